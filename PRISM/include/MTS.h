@@ -1,6 +1,8 @@
 #ifndef MTS_MTSAPI_H
 #define MTS_MTSAPI_H
 
+#include <future>
+#include <memory>
 #include "MTSImpl.h"
 #include "common.h"
 
@@ -8,30 +10,71 @@ class MTS {
     private:
 	MTSImpl *mts;
     public:
-	MTS(int numa) {
-	    mts = new MTSImpl(numa);
+	MTS(int numa, const mts_vs_config_t *vs_config = nullptr) {
+	    mts = new MTSImpl(numa, vs_config);
 	}
 	~MTS() {
 	    delete mts;
 	}
-	bool insert(Key_t key, Val_t val) {
+	/* values take 0 to MTS_VAL_MAX_SIZE bytes; longer ones are rejected */
+	bool insert(Key_t key, const Value_t &val) {
 	    return mts->insert(key, val);
 	}
-	bool update(Key_t key, Val_t val) {
+	bool update(Key_t key, const Value_t &val) {
 	    return mts->update(key, val);
 	}
-	Val_t lookup(Key_t key) {
+	/* inserts or updates n pairs with one persist per oplog batch */
+	uint64_t multi_put(const Key_t *keys, const Value_t *vals, size_t n) {
+	    return mts->multi_put(keys, vals, n);
+	}
+	/* an empty value if the key is not found */
+	Value_t lookup(Key_t key) {
 	    return mts->lookup(key);
 	}
+	/* cb may run on an I/O completer thread; keep it short */
+	void lookup_async(Key_t key, lookup_cb_t cb) {
+	    mts->lookup_async(key, std::move(cb));
+	}
+	void lookup_async(const Key_t *keys, size_t n, lookup_cb_t cb) {
+	    mts->lookup_async(keys, n, std::move(cb));
+	}
+	std::future<Value_t> lookup_async(Key_t key) {
+	    auto promise = std::make_shared<std::promise<Value_t>>();
+	    std::future<Value_t> future = promise->get_future();
+	    mts->lookup_async(key, [promise](Key_t, const Value_t &val, bool) {
+		promise->set_value(val);
+	    });
+	    return future;
+	}
+	uint64_t multi_get(const Key_t *keys, size_t n, Value_t *out) {
+	    return mts->multi_get(keys, n, out);
+	}
 	bool remove(Key_t key) {
 	    return mts->remove(key);
 	}
-	uint64_t scan(Key_t startKey, int range, std::vector<Val_t> &result) {
+	uint64_t scan(Key_t startKey, int range, std::vector<Value_t> &result) {
 	    return mts->scan(startKey, range, result);
 	}
+	typedef MTSIterator Iterator;
+	/* it.next(key, val) returns the pairs from startKey on, in key order;
+	 * the iterator keeps the caller's read ring busy until destroyed */
+	Iterator seek(Key_t startKey) {
+	    return mts->seek(startKey);
+	}
 	bool recover(Key_t startKey) {
 	    return mts->recover(startKey);
 	}
+	/* parallel restart from the AddressTables, before any other operation */
+	uint64_t recover() {
+	    return mts->recover();
+	}
+	/* latency histograms and counters of all threads since reset_stats() */
+	void get_stats(mts_stats_t *stats) {
+	    mts->get_stats(stats);
+	}
+	void reset_stats() {
+	    mts->reset_stats();
+	}
 	void registerThread() {
 	    mts->registerThread();
 	}
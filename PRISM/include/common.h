@@ -1,11 +1,91 @@
 #ifndef MTS_COMMON_H
 #define MTS_COMMON_H
 #include <cstdint>
+#include <cstring>
+#include <limits>
+#include <functional>
+#include <string>
+#include <string_view>
 #include "../lib/TSOpLog/debug.h"
 #include "../lib/TSOpLog/nvm.h"
 
+#ifdef MTS_STRING_KEY
+/* byte-string keys of up to KEYLENGTH - 1 bytes, shared with pactree's
+ * STRINGKEY build; enabled with -DMTS_STRING_KEY=ON */
+#ifndef STRINGKEY
+#error "MTS_STRING_KEY needs pactree built with STRINGKEY"
+#endif
+#include "../lib/pactree/include/common.h"
+#else
 typedef uint64_t Key_t;
+#endif
 typedef uint64_t Val_t;
+/* a value is a byte string of up to MTS_VAL_MAX_SIZE bytes; Val_t is the
+ * 8-byte payload KeyIndex keeps per key */
+typedef std::string Value_t;
+
+#ifdef MTS_STRING_KEY
+static inline bool key_is_max(const Key_t &key) {
+    const unsigned char *data = (const unsigned char *)key.getData();
+    for(size_t i = 0; i < KEYLENGTH - 1; i++) {
+	if(data[i] != 0xff)
+	    return false;
+    }
+    return true;
+}
+
+/* the smallest key greater than the given one */
+static inline Key_t key_successor(const Key_t &key) {
+    unsigned char data[KEYLENGTH];
+    size_t len = KEYLENGTH - 1;
+    memcpy(data, key.getData(), KEYLENGTH);
+    for(ssize_t i = KEYLENGTH - 2; i >= 0; i--) {
+	if(++data[i] != 0)
+	    break;
+    }
+    while(len > 0 && data[len - 1] == 0)
+	len--;
+
+    Key_t next;
+    next.set((const char *)data, len);
+    return next;
+}
+
+namespace std {
+template <> struct hash<Key_t> {
+    size_t operator()(const Key_t &key) const {
+	return hash<string_view>()(string_view(key.getData(), KEYLENGTH));
+    }
+};
+}
+#else
+static inline bool key_is_max(const Key_t &key) {
+    return key == std::numeric_limits<Key_t>::max();
+}
+
+static inline Key_t key_successor(const Key_t &key) {
+    return key + 1;
+}
+#endif
+
+/* completion callback of asynchronous lookups: (key, value, found) */
+typedef std::function<void(Key_t, const Value_t &, bool)> lookup_cb_t;
+
+typedef struct at_entry at_entry_t;
+
+/* an asynchronous lookup waiting for its value */
+typedef struct lookup_ctx {
+    Key_t key;
+    at_entry_t *at_entry;
+    lookup_cb_t cb;
+} lookup_ctx_t;
+
+/* a read request handed over to the I/O combiner */
+typedef struct aio_req {
+    at_entry_t *at_entry;
+    lookup_ctx_t *ctx; /* nullptr if nobody waits for the value */
+    uint64_t start; /* tsc when a lookup queued the read, 0 if untimed */
+} aio_req_t;
 
 class OpForm {
     public:
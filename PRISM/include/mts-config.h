@@ -3,7 +3,10 @@
 #include "arch.h"
 
 #define MTS_THREAD_NUM 32
+/* values are byte strings of up to MTS_VAL_MAX_SIZE bytes; the benchmark
+ * driver (index.h) writes values of KV_SIZE bytes */
 #define KV_SIZE 1024UL
+#define MTS_VAL_MAX_SIZE 8192UL
 #define SECTOR_SIZE 512UL 
 
 /* KeyIndex */
@@ -28,47 +31,161 @@
 #define MTS_OPLOG_HIGH_MARK (MTS_OPLOG_SIZE)
 /* bytes */
 #define MTS_OPLOG_LOW_MARK 0 
+/* a PWB switches halves and starts reclaiming once this full (bytes) */
+#define MTS_OPLOG_SWITCH_MARK (MTS_OPLOG_HIGH_MARK / 4 * 3)
+/* an oplog entry is a header of MTS_OPLOG_META_SIZE followed by its value,
+ * padded to a cache line. A value of up to MTS_OPLOG_OVERWRITE_MAX bytes
+ * gets room for a second copy, so that an update of the same length can
+ * rewrite it in place; MTS_OPLOG_WRITE_SIZE is what is written of it. */
+#define MTS_OPLOG_META_SIZE \
+    ((sizeof(Key_t) + 2 * sizeof(void *) + 2 * sizeof(uint32_t) + L1_CACHE_BYTES - 1) / L1_CACHE_BYTES * L1_CACHE_BYTES)
+#define MTS_OPLOG_OVERWRITE_MAX 256UL
+#define MTS_OPLOG_VAL_SPAN(len) \
+    (((len) + L1_CACHE_BYTES - 1) / L1_CACHE_BYTES * L1_CACHE_BYTES)
+#define MTS_OPLOG_WRITE_SIZE(len) \
+    ((MTS_OPLOG_META_SIZE + (len) + L1_CACHE_BYTES - 1) / L1_CACHE_BYTES * L1_CACHE_BYTES)
+#define MTS_OPLOG_ENTRY_SIZE(len) \
+    (MTS_OPLOG_WRITE_SIZE(len) + ((len) <= MTS_OPLOG_OVERWRITE_MAX ? MTS_OPLOG_VAL_SPAN(len) : 0))
+/* reclaim workers shared by all PWBs */
+#define MTS_RECLAIM_WORKER_NUM 8
 
 /* Value Storage */
+/* devices used unless mts_vs_config_t sets up to MTS_VS_MAX_NUM at startup */
 #define MTS_VS_NUM 8
+#define MTS_VS_MAX_NUM 16
 #define MTS_VS_PATH "/mnt/hpt"
 #define MTS_VS_DISK_NUM 8
-#define MTS_VS_ENTRY_SIZE sizeof(vs_entry_t)
-#define MTS_VS_ENTRIES_PER_CHUNK (MTS_VS_CHUNK_SIZE / MTS_VS_ENTRY_SIZE) 
-#define MTS_VS_G_SIZE (MTS_VS_NUM * 512UL * 1024UL * 1024UL * 1024UL)
-#define MTS_VS_SIZE (MTS_VS_G_SIZE / MTS_VS_NUM)
+/* a chunk packs up to MTS_VS_ENTRIES_PER_CHUNK records, as many as the
+ * smallest record allows, in key order ahead of a trailer; the slot_end of
+ * its records lie right before the trailer, so the data of a chunk ends
+ * MTS_VS_TRAILER_SIZE(nr_slots) bytes before the chunk does. A vs_offset
+ * counts slots over all chunks of a device, in MTS_VS_OFFSET_BITS signed
+ * bits next to the VS id. */
+#define MTS_VS_OFFSET_BITS 56
+#define MTS_VS_RECORD_ALIGN 16UL
+#define MTS_VS_RECORD_SIZE(len) \
+    ((sizeof(vs_entry_t) + (len) + MTS_VS_RECORD_ALIGN - 1) / MTS_VS_RECORD_ALIGN * MTS_VS_RECORD_ALIGN)
+#define MTS_VS_ENTRIES_PER_CHUNK (MTS_VS_CHUNK_SIZE / MTS_VS_RECORD_SIZE(0))
+#define MTS_VS_TRAILER_POS (MTS_VS_CHUNK_SIZE - sizeof(vs_chunk_trailer_t))
+#define MTS_VS_TRAILER_SIZE(nr_slots) \
+    ((sizeof(vs_chunk_trailer_t) + (nr_slots) * sizeof(uint16_t) + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_SIZE)
+#define MTS_VS_DATA_LIMIT(nr_slots) (MTS_VS_CHUNK_SIZE - MTS_VS_TRAILER_SIZE(nr_slots))
+#define MTS_VS_DATA_SIZE MTS_VS_DATA_LIMIT(1)
+/* of each device */
+#define MTS_VS_SIZE (512UL * 1024UL * 1024UL * 1024UL)
 #define MTS_VS_CHUNK_SIZE (512UL * 1024UL)
 /* w/ io_uring, 512KB is the best size 128KB * QD(4) */
 #define MTS_VS_CHUNK_NUM (MTS_VS_SIZE / MTS_VS_CHUNK_SIZE)
 #define MTS_VS_HIGH_MARK (MTS_VS_CHUNK_NUM * 75 / 100)
 #define MTS_VS_LOW_MARK (MTS_VS_CHUNK_NUM * 65 / 100)
+/* Background GC of ValueStorage runs above MTS_VS_HIGH_MARK and stops below
+ * MTS_VS_LOW_MARK. Every chunk written by the foreground lets it read
+ * MTS_VS_GC_CREDIT victims; the limit is lifted above MTS_VS_GC_URGENT_MARK
+ * or when no chunk has been written for MTS_VS_GC_IDLE_US. */
+#define MTS_VS_GC_URGENT_MARK (MTS_VS_CHUNK_NUM * 90 / 100)
+#define MTS_VS_GC_CREDIT 4
+#define MTS_VS_GC_MAX_CREDIT 64
+#define MTS_VS_GC_IDLE_US 1000
+/* free chunks left to GC; the foreground waits for GC below this */
+#define MTS_VS_GC_RESERVED_CHUNKS 2
+/* free chunks a writer takes from the shared free list at once */
+#define MTS_VS_CHUNK_RESERVE 4
+/* reclaimed and evicted entries fill separate chunks by temperature: an
+ * at_entry updated MTS_VS_HOT_UPDATES times lately is hot. A stream of 1
+ * mixes them again. */
+#define MTS_VS_STREAM_NUM 2
+#define MTS_VS_HOT_UPDATES 2
+/* at_entries tracked by the update sketch */
+#define MTS_VS_HEAT_SKETCH_SIZE (1UL << 20)
+/* reclaimed chunks go to the cheaper of two devices sampled by weight; a
+ * new latency sample moves the average of a device by 1/2^this */
+#define MTS_VS_LAT_EWMA_SHIFT 3
+/* the chunk state of every VS is checkpointed to NVM this often */
+#define MTS_VS_MAP_PATH "/mnt/pmem"
+#define MTS_VS_CKPT_INTERVAL_US 1000000
+#define MTS_VS_MAP_MAGIC 0x5653504d41500004UL
+/* chunks a checkpoint copies under the chunk locks before writing them */
+#define MTS_VS_CKPT_BATCH 256
+/* GC buckets chunks by their valid bytes in units of this */
+#define MTS_VS_GC_BUCKET_SIZE 4096UL
+#define MTS_VS_GC_BUCKET_NUM (MTS_VS_DATA_SIZE / MTS_VS_GC_BUCKET_SIZE + 2)
+/* locks striping the validity state of the chunks */
+#define MTS_VS_CHUNK_LOCK_NUM 64
 /* Number of CHUNKS, not bytes */
 
-#define READ_IO_SIZE 4096UL
+/* buffer of a read slot: the sectors, or the frames, covering the largest
+ * record; a point read only fetches those of its record */
+#define READ_IO_SIZE 16384UL
+/* scan() merges reads of records of the same chunk lying at most this many
+ * bytes apart */
+#define MTS_VS_SCAN_MERGE_GAP 4096UL
+#define MTS_VS_SCAN_MAX_IO_SIZE (MTS_VS_CHUNK_SIZE)
+/* keys an iterator takes from KeyIndex at a time; one batch must fit
+ * in the R_QD slots of a read ring */
+#define MTS_SCAN_BATCH (R_QD)
+/* ValueStorage chunks are compressed by MTS_VS_CODEC in frames; a read
+ * fetches and inflates only the frames holding its record */
+#define MTS_VS_CODEC_NONE 0
+#define MTS_VS_CODEC_ZLIB 1
+#define MTS_VS_CODEC MTS_VS_CODEC_NONE
+#define MTS_VS_FRAME_SIZE 4096UL
+#define MTS_VS_FRAMES_PER_CHUNK (MTS_VS_CHUNK_SIZE / MTS_VS_FRAME_SIZE)
+#define MTS_VS_READ_FRAMES (READ_IO_SIZE / MTS_VS_FRAME_SIZE)
+#define MTS_VS_TRAILER_MAGIC 0x5653545241494c02UL
 
 /* io_uring */
 #define W_QD 4
+/* chunks of a writer in flight: one is filled while the others are written */
+#define MTS_VS_W_DEPTH 2
 #define R_QD 64
 #define GC_QD 8
 #define IO_URING_WRITE	    1
 #define IO_URING_READ	    1
 #define IO_URING_SCAN	    1
 #define IO_URING_GC	    1
-#define IO_URING_WRING_NUM MTS_THREAD_NUM
-#define IO_URING_RRING_NUM MTS_THREAD_NUM
+/* ValueStorage writers: a slot per PWB, then one per cache thread */
+#define MTS_VS_WRITER_NUM (MTS_OPLOG_NUM + MTS_DRAMCACHE_NUM)
+#define MTS_VS_CACHE_WRITER(shard) (MTS_OPLOG_NUM + (shard))
+#define IO_URING_WRING_NUM MTS_VS_WRITER_NUM
+/* read ring 0 of a VS serves the lookup combiner and its completers; a
+ * thread reaping its own reads (scan, multi_get) does so on its own ring */
+#define IO_URING_RRING_NUM (MTS_THREAD_NUM + 1)
+#define MTS_LOOKUP_RING 0
+#define MTS_THREAD_RING(thread_id) ((thread_id) + 1)
 #define IO_URING_SRING_NUM MTS_THREAD_NUM
 #define IO_COMPLETER_NUM 8
+/* IO completers and cache threads poll for this long after their last work
+ * and then block until woken, rechecking every MTS_POLL_SLEEP_MS */
+#define MTS_POLL_SPIN_US 50
+#define MTS_POLL_SLEEP_MS 1
 
 /* DRAM Cache */
 #define MTS_DRAMCACHE 1
-#define MTS_DRAMCACHE_NUM 1
+/* cache threads; entries are sharded across them by at_entry */
+#define MTS_DRAMCACHE_NUM 4
 #define MTS_DRAMCACHE_SIZE ((20UL * 1024UL * 1024UL * 1024UL))
 #define MTS_DRAMCACHE_RATIO 16UL
 #define MTS_ACTIVE_LIST_SIZE (MTS_DRAMCACHE_SIZE / MTS_DRAMCACHE_RATIO)
 #define MTS_INACTIVE_LIST_SIZE (MTS_DRAMCACHE_SIZE - MTS_ACTIVE_LIST_SIZE)
 #define MTS_RECLAIM_PAGES_NUM 512
-#define MTS_CACHEQUEUE_NUM MTS_THREAD_NUM
-/* Set to the same value as the number of MTS thread*/
+/* one bounded MPSC ring of batches per cache thread (< 65535 for boost::lockfree) */
+#define MTS_CACHEQUEUE_NUM MTS_DRAMCACHE_NUM
+#define MTS_CACHEQUEUE_SIZE 4096
+/* TinyLFU admission to the DRAM cache */
+#define MTS_DC_ADMISSION 1
+#define MTS_DC_SKETCH_DEPTH 4
+/* scanned items are admitted once seen this often */
+#define MTS_DC_SCAN_ADMIT_FREQ 2
+/* expected size of a cached item, for sizing the admission sketch */
+#define MTS_DC_ITEM_SIZE 1024UL
+/* slab pools of cq_entry and completion vectors, and of MTS_SC_NUM size
+ * classes for cache entries and slot directories: two per power of two
+ * from MTS_SC_MIN_SIZE */
+#define MTS_SLAB_SIZE (2UL << 20)
+#define MTS_SLAB_BATCH 64
+#define MTS_SLAB_NODE_NUM 8
+#define MTS_SC_MIN_SIZE 64UL
+#define MTS_SC_NUM 20
 
 /* Value location */
 enum {
@@ -99,6 +216,10 @@ enum { OL_INSERT,
     OL_UPDATE,
 };
 
+enum { VS_STREAM_COLD,
+    VS_STREAM_HOT,
+};
+
 enum {KEYINDEX,
     OPLOG,
     ADDRESSTABLE,
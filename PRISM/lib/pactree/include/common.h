@@ -13,7 +13,9 @@
 #define MAX_NUMA 2
 //#define STRINGKEY
 #define WORKER_THREAD_PER_NUMA 1
+#ifndef KEYLENGTH
 #define KEYLENGTH 32
+#endif
 //#define SYNC
 
 //#define PACTREE_ENABLE_STATS
@@ -25,25 +27,31 @@ private:
     char data[keySize];
     size_t keyLength = 0;
 public:
+    static_assert(keySize >= sizeof(uint64_t), "a key holds at least an 8-byte prefix");
+
     StringKey() { memset(data, 0x00, keySize);}
-    StringKey(const StringKey &other) {
-        memcpy(data, other.data, keySize);
-    }
     StringKey(const char bytes[]) {set(bytes, strlen(bytes));}
     StringKey(int k) {
         setFromString(std::to_string(k));
     }
-    inline StringKey &operator=(const StringKey &other) {
-        memcpy(data, other.data, keySize);
-//		keyLength = other.keyLength;
-        return *this;
+
+    /* Keys are zero-padded byte strings ordered by memcmp, so binary keys
+     * work too. The first 8 bytes are compared as one big-endian word,
+     * which settles most comparisons without touching the rest. */
+    inline int compare(const StringKey<keySize> &other) const {
+        uint64_t a, b;
+        memcpy(&a, data, sizeof(a));
+        memcpy(&b, other.data, sizeof(b));
+        if (a != b)
+            return __builtin_bswap64(a) < __builtin_bswap64(b) ? -1 : 1;
+        return memcmp(data + sizeof(a), other.data + sizeof(b), keySize - sizeof(a));
     }
-    inline bool operator<(const StringKey<keySize> &other) { return strcmp(data, other.data) < 0;}
-    inline bool operator>(const StringKey<keySize> &other) { return strcmp(data, other.data) > 0;}
-    inline bool operator==(const StringKey<keySize> &other) { return strcmp(data, other.data) == 0;}
-    inline bool operator!=(const StringKey<keySize> &other) { return !(*this == other);}
-    inline bool operator<=(const StringKey<keySize> &other) { return !(*this > other);}
-    inline bool operator>=(const StringKey<keySize> &other) {return !(*this < other);}
+    inline bool operator<(const StringKey<keySize> &other) const { return compare(other) < 0;}
+    inline bool operator>(const StringKey<keySize> &other) const { return compare(other) > 0;}
+    inline bool operator==(const StringKey<keySize> &other) const { return compare(other) == 0;}
+    inline bool operator!=(const StringKey<keySize> &other) const { return !(*this == other);}
+    inline bool operator<=(const StringKey<keySize> &other) const { return !(*this > other);}
+    inline bool operator>=(const StringKey<keySize> &other) const {return !(*this < other);}
 
     size_t size() const {
         if (keyLength)
@@ -59,7 +67,7 @@ public:
             data[keySize - 1] = '\0';
             keyLength = keySize;
         } else {
-            strcpy(data, key.c_str());
+            memcpy(data, key.c_str(), key.size());
             keyLength = key.size();
         }
         return;
@@ -67,9 +75,9 @@ public:
 
     inline void set(const char bytes[], const std::size_t length) {
         assert(length <= keySize-1);
+        memset(data, 0, keySize);
         memcpy(data, bytes, length);
- //       keyLength = length;
-        data[length] = '\0';
+        keyLength = length;
     }
     const char* getData() const { return data;}
     //friend ostream & operator << (ostream &out, const StringKey<keySize> &k);
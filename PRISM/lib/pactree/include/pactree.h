@@ -28,8 +28,9 @@ public:
     Val_t remove(Key_t key) {
         return pt->remove(key);
     }
-    uint64_t scan(Key_t startKey, int range, std::vector<Val_t> &result) {
-        return pt->scan(startKey, range, result);
+    // endKey, if given, receives the last key scanned
+    uint64_t scan(Key_t startKey, int range, std::vector<Val_t> &result, Key_t *endKey = nullptr) {
+        return pt->scan(startKey, range, result, endKey);
     }
     void registerThread() {
         pt->registerThread();
@@ -43,7 +43,7 @@ public:
 			idx = new(idxPtr.getVaddr()) ART_ROWEX::Tree([] (TID tid,Key &key){
 	               key.set(reinterpret_cast<char*>(tid), KEYLENGTH);
 					});
-			std::string maxString= "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~";
+			std::string maxString(KEYLENGTH - 1, '\xff');
            curMin.setFromString(maxString);
 #endif
 		}
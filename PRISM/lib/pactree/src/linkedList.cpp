@@ -60,7 +60,7 @@ ListNode* LinkedList::initialize() {
     head->setCur(headPtr);
 #ifdef STRINGKEY
 	std::string minString= "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0";
-    std::string maxString= "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~";
+    std::string maxString(KEYLENGTH - 1, '\xff');
     Key_t max;
     max.setFromString(maxString);
     Key_t min;
@@ -333,7 +333,7 @@ ListNode *LinkedList::getHead() {
     return head;
 }
 
-uint64_t LinkedList::scan(Key_t startKey, int range, std::vector<Val_t> &rangeVector, ListNode *head) {
+uint64_t LinkedList::scan(Key_t startKey, int range, std::vector<Val_t> &rangeVector, ListNode *head, Key_t *endKey) {
     restart:
     ListNode* cur = head;
     rangeVector.clear();
@@ -360,7 +360,7 @@ uint64_t LinkedList::scan(Key_t startKey, int range, std::vector<Val_t> &rangeVe
 		/*resultBuffer.clear();*/
 	if (cur->getDeleted())
            goto restart;
-        end = cur->scan(startKey, range, rangeVector, readVersion,genId);
+        end = cur->scan(startKey, range, rangeVector, readVersion,genId, endKey);
         if(!cur->readUnlock(readVersion)){
 			continue;
 		}
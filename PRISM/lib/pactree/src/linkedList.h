@@ -25,7 +25,7 @@ public:
     bool remove(Key_t key, ListNode* head);
     bool probe(Key_t key, ListNode* head);
     bool lookup(Key_t key, Val_t &value, ListNode* head);
-    uint64_t scan(Key_t startKey, int range, std::vector<Val_t> &rangeVector, ListNode *head);
+    uint64_t scan(Key_t startKey, int range, std::vector<Val_t> &rangeVector, ListNode *head, Key_t *endKey = nullptr);
     void print(ListNode *head);
     uint32_t size(ListNode* head);
     ListNode* getHead();
@@ -826,7 +826,7 @@ void ListNode::print() {
     std::cout << "::"<<std::endl;
 }
 
-bool ListNode::scan(Key_t startKey, int range, std::vector<Val_t> &rangeVector, uint64_t writeVersion, uint64_t genId) {
+bool ListNode::scan(Key_t startKey, int range, std::vector<Val_t> &rangeVector, uint64_t writeVersion, uint64_t genId, Key_t *endKey) {
     restart:
     ListNode* next = nextPtr.getVaddr();
     if (next == nullptr)
@@ -844,6 +844,7 @@ bool ListNode::scan(Key_t startKey, int range, std::vector<Val_t> &rangeVector,
     if (startKey > min) startIndex = permuterLowerBound(startKey);
     for (uint8_t i = startIndex; i < numEntries && todo > 0; i++) {
         rangeVector.push_back(keyArray[permuter[i]].second);
+        if (endKey != nullptr) *endKey = keyArray[permuter[i]].first;
         todo--;
     }
     return rangeVector.size() == range;
@@ -64,7 +64,7 @@ public:
     bool remove(Key_t key, uint64_t genId);
     bool probe(Key_t key); //return True if key exists
     bool lookup(Key_t key, Val_t &value);
-    bool scan(Key_t startKey, int range, std::vector<Val_t> &rangeVector, uint64_t writeVersion, uint64_t genId);
+    bool scan(Key_t startKey, int range, std::vector<Val_t> &rangeVector, uint64_t writeVersion, uint64_t genId, Key_t *endKey = nullptr);
     void print();
     bool checkRange(Key_t key);
     bool checkRangeLookup(Key_t key);
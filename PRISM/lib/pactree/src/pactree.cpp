@@ -448,10 +448,10 @@ int pactreeImpl::getThreadNuma() {
         return threadNumaNode;
 }
 
-uint64_t pactreeImpl::scan(Key_t &startKey, int range, std::vector<Val_t> &result) {
+uint64_t pactreeImpl::scan(Key_t &startKey, int range, std::vector<Val_t> &result, Key_t *endKey) {
     ListNode *jumpNode = getJumpNode(startKey);
 
-    return dl.scan(startKey, range, result, jumpNode);
+    return dl.scan(startKey, range, result, jumpNode, endKey);
 }
 
 void pactreeImpl::registerThread() {
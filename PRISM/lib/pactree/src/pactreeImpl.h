@@ -45,7 +45,7 @@ public:
     ListNode* getJumpNodewithLock(Key_t &key, void** node);
     bool JumpNodewithUnLock(void* node);
 #endif
-    uint64_t scan(Key_t &startKey, int range, std::vector<Val_t> &result);
+    uint64_t scan(Key_t &startKey, int range, std::vector<Val_t> &result, Key_t *endKey = nullptr);
     static SearchLayer* createSearchLayer(root_obj *root, int threadId);
     static int getThreadNuma();
     void init(int numNuma, root_obj* root) ;
@@ -4,11 +4,11 @@
     end = read_tscp() - start;      \
 }
 
-int apply_ops(aio_struct_t *l, aio_thread_state_t *st_thread, at_entry_t *(*sfunc)(at_entry_t *, std::vector<at_entry_t *> *),
-	at_entry_t *at_entry, ValueStorage *valuestorage, int ring_idx) {
+int apply_ops(aio_struct_t *l, aio_thread_state_t *st_thread, at_entry_t *(*sfunc)(at_entry_t *, lookup_ctx_t *, std::vector<aio_req_t> *),
+	at_entry_t *at_entry, lookup_ctx_t *ctx, ValueStorage *valuestorage, int ring_idx) {
 
-    std::vector<at_entry_t *> *dst_at_entry_vec = valuestorage->dst_at_entry_vec[ring_idx];
-    std::vector<at_entry_t *> *src_at_entry_vec = valuestorage->src_at_entry_vec[ring_idx];
+    std::vector<aio_req_t> *dst_at_entry_vec = valuestorage->dst_at_entry_vec[ring_idx];
+    std::vector<aio_req_t> *src_at_entry_vec = valuestorage->src_at_entry_vec[ring_idx];
 
     volatile aio_node_t *p; 
     volatile aio_node_t *cur;
@@ -23,6 +23,7 @@ int apply_ops(aio_struct_t *l, aio_thread_state_t *st_thread, at_entry_t *(*sfun
 
     cur = (aio_node_t *)SWAP(&l->tail, next_node);
     cur->tmp = at_entry;
+    cur->ctx = ctx;
     cur->next = (aio_node_t *)next_node;
     st_thread->next = (aio_node_t *)cur;
 
@@ -40,7 +41,7 @@ int apply_ops(aio_struct_t *l, aio_thread_state_t *st_thread, at_entry_t *(*sfun
 	    counter++;
 	    ts_trace(TS_INFO, "apply_ops | %p \n", p->tmp);
 	    tmp_next = p->next;
-	    p->arg_ret = sfunc(p->tmp, src_at_entry_vec);
+	    p->arg_ret = sfunc(p->tmp, p->ctx, src_at_entry_vec);
 	    NonTSOFence();
 	    p->completed = true;
 	    NonTSOFence();
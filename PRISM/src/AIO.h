@@ -19,6 +19,7 @@ typedef struct aio_node {
     struct aio_node *next;
     at_entry_t *arg_ret;
     at_entry_t *tmp;
+    lookup_ctx_t *ctx;
     int locked;
     int completed;
     char align[PAD_CACHE(sizeof(half_aio_node))];
@@ -57,15 +58,16 @@ inline void *get_aligned_memory(size_t align, size_t size) {
 }
 
 int apply_ops(aio_struct_t *l, aio_thread_state_t *st_thread,
-	at_entry_t *(*sfunc)(at_entry_t *, std::vector<at_entry_t *> *), at_entry_t *at_entry, ValueStorage *valuestorage, int ring_idx);
+	at_entry_t *(*sfunc)(at_entry_t *, lookup_ctx_t *, std::vector<aio_req_t> *),
+	at_entry_t *at_entry, lookup_ctx_t *ctx, ValueStorage *valuestorage, int ring_idx);
 int apply_ops(aio_struct_t *l, aio_thread_state_t *st_thread,
 	at_entry_t *(*sfunc)(Key_t , KeyIndex *, std::vector<at_entry_t *> *), 
 	Key_t key, KeyIndex *keyindex, std::vector<at_entry_t *> *at_entry_vec);
 void aio_struct_init(aio_struct_t *l);
 void aio_thread_state_init(aio_thread_state_t *st_thread);
 
-inline static at_entry_t *batching_io(at_entry_t *at_entry, std::vector<at_entry_t *> *cur_at_entry_vec) {
-    cur_at_entry_vec->push_back(at_entry);
+inline static at_entry_t *batching_io(at_entry_t *at_entry, lookup_ctx_t *ctx, std::vector<aio_req_t> *cur_at_entry_vec) {
+    cur_at_entry_vec->push_back({at_entry, ctx, read_tscp()});
     return at_entry; 
 }
 
@@ -1,4 +1,5 @@
 #include "AddressTable.h"
+#include "ValueStorage.h"
 
 #define MAX_AT_ENTRY_NUM (MTS_AT_SIZE / sizeof(at_entry_t))
 
@@ -139,25 +140,82 @@ bool AddressTable::free(at_entry_t *at_entry) {
     return true;
 }
 
+/*
+ * Scans the whole table once: the slot of every entry in the value storage
+ * is marked in its VS by recover_slot(), values of the DRAM cache fall back
+ * to their VS copy, and the allocation state (next_empty_at_offset and the free list)
+ * is rebuilt from the clean entries. Returns the number of live entries.
+ */
+uint64_t AddressTable::recover() {
+    uint64_t nr_live = 0;
+    int64_t last_used = -1;
+
+    for(uint64_t offset = 0; offset < MTS_AT_ENTRY_NUM; offset++) {
+	at_entry_t *at_entry = &at_starting_addr[offset];
+	int tag = get_tag((intptr_t)at_entry->val_addr);
+	vs_idx_t vs_idx = at_entry->vs_idx;
+
+	if(vs_idx.vs_id > -1 && vs_idx.vs_offset > -1) {
+	    /* the value is on a VS which is not set up this time */
+	    if(vs_idx.vs_id >= g_vsNum) {
+		ts_trace(TS_ERROR, "[AT_RECOVER] id: %u offset: %lu is on ValueStorage %d, but only %d are set up\n",
+			at_id, offset, vs_idx.vs_id, g_vsNum);
+		exit(EXIT_FAILURE);
+	    }
+	    /* a cached value does not survive a restart */
+	    if(tag == DCACHE_VAL)
+		at_entry->val_addr = nullptr;
+	    g_perNumaValueStorage[vs_idx.vs_id]->recover_slot(vs_idx.vs_offset);
+	} else if(tag != OPLOG_VAL) {
+	    continue;
+	}
+	nr_live++;
+	last_used = offset;
+    }
+    pmem_persist((void *)at_starting_addr, (last_used + 1) * sizeof(at_entry_t));
+
+    spinlock.lock();
+    free_at_offset_list->clear();
+    for(int64_t offset = 0; offset < last_used; offset++) {
+	at_entry_t *at_entry = &at_starting_addr[offset];
+	if(at_entry->vs_idx.vs_offset < 0 && get_tag((intptr_t)at_entry->val_addr) != OPLOG_VAL)
+	    free_at_offset_list->push_back(offset);
+    }
+    next_empty_at_offset = last_used + 1;
+    whole_file_written = (next_empty_at_offset == MTS_AT_ENTRY_NUM);
+    spinlock.unlock();
+
+    ts_trace(TS_INFO, "[AT_RECOVER] id: %u live: %lu next_empty: %lu free: %lu\n",
+	    at_id, nr_live, next_empty_at_offset, free_at_offset_list->size());
+    return nr_live;
+}
+
 op_entry_t *AddressTable::get_ol_entry(at_entry_t *at_entry) {
     op_entry_t *op_entry = (op_entry_t *)at_entry->val_addr;
     return op_entry;
 }
 
-void AddressTable::link_to_ol(at_entry_t *at_entry, op_entry_t *op_entry) {
+void AddressTable::link_to_ol(at_entry_t *at_entry, op_entry_t *op_entry, bool drain) {
     intptr_t tagged_entry = put_tagged_ptr((intptr_t)op_entry, OPLOG_VAL);
+    if(!drain) {
+	pmem_memcpy((void *)&at_entry->val_addr, (void *)&tagged_entry, sizeof(op_entry), PMEM_F_MEM_NONTEMPORAL | PMEM_F_MEM_NODRAIN);
+	return;
+    }
     pmem_memcpy((void *)&at_entry->val_addr, (void *)&tagged_entry, sizeof(op_entry), PMEM_F_MEM_NONTEMPORAL);
     _mm_sfence();
 }
 
-void AddressTable::link_to_ol(at_entry_t *at_entry, op_entry_t *op_entry, int *past_vs_id, int *past_vs_offset) {
-    *past_vs_id = at_entry->vs_idx.vs_id;
-    *past_vs_offset = at_entry->vs_idx.vs_offset;
+void AddressTable::link_to_ol(at_entry_t *at_entry, op_entry_t *op_entry, vs_idx_t *past_vs_idx, bool drain) {
+    *past_vs_idx = at_entry->vs_idx;
     vs_idx_t new_vs_idx = {-1, -1};
 
     at_entry_t *tagged_entry = new at_entry_t;
     tagged_entry->val_addr = (op_entry_t *)put_tagged_ptr((intptr_t)op_entry, OPLOG_VAL);
     tagged_entry->vs_idx = new_vs_idx;
+    if(!drain) {
+	pmem_memcpy((void *)at_entry, (void *)tagged_entry, sizeof(at_entry_t), PMEM_F_MEM_NONTEMPORAL | PMEM_F_MEM_NODRAIN);
+	return;
+    }
     pmem_memcpy((void *)at_entry, (void *)tagged_entry, sizeof(at_entry_t), PMEM_F_MEM_NONTEMPORAL);
     _mm_sfence();
 }
@@ -168,7 +226,7 @@ at_entry_t *AddressTable::get_at_entry(at_entry_t *mem, size_t offset) {
 
 int AddressTable::get_at_id(at_entry_t *at_entry) {
     if(((uintptr_t)at_entry >= (uintptr_t)&at_starting_addr[0]) &&
-	((uintptr_t)at_entry <= (uintptr_t)&at_starting_addr[MTS_AT_ENTRY_NUM]))
+	((uintptr_t)at_entry < (uintptr_t)&at_starting_addr[MTS_AT_ENTRY_NUM]))
     return at_id;
     else return -1;
 }
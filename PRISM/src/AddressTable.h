@@ -26,9 +26,10 @@ typedef struct at_idx {
     uint32_t at_offset;
 } at_idx_t;
 
+/* a slot of a ValueStorage, in one word; -1 in both if there is none */
 typedef struct vs_idx {
-    int vs_id;
-    int vs_offset;
+    int64_t vs_id : 8;
+    int64_t vs_offset : MTS_VS_OFFSET_BITS;
 } vs_idx_t;
 
 typedef struct dummy_entry{
@@ -90,11 +91,14 @@ class AddressTable {
 	int get_val_pos(at_entry_t *at_entry, int *cur_vs_id);
 
 	op_entry_t *get_ol_entry(at_entry_t *at_entry);
-	void link_to_ol(at_entry_t *at_entry_addr, op_entry_t *oplog_addr);
-	void link_to_ol(at_entry_t *at_entry_addr, op_entry_t *oplog_addr, int *past_vs_id, int *past_vs_offset);
+	/* !drain leaves the fence to the caller (group commit) */
+	void link_to_ol(at_entry_t *at_entry_addr, op_entry_t *oplog_addr, bool drain = true);
+	void link_to_ol(at_entry_t *at_entry_addr, op_entry_t *oplog_addr, vs_idx_t *past_vs_idx, bool drain = true);
 	void link_to_vs(void *at_entry_addr, void *vs_addr, size_t vs_chunk_offset, size_t vs_entry_offset);
 
 	void build_bitmap(at_idx_t at_idx);
+	/* rebuilds the allocation state and marks the live VS slots */
+	uint64_t recover();
 
 	bool is_valid(void *at_entry_addr, ValueStorage *vs);
 	int get_at_id(at_entry_t *at_entry);
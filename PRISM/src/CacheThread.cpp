@@ -1,11 +1,12 @@
 #include "CacheThread.h"
 extern std::vector<ValueStorage *> g_perNumaValueStorage;
-std::random_device ct_rd;
-std::mt19937 ct_gen(ct_rd());
 
-CacheThread::CacheThread() {
+CacheThread::CacheThread(int shard, FreqSketch *sketch) {
     active_list = createLRUList(ACTIVE_LIST);
     inactive_list = createLRUList(INACTIVE_LIST);
+    this->sketch = sketch;
+    /* its own slot: a PWB's slot is written by its reclaim worker */
+    w_slot = MTS_VS_CACHE_WRITER(shard);
 }
 
 CacheThread::~CacheThread() {
@@ -21,7 +22,7 @@ int which_list(dc_entry_t *dc_entry) {
     if(dc_entry == NULL)
 	return NONE;
 
-    ts_trace(TS_INFO, "[which_list] dc_entry: %p(%lu)\n", dc_entry, dc_entry->val);
+    ts_trace(TS_INFO, "[which_list] dc_entry: %p(%u)\n", dc_entry, dc_entry->len);
 
     /* ACTIVE_LIST or INACTIVE_LIST */
     return dc_entry->list_type;
@@ -40,32 +41,10 @@ void CacheThread::link_to_at(dc_entry_t *dc_entry) {
 }
 
 ValueStorage *CacheThread::pick_valuestorage() {
-    ValueStorage *vs;
-    int vs_id;
-
-    std::uniform_int_distribution<> dist(0, MTS_VS_NUM-1);
-    int vs_id1 = dist(ct_gen);
-    int vs_id2 = dist(ct_gen);
-    ts_trace(TS_INFO, "[CACHE_PICK_VS] VS_ID1: %d, VS_ID2: %d\n", vs_id1, vs_id2);
-    ValueStorage *vs1 = g_perNumaValueStorage[vs_id1];
-    ValueStorage *vs2 = g_perNumaValueStorage[vs_id2];
-
-    if (vs1->get_used_chunk_num() < vs2->get_used_chunk_num()) {
-	vs_id = vs_id1;
-	vs = vs1;
-    } else {
-	vs_id = vs_id2;
-	vs = vs2;
-    }
-    while(true) {
-	if(!vs->is_writing) {
-	    ts_trace(TS_WARNING, "[CACHE_PICK_VS] VS_ID: %d %d / %lu\n", vs_id, vs->get_used_chunk_num(), MTS_VS_HIGH_MARK);
-	    return vs;
-	}
-	vs_id = dist(ct_gen);
-	vs = g_perNumaValueStorage[vs_id];
-	ts_trace(TS_WARNING, "[CACHE_TRY_PICK_VS] VS_ID: %d %d / %lu\n", vs_id, vs->get_used_chunk_num(), MTS_VS_HIGH_MARK);
-    }
+    ValueStorage *vs = pick_vs_for_write();
+
+    ts_trace(TS_INFO, "[CACHE_PICK_VS] VS_ID: %d %d / %lu\n", vs->get_vs_id(), vs->get_used_chunk_num(), MTS_VS_HIGH_MARK);
+    return vs;
 }
 
 void CacheThread::evict_entry() {
@@ -75,9 +54,6 @@ void CacheThread::evict_entry() {
     ValueStorage *vs = NULL;
     std::set<int> written_vs_set;
 
-    std::uniform_int_distribution<> dist(0, MTS_OPLOG_NUM-1);
-    int g_oplog_id = dist(ct_gen);
-
     for(int i = 0; i < MTS_RECLAIM_PAGES_NUM; i++) {
 	dc_entry_t *removed_entry = inactive_list->get_tail();
 	dc_entry_t *next_removed_entry;
@@ -118,17 +94,16 @@ void CacheThread::evict_entry() {
 	    }
 
 	    while(removed_entry) {
-		ts_trace(TS_INFO,"[evict_entry] removed_entry: %p val: %lu\n",
-			removed_entry, removed_entry->val);
+		ts_trace(TS_INFO,"[evict_entry] removed_entry: %p len: %u\n",
+			removed_entry, removed_entry->len);
 
 		if(has_active_list_entry == true) {
 		    Key_t key = removed_entry->key;
-		    Val_t val = removed_entry->val;
 		    at_entry_t *at_entry = removed_entry->at_entry;
-		    ts_trace(TS_INFO, "[evict_entry] vs->put_vs_entry val: %lu at_entry: %p\n", val, at_entry);
+		    ts_trace(TS_INFO, "[evict_entry] vs->put_vs_entry len: %u at_entry: %p\n", removed_entry->len, at_entry);
 
 		    int vs_id = vs->get_vs_id();
-		    vs->put_vs_entry(g_oplog_id, key, val, at_entry);
+		    vs->put_vs_entry(w_slot, key, removed_entry->val, removed_entry->len, at_entry, vs_stream(at_entry));
 
 		    if(!written_vs_set.count(vs_id))
 			written_vs_set.insert(vs_id);
@@ -143,7 +118,7 @@ void CacheThread::evict_entry() {
 		}
 		removed_entry = next_removed_entry;
 
-		ts_trace(TS_INFO, "[evict_entry] inactive_list->get_cur_size(): %d\n", inactive_list->get_cur_size());
+		ts_trace(TS_INFO, "[evict_entry] inactive_list->get_cur_size(): %lu\n", inactive_list->get_cur_size());
 
 		if(inactive_list->get_cur_size() == 0)
 		    break;
@@ -155,7 +130,7 @@ void CacheThread::evict_entry() {
 
 	    if(written_active_list_entry) {
 		if(vs != NULL) { 
-		    vs->forced_write_chunk(g_oplog_id);
+		    vs->forced_write_chunk(w_slot);
 		}
 	    }
 	}
@@ -164,10 +139,31 @@ void CacheThread::evict_entry() {
     }
 }
 
+/*
+ * TinyLFU admission. Once the cache is warm, a looked-up item must be
+ * estimated hotter than the next victim, and a scanned item must have been
+ * seen MTS_DC_SCAN_ADMIT_FREQ times.
+ */
+bool CacheThread::admit(at_entry_t *at_entry, bool scan_ops) {
+    if(!MTS_DC_ADMISSION)
+	return true;
+
+    if(inactive_list->get_cur_size() + MTS_RECLAIM_PAGES_NUM * MTS_DC_ITEM_SIZE < inactive_list->get_max_size())
+	return true;
+
+    if(scan_ops)
+	return sketch->estimate(at_entry) >= MTS_DC_SCAN_ADMIT_FREQ;
+
+    dc_entry_t *victim = inactive_list->get_tail();
+    if(victim == NULL)
+	return true;
+    return sketch->estimate(at_entry) > sketch->estimate(victim->at_entry);
+}
+
 void CacheThread::freeOperation(at_entry_t *at_entry) {
     auto dc_entry = (dc_entry_t *)at_entry->val_addr;
     if(dc_entry != NULL) {
-	ts_trace(TS_INFO, "[freeOperation] dc_entry: %p(%lu)\n", dc_entry, dc_entry->val);
+	ts_trace(TS_INFO, "[freeOperation] dc_entry: %p(%u)\n", dc_entry, dc_entry->len);
 
 	if(smp_cas(&at_entry->val_addr, dc_entry, nullptr)) {
 	    if(dc_entry->list_type == ACTIVE_LIST) {
@@ -202,8 +198,8 @@ void CacheThread::cacheOperation(std::vector<cq_entry_t *> *cq_entry_vec) {
     std::vector<cq_entry_t *>::iterator iter;
     for(iter = cq_entry_vec->begin(); iter != cq_entry_vec->end(); iter++) {
 	cq_entry = *iter;
-	ts_trace(TS_INFO, "[cacheOperation] cq_entry: %p cq_entry->at_entry: %p cq_entry->val: %lu\n",
-		cq_entry, cq_entry->at_entry, cq_entry->val);
+	ts_trace(TS_INFO, "[cacheOperation] cq_entry: %p cq_entry->at_entry: %p cq_entry->dc_entry: %p\n",
+		cq_entry, cq_entry->at_entry, cq_entry->dc_entry);
 
 	/* concurrent update or not */
 	at_entry_t *at_entry = cq_entry->at_entry;
@@ -217,6 +213,9 @@ void CacheThread::cacheOperation(std::vector<cq_entry_t *> *cq_entry_vec) {
 	    continue;
 	}
 
+	if(MTS_DC_ADMISSION)
+	    sketch->record(at_entry);
+
 	if(get_tag((intptr_t)at_entry->val_addr) == DCACHE_VAL) {
 	    dc_entry = (dc_entry_t *)get_untagged_ptr((intptr_t)at_entry->val_addr);
 
@@ -224,7 +223,7 @@ void CacheThread::cacheOperation(std::vector<cq_entry_t *> *cq_entry_vec) {
 
 	    /* Case 1. hit entry of INACTIVE_LIST */
 	    if(cur_list_type == INACTIVE_LIST) { 
-		ts_trace(TS_INFO, "[cacheOperation] Hit on INACTIVE_LIST | dc_entry: %p val: %lu\n", dc_entry, dc_entry->val);
+		ts_trace(TS_INFO, "[cacheOperation] Hit on INACTIVE_LIST | dc_entry: %p len: %u\n", dc_entry, dc_entry->len);
 
 		inactive_list->remove_entry(dc_entry);
 		active_list->insert_head(dc_entry);
@@ -236,8 +235,8 @@ void CacheThread::cacheOperation(std::vector<cq_entry_t *> *cq_entry_vec) {
 			    s_dc_entry->s_prev = dc_entry;
 			if(dc_entry->s_next != NULL)
 			    dc_entry->s_next = s_dc_entry;
-			ts_trace(TS_INFO, "[cacheOperation-scan] dc_entry: %p val: %lu s_dc_entry: %p val: %lu\n",
-				dc_entry, dc_entry->val, s_dc_entry, s_dc_entry->val);
+			ts_trace(TS_INFO, "[cacheOperation-scan] dc_entry: %p len: %u s_dc_entry: %p len: %u\n",
+				dc_entry, dc_entry->len, s_dc_entry, s_dc_entry->len);
 		    }
 		    s_dc_entry = dc_entry;
 		}
@@ -259,7 +258,7 @@ void CacheThread::cacheOperation(std::vector<cq_entry_t *> *cq_entry_vec) {
 
 	    /* Case 2. hit entry of ACTIVE_LIST */
 	    else if(cur_list_type == ACTIVE_LIST) { 
-		ts_trace(TS_INFO, "[cacheOperation] Hit on ACTIVE_LIST | dc_entry: %p val: %lu\n", dc_entry, dc_entry->val);
+		ts_trace(TS_INFO, "[cacheOperation] Hit on ACTIVE_LIST | dc_entry: %p len: %u\n", dc_entry, dc_entry->len);
 		active_list->move_to_head(dc_entry);
 
 		/* chainning scanned items */
@@ -269,8 +268,8 @@ void CacheThread::cacheOperation(std::vector<cq_entry_t *> *cq_entry_vec) {
 			    s_dc_entry->s_prev = dc_entry;
 			if(dc_entry->s_next != NULL)
 			    dc_entry->s_next = s_dc_entry;
-			ts_trace(TS_INFO, "[cacheOperation-scan] dc_entry: %p val: %lu s_dc_entry: %p val: %lu\n",
-				dc_entry, dc_entry->val, s_dc_entry, s_dc_entry->val);
+			ts_trace(TS_INFO, "[cacheOperation-scan] dc_entry: %p len: %u s_dc_entry: %p len: %u\n",
+				dc_entry, dc_entry->len, s_dc_entry, s_dc_entry->len);
 		    }
 		    s_dc_entry = dc_entry;
 		}
@@ -282,9 +281,16 @@ void CacheThread::cacheOperation(std::vector<cq_entry_t *> *cq_entry_vec) {
 
 	/* Case 3. first access */
 	else {
+	    if(!admit(at_entry, scan_ops)) {
+		ts_trace(TS_INFO, "[cacheOperation] NOT ADMITTED | at_entry: %p\n", at_entry);
+		continue;
+	    }
+	    if(cq_entry->dc_entry == nullptr)
+		continue;
+
 	    dc_entry = inactive_list->alloc_entry(cq_entry);
-	    ts_trace(TS_INFO, "[cacheOperation] FIRST ACCESS | dc_entry: %p at_entry: %p val: %lu\n", 
-		    dc_entry, dc_entry->at_entry, dc_entry->val);
+	    ts_trace(TS_INFO, "[cacheOperation] FIRST ACCESS | dc_entry: %p at_entry: %p len: %u\n", 
+		    dc_entry, dc_entry->at_entry, dc_entry->len);
 
 	    inactive_list->insert_head(dc_entry);
 
@@ -295,8 +301,8 @@ void CacheThread::cacheOperation(std::vector<cq_entry_t *> *cq_entry_vec) {
 			s_dc_entry->s_prev = dc_entry;
 		    if(dc_entry->s_next != NULL)
 			dc_entry->s_next = s_dc_entry;
-		    ts_trace(TS_INFO, "[cacheOperation-scan] dc_entry: %p val: %lu s_dc_entry: %p val: %lu\n",
-			    dc_entry, dc_entry->val, s_dc_entry, s_dc_entry->val);
+		    ts_trace(TS_INFO, "[cacheOperation-scan] dc_entry: %p len: %u s_dc_entry: %p len: %u\n",
+			    dc_entry, dc_entry->len, s_dc_entry, s_dc_entry->len);
 		}
 		s_dc_entry = dc_entry;
 	    }
@@ -304,7 +310,7 @@ void CacheThread::cacheOperation(std::vector<cq_entry_t *> *cq_entry_vec) {
 	    link_to_at(dc_entry);
 
 	    if(inactive_list->get_cur_size() > inactive_list->get_max_size()) {
-		ts_trace(TS_INFO, "[cacheOperation] inactive_list->get_cur_size(): %d inactive_list->get_max_size(): %d\n",
+		ts_trace(TS_INFO, "[cacheOperation] inactive_list->get_cur_size(): %lu inactive_list->get_max_size(): %lu\n",
 			inactive_list->get_cur_size(), inactive_list->get_max_size());
 		evict_entry();
 	    }
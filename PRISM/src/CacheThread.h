@@ -16,6 +16,7 @@
 #include <libpmemobj.h>
 #include <shared_mutex>
 #include "LRUList.h"
+#include "FreqSketch.h"
 #include "MTSImpl.h"
 
 class LRUList;
@@ -26,10 +27,14 @@ class CacheThread {
     private:
 	LRUList *active_list;
 	LRUList *inactive_list;
+	FreqSketch *sketch;
+	int w_slot;	/* ValueStorage writer slot of the shard */
+
+	bool admit(at_entry_t *at_entry, bool scan_ops);
 
     public:
 	mutable std::shared_mutex s_mutex_;
-	CacheThread();
+	CacheThread(int shard, FreqSketch *sketch);
 	~CacheThread();
 
 	LRUList *createLRUList(unsigned int list_type);
@@ -41,7 +46,6 @@ class CacheThread {
 	void link_to_at(dc_entry_t *dc_entry);
 	ValueStorage *pick_valuestorage();
 	void evict_entry();
-	Val_t get_val(at_entry_t *at_entry);
 };
 
 
@@ -0,0 +1,80 @@
+#include <zlib.h>
+#include "Codec.h"
+#include "util.h"
+
+/* a z_stream per thread, reset between frames instead of set up again */
+struct zlib_streams {
+    z_stream deflate_strm;
+    z_stream inflate_strm;
+    bool deflate_ready = false;
+    bool inflate_ready = false;
+
+    ~zlib_streams() {
+	if(deflate_ready)
+	    deflateEnd(&deflate_strm);
+	if(inflate_ready)
+	    inflateEnd(&inflate_strm);
+    }
+};
+
+static thread_local zlib_streams zlib_tls;
+
+size_t ZlibCodec::compress(const char *src, size_t len, char *dst, size_t cap) {
+    z_stream *strm = &zlib_tls.deflate_strm;
+
+    if(unlikely(!zlib_tls.deflate_ready)) {
+	strm->zalloc = Z_NULL;
+	strm->zfree = Z_NULL;
+	strm->opaque = Z_NULL;
+	if(deflateInit(strm, Z_BEST_SPEED) != Z_OK) {
+	    ts_trace(TS_ERROR, "[ZLIB] deflateInit failed\n");
+	    exit(EXIT_FAILURE);
+	}
+	zlib_tls.deflate_ready = true;
+    } else deflateReset(strm);
+
+    strm->next_in = (Bytef *)src;
+    strm->avail_in = len;
+    strm->next_out = (Bytef *)dst;
+    strm->avail_out = cap;
+
+    if(deflate(strm, Z_FINISH) != Z_STREAM_END)
+	return 0;
+    return cap - strm->avail_out;
+}
+
+bool ZlibCodec::decompress(const char *src, size_t src_len, char *dst, size_t len) {
+    z_stream *strm = &zlib_tls.inflate_strm;
+
+    if(unlikely(!zlib_tls.inflate_ready)) {
+	strm->zalloc = Z_NULL;
+	strm->zfree = Z_NULL;
+	strm->opaque = Z_NULL;
+	strm->next_in = Z_NULL;
+	strm->avail_in = 0;
+	if(inflateInit(strm) != Z_OK) {
+	    ts_trace(TS_ERROR, "[ZLIB] inflateInit failed\n");
+	    exit(EXIT_FAILURE);
+	}
+	zlib_tls.inflate_ready = true;
+    } else inflateReset(strm);
+
+    strm->next_in = (Bytef *)src;
+    strm->avail_in = src_len;
+    strm->next_out = (Bytef *)dst;
+    strm->avail_out = len;
+
+    return inflate(strm, Z_FINISH) == Z_STREAM_END && strm->avail_out == 0;
+}
+
+VSCodec *createVSCodec(int codec) {
+    switch(codec) {
+	case MTS_VS_CODEC_NONE:
+	    return nullptr;
+	case MTS_VS_CODEC_ZLIB:
+	    return new ZlibCodec();
+	default:
+	    ts_trace(TS_ERROR, "Unknown ValueStorage codec %d\n", codec);
+	    exit(EXIT_FAILURE);
+    }
+}
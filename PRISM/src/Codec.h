@@ -0,0 +1,28 @@
+#ifndef MTS_CODEC_H
+#define MTS_CODEC_H
+
+#include <stddef.h>
+#include "mts-config.h"
+
+/* Compression of ValueStorage frames; safe to share between threads */
+class VSCodec {
+    public:
+	virtual ~VSCodec() {}
+	/* returns the length of src compressed into dst, 0 if it needs more
+	 * than cap bytes */
+	virtual size_t compress(const char *src, size_t len, char *dst, size_t cap) = 0;
+	/* src may be followed by padding; returns false unless exactly len
+	 * bytes come out */
+	virtual bool decompress(const char *src, size_t src_len, char *dst, size_t len) = 0;
+};
+
+class ZlibCodec : public VSCodec {
+    public:
+	size_t compress(const char *src, size_t len, char *dst, size_t cap);
+	bool decompress(const char *src, size_t src_len, char *dst, size_t len);
+};
+
+/* nullptr for MTS_VS_CODEC_NONE */
+VSCodec *createVSCodec(int codec);
+
+#endif /* MTS_CODEC_H */
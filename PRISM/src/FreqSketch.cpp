@@ -0,0 +1,115 @@
+#include <algorithm>
+#include "FreqSketch.h"
+
+#define SKETCH_COUNTER_MAX 15UL
+
+static inline uint64_t sketch_hash(at_entry_t *at_entry) {
+    uint64_t h = (uintptr_t)at_entry;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdUL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53UL;
+    h ^= h >> 33;
+    return h;
+}
+
+FreqSketch::FreqSketch(uint64_t nr_entries) {
+    width = 1024;
+    while(width < nr_entries)
+	width <<= 1;
+
+    table = new std::atomic<uint64_t>[MTS_DC_SKETCH_DEPTH * width / 16]();
+    doorkeeper = new std::atomic<uint64_t>[width / 64]();
+    additions = 0;
+    sample_size = 10 * width;
+}
+
+FreqSketch::~FreqSketch() {
+    delete[] table;
+    delete[] doorkeeper;
+}
+
+uint64_t FreqSketch::counter_idx(uint64_t hash, int row) {
+    uint64_t h = hash + row * ((hash >> 32) | 1);
+    return row * width + (h & (width - 1));
+}
+
+unsigned int FreqSketch::get_counter(uint64_t idx) {
+    uint64_t word = table[idx / 16].load(std::memory_order_relaxed);
+    return (word >> ((idx % 16) * 4)) & SKETCH_COUNTER_MAX;
+}
+
+void FreqSketch::inc_counter(uint64_t idx) {
+    std::atomic<uint64_t> &word = table[idx / 16];
+    int shift = (idx % 16) * 4;
+    uint64_t old = word.load(std::memory_order_relaxed);
+
+    while(((old >> shift) & SKETCH_COUNTER_MAX) != SKETCH_COUNTER_MAX) {
+	if(word.compare_exchange_weak(old, old + (1UL << shift), std::memory_order_relaxed))
+	    break;
+    }
+}
+
+/* Returns false if nothing changed, which keeps hot keys read-only */
+bool FreqSketch::increment(uint64_t hash) {
+    uint64_t door = (hash >> 16) & (width - 1);
+    uint64_t bit = 1UL << (door % 64);
+
+    if(!(doorkeeper[door / 64].load(std::memory_order_relaxed) & bit)) {
+	doorkeeper[door / 64].fetch_or(bit, std::memory_order_relaxed);
+	return true;
+    }
+
+    uint64_t idx[MTS_DC_SKETCH_DEPTH];
+    unsigned int cnt[MTS_DC_SKETCH_DEPTH];
+    unsigned int min = SKETCH_COUNTER_MAX;
+    for(int row = 0; row < MTS_DC_SKETCH_DEPTH; row++) {
+	idx[row] = counter_idx(hash, row);
+	cnt[row] = get_counter(idx[row]);
+	min = std::min(min, cnt[row]);
+    }
+    if(min == SKETCH_COUNTER_MAX)
+	return false;
+
+    /* conservative update: only the smallest counters grow */
+    for(int row = 0; row < MTS_DC_SKETCH_DEPTH; row++) {
+	if(cnt[row] == min)
+	    inc_counter(idx[row]);
+    }
+    return true;
+}
+
+/* halves all counters so that old popularity fades */
+void FreqSketch::reset() {
+    for(uint64_t i = 0; i < MTS_DC_SKETCH_DEPTH * width / 16; i++) {
+	uint64_t word = table[i].load(std::memory_order_relaxed);
+	table[i].store((word >> 1) & 0x7777777777777777UL, std::memory_order_relaxed);
+    }
+    for(uint64_t i = 0; i < width / 64; i++)
+	doorkeeper[i].store(0, std::memory_order_relaxed);
+    additions.store(additions.load(std::memory_order_relaxed) / 2, std::memory_order_relaxed);
+}
+
+/* ages the sketch every sample_size additions */
+void FreqSketch::record(at_entry_t *at_entry) {
+    if(increment(sketch_hash(at_entry)) &&
+	    additions.fetch_add(1, std::memory_order_relaxed) + 1 == sample_size)
+	reset();
+}
+
+void FreqSketch::record_hit(at_entry_t *at_entry) {
+    increment(sketch_hash(at_entry));
+}
+
+unsigned int FreqSketch::estimate(at_entry_t *at_entry) {
+    uint64_t hash = sketch_hash(at_entry);
+    uint64_t door = (hash >> 16) & (width - 1);
+
+    unsigned int min = SKETCH_COUNTER_MAX;
+    for(int row = 0; row < MTS_DC_SKETCH_DEPTH; row++)
+	min = std::min(min, get_counter(counter_idx(hash, row)));
+
+    if(doorkeeper[door / 64].load(std::memory_order_relaxed) & (1UL << (door % 64)))
+	min++;
+    return min;
+}
@@ -0,0 +1,40 @@
+#ifndef MTS_FREQSKETCH_H
+#define MTS_FREQSKETCH_H
+
+#include <stdint.h>
+#include <atomic>
+#include "mts-config.h"
+
+typedef struct at_entry at_entry_t;
+
+/*
+ * Count-min sketch of 4-bit counters behind a doorkeeper bitmap, estimating
+ * how often an at_entry was accessed recently (TinyLFU). The cache thread
+ * owning the sketch records misses and ages it; readers record DRAM cache
+ * hits. The update sketch is recorded and aged by every writer. Updates
+ * are relaxed: a lost increment only skews an estimate.
+ */
+class FreqSketch {
+    private:
+	std::atomic<uint64_t> *table; /* MTS_DC_SKETCH_DEPTH rows of width counters */
+	std::atomic<uint64_t> *doorkeeper;
+	uint64_t width;
+	std::atomic<uint64_t> additions;
+	uint64_t sample_size;
+
+	uint64_t counter_idx(uint64_t hash, int row);
+	unsigned int get_counter(uint64_t idx);
+	void inc_counter(uint64_t idx);
+	bool increment(uint64_t hash);
+	void reset();
+
+    public:
+	FreqSketch(uint64_t nr_entries);
+	~FreqSketch();
+
+	void record(at_entry_t *at_entry);
+	void record_hit(at_entry_t *at_entry);
+	unsigned int estimate(at_entry_t *at_entry);
+};
+
+#endif /* MTS_FREQSKETCH_H */
@@ -0,0 +1,72 @@
+#ifndef MTS_IDLEWAIT_H
+#define MTS_IDLEWAIT_H
+
+#include <atomic>
+#include <chrono>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "mts-config.h"
+
+/*
+ * Adaptive polling of a background thread. The thread keeps polling while
+ * it finds work; MTS_POLL_SPIN_US after the last work it blocks on an
+ * eventfd until a producer calls wake(), rechecking every MTS_POLL_SLEEP_MS.
+ * A producer publishes its work before wake(), and the thread rechecks for
+ * work after announcing that it sleeps, so no wakeup gets lost.
+ */
+class alignas(64) IdleWait {
+    private:
+	int efd;
+	std::atomic<bool> sleeping;
+	bool spinning;
+	std::chrono::steady_clock::time_point idle_since;
+
+    public:
+	IdleWait() {
+	    efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	    sleeping = false;
+	    spinning = false;
+	}
+	~IdleWait() {
+	    if(efd >= 0)
+		close(efd);
+	}
+
+	/* the last round found work */
+	void busy() {
+	    spinning = false;
+	}
+
+	/* the last round found nothing; has_work() rechecks the producers */
+	template <typename F>
+	void idle(F has_work) {
+	    auto now = std::chrono::steady_clock::now();
+
+	    if(!spinning) {
+		spinning = true;
+		idle_since = now;
+	    }
+	    if(efd < 0 || now - idle_since < std::chrono::microseconds(MTS_POLL_SPIN_US)) {
+		__builtin_ia32_pause();
+		return;
+	    }
+
+	    sleeping.store(true);
+	    if(!has_work()) {
+		struct pollfd pfd = {efd, POLLIN, 0};
+		uint64_t cnt;
+		if(poll(&pfd, 1, MTS_POLL_SLEEP_MS) > 0)
+		    (void)!read(efd, &cnt, sizeof(cnt));
+	    }
+	    sleeping.store(false);
+	}
+
+	void wake() {
+	    uint64_t one = 1;
+	    if(sleeping.load())
+		(void)!write(efd, &one, sizeof(one));
+	}
+};
+
+#endif /* MTS_IDLEWAIT_H */
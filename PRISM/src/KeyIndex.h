@@ -9,8 +9,10 @@ class PACTREEIndex {
 	int numa;
 	pactree *idx;
     public:
-	PACTREEIndex() {
-	    idx = new pactree(1);
+	/* pactree keeps a search layer replica on each of the numa sockets */
+	PACTREEIndex(int numa) {
+	    this->numa = numa;
+	    idx = new pactree(numa);
 	}
 	~PACTREEIndex() {
 	    delete idx;
@@ -36,8 +38,9 @@ class PACTREEIndex {
 	    auto result = idx->lookup(key);
 	    return reinterpret_cast<void*>(result);
 	}
-	size_t lookupRange(Key_t start, int range, std::vector<Val_t> &results) {
-	    auto resultCount = idx->scan(start, range, results);
+	/* endKey, if given, receives the last key scanned */
+	size_t lookupRange(Key_t start, int range, std::vector<Val_t> &results, Key_t *endKey = nullptr) {
+	    auto resultCount = idx->scan(start, range, results, endKey);
 	    return resultCount;
 	}
 };
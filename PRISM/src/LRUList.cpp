@@ -2,9 +2,10 @@
 
 LRUList::LRUList(unsigned int list_type) {
     dcache = (cache_t *)malloc(sizeof(cache_t));
+    /* every cache thread holds one shard of the cache */
     if(list_type == ACTIVE_LIST)
-	dcache->max_size = MTS_ACTIVE_LIST_SIZE / sizeof(dc_entry_t);
-    else dcache->max_size = MTS_INACTIVE_LIST_SIZE / sizeof(dc_entry_t);
+	dcache->max_size = MTS_ACTIVE_LIST_SIZE / MTS_DRAMCACHE_NUM;
+    else dcache->max_size = MTS_INACTIVE_LIST_SIZE / MTS_DRAMCACHE_NUM;
     dcache->cur_size = 0;
     dcache->list_type = list_type; 
     dcache->head = NULL;
@@ -23,25 +24,64 @@ LRUList::~LRUList() {
     free(dcache);
 }
 
-int LRUList::get_cur_size() {
+uint64_t LRUList::get_cur_size() {
     return dcache->cur_size;
 }
 
-int LRUList::get_max_size() {
+uint64_t LRUList::get_max_size() {
     return dcache->max_size;
 }
 
-dc_entry *LRUList::alloc_entry(cq_entry_t *cq_entry) {
-    dc_entry *dc_entry = (dc_entry_t *)malloc(sizeof(dc_entry_t));
-
-    if(dc_entry == NULL) {
-	ts_trace(TS_INFO, "Failed to allocate dc_entry memory LRUList::alloc()\n");
+dc_entry_t *alloc_dc_entry(at_entry_t *at_entry, const Key_t &key, const char *val, uint32_t len) {
+    int cls = sc_class(sizeof(dc_entry_t) + len);
+    if(cls < 0) {
+	ts_trace(TS_ERROR, "[alloc_dc_entry] no size class for a value of %u B\n", len);
 	exit(EXIT_FAILURE);
     }
 
-    dc_entry->at_entry = cq_entry->at_entry;
-    dc_entry->key = cq_entry->key;
-    dc_entry->val = cq_entry->val;
+    dc_entry_t *dc_entry = (dc_entry_t *)sc_alloc(cls);
+    dc_entry->at_entry = at_entry;
+    dc_entry->cls = cls;
+    dc_entry->len = len;
+    dc_entry->key = key;
+    memcpy(dc_entry->val, val, len);
+    return dc_entry;
+}
+
+void free_dc_entry(dc_entry_t *dc_entry) {
+    sc_free(dc_entry->cls, dc_entry);
+}
+
+/*
+ * Copies the value of at_entry's dc_entry. Fails if the value is not cached
+ * or its entry is evicted or reused while being copied; a reused entry
+ * stays in its size class, so len is bounded by it.
+ */
+bool read_dc_val(at_entry_t *at_entry, Value_t *val, Key_t *key) {
+    void *val_addr = at_entry->val_addr;
+    if(get_tag((intptr_t)val_addr) != DCACHE_VAL)
+	return false;
+
+    dc_entry_t *dc_entry = (dc_entry_t *)get_untagged_ptr((intptr_t)val_addr);
+    if(dc_entry == nullptr || dc_entry->at_entry != at_entry)
+	return false;
+
+    int cls = dc_entry->cls;
+    if(cls < 0 || cls >= MTS_SC_NUM)
+	return false;
+    uint32_t len = std::min((unsigned long)dc_entry->len, sc_size(cls) - sizeof(dc_entry_t));
+    val->assign(dc_entry->val, len);
+    if(key)
+	*key = dc_entry->key;
+
+    smp_rmb();
+    return dc_entry->at_entry == at_entry && at_entry->val_addr == val_addr;
+}
+
+dc_entry *LRUList::alloc_entry(cq_entry_t *cq_entry) {
+    dc_entry *dc_entry = cq_entry->dc_entry;
+    cq_entry->dc_entry = nullptr;
+
     dc_entry->list_type = dcache->list_type;
 
     dc_entry->prev = NULL;
@@ -49,7 +89,7 @@ dc_entry *LRUList::alloc_entry(cq_entry_t *cq_entry) {
     dc_entry->s_prev = NULL;
     dc_entry->s_next = NULL;
 
-    ts_trace(TS_INFO, "[alloc_entry] dc_entry: %p val: %lu\n", dc_entry, dc_entry->val);
+    ts_trace(TS_INFO, "[alloc_entry] dc_entry: %p len: %u\n", dc_entry, dc_entry->len);
 
     return dc_entry;
 }
@@ -64,8 +104,8 @@ bool LRUList::chain_has_active_entry(dc_entry_t *dc_entry) {
 }
 
 void LRUList::free_entry(dc_entry_t *dc_entry) {
-    ts_trace(TS_INFO, "[free_entry] at_entry: %p dc_entry: %p val: %lu\n",
-	    dc_entry->at_entry, dc_entry, dc_entry->val);
+    ts_trace(TS_INFO, "[free_entry] at_entry: %p dc_entry: %p len: %u\n",
+	    dc_entry->at_entry, dc_entry, dc_entry->len);
 
     /* uncoupling scanned items */
     if(dc_entry->s_prev)
@@ -73,7 +113,7 @@ void LRUList::free_entry(dc_entry_t *dc_entry) {
     if(dc_entry->s_next)
 	dc_entry->s_next->s_prev = dc_entry->s_prev;
 
-    free(dc_entry);
+    free_dc_entry(dc_entry);
     ts_trace(TS_INFO, "[free_entry] after free() | dc_entry: %p\n", dc_entry);
 
 }
@@ -90,14 +130,14 @@ void LRUList::insert_head(dc_entry_t *dc_entry) {
     }
 
     dc_entry->list_type = dcache->list_type;
-    dcache->cur_size++;
+    dcache->cur_size += sc_size(dc_entry->cls);
 }
 
 dc_entry_t *LRUList::iter_dcache() {
     dc_entry_t *temp = dcache->head;
     return temp;
     while(temp) {
-	ts_trace(TS_INFO, "[iter_dcache] %d dc_entry: %p(%lu)\n", temp->list_type, temp, temp->val);
+	ts_trace(TS_INFO, "[iter_dcache] %d dc_entry: %p(%u)\n", temp->list_type, temp, temp->len);
 	temp = temp->next;
     }
 }
@@ -146,7 +186,7 @@ dc_entry_t *LRUList::remove_tail() {
     dcache->tail = old_tail->prev;
     dcache->tail->next = NULL;
 
-    dcache->cur_size--;
+    dcache->cur_size -= sc_size(old_tail->cls);
 
     return old_tail;
 }
@@ -174,7 +214,7 @@ dc_entry_t *LRUList::remove_entry(dc_entry_t *dc_entry) {
 	pmem_persist((void *)&at_entry, sizeof(at_entry_t));
     }
 
-    dcache->cur_size--;
+    dcache->cur_size -= sc_size(dc_entry->cls);
 
     return dc_entry;
 }
@@ -18,36 +18,36 @@
 
 typedef struct at_entry at_entry_t;
 
-typedef struct cq_entry {
-    at_entry_t *at_entry;
-    Key_t key;
-    Val_t val;
-    bool ops;
-    void init(at_entry_t *_at_entry, Val_t _val, bool _ops) {
-	this->val = _val;
-	this->at_entry = _at_entry;
-	this->ops = _ops;
-    }
-} cq_entry_t;
-
+/* allocated from the size class of its value */
 typedef struct dc_entry {
     at_entry_t *at_entry;
     dc_entry *prev, *next;
     dc_entry *s_prev, *s_next;
     unsigned int list_type;
+    int cls;
+    uint32_t len;
 
     Key_t key;
-    Val_t val;
-    unsigned char __reserved[KV_SIZE-sizeof(Val_t)-sizeof(Key_t)];
+    char val[];
 } dc_entry_t;
 
+typedef struct cq_entry {
+    at_entry_t *at_entry;
+    dc_entry_t *dc_entry;	/* filled in by the producer, taken by the cache thread */
+    bool ops;
+} cq_entry_t;
+
 typedef struct cache {
     dc_entry_t *head, *tail; // Doubly-linked list
-    int max_size; // Maxiumum number of entries
-    int cur_size; // Current number of entries
+    uint64_t max_size; // Maxiumum bytes of entries
+    uint64_t cur_size; // Current bytes of entries
     unsigned int list_type;
 } cache_t;
 
+dc_entry_t *alloc_dc_entry(at_entry_t *at_entry, const Key_t &key, const char *val, uint32_t len);
+void free_dc_entry(dc_entry_t *dc_entry);
+bool read_dc_val(at_entry_t *at_entry, Value_t *val, Key_t *key = nullptr);
+
 class LRUList {
     private:
 
@@ -70,8 +70,8 @@ class LRUList {
 
 	bool chain_has_active_entry(dc_entry_t *dc_entry);
 
-	int get_cur_size();
-	int get_max_size();
+	uint64_t get_cur_size();
+	uint64_t get_max_size();
 
 	dc_entry_t *iter_dcache();
 };
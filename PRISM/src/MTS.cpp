@@ -2,6 +2,8 @@
 #include <zconf.h>
 #include <cassert>
 #include <mutex>
+#include <limits>
+#include <unordered_map>
 #include <ordo_clock.h>
 #include <time.h>
 #include "numa.h"
@@ -17,18 +19,19 @@
     total_oplog_hit_cnt = 0;	    \
     total_valuestorage_hit_cnt = 0; \
 }
-#define INC_GET_CNT() (curMTSThread->get_cnt++)
-#define INC_DCACHE_HIT_CNT() (curMTSThread->dcache_hit_cnt++)
-#define INC_OPLOG_HIT_CNT() (curMTSThread->oplog_hit_cnt++)
-#define INC_VALUESTORAGE_HIT_CNT() (curMTSThread->valuestorage_hit_cnt++)
-#define INC_VALUESTORAGE_HIT_CNT2(x) (curMTSThread->valuestorage_hit_cnt+=x)
+#define INC_GET_CNT() do { curMTSThread->get_cnt++; stat_count(STAT_CNT_GET); } while(0)
+#define INC_DCACHE_HIT_CNT() do { curMTSThread->dcache_hit_cnt++; stat_count(STAT_CNT_DCACHE_HIT); } while(0)
+#define INC_OPLOG_HIT_CNT() do { curMTSThread->oplog_hit_cnt++; stat_count(STAT_CNT_OPLOG_HIT); } while(0)
+#define INC_VALUESTORAGE_HIT_CNT() do { curMTSThread->valuestorage_hit_cnt++; stat_count(STAT_CNT_VS_HIT); } while(0)
+#define INC_VALUESTORAGE_HIT_CNT2(x) do { curMTSThread->valuestorage_hit_cnt+=x; stat_count(STAT_CNT_VS_HIT, x); } while(0)
 #else
+/* the counters of get_stats() are kept regardless */
 #define MTS_RESET_GET_COUNTERS()
-#define INC_GET_CNT() 
-#define INC_DCACHE_HIT_CNT() 
-#define INC_OPLOG_HIT_CNT() 
-#define INC_VALUESTORAGE_HIT_CNT() 
-#define INC_VALUESTORAGE_HIT_CNT2(x)
+#define INC_GET_CNT() stat_count(STAT_CNT_GET)
+#define INC_DCACHE_HIT_CNT() stat_count(STAT_CNT_DCACHE_HIT)
+#define INC_OPLOG_HIT_CNT() stat_count(STAT_CNT_OPLOG_HIT)
+#define INC_VALUESTORAGE_HIT_CNT() stat_count(STAT_CNT_VS_HIT)
+#define INC_VALUESTORAGE_HIT_CNT2(x) stat_count(STAT_CNT_VS_HIT, x)
 #endif
 
 #ifdef MTS_STATS_LATENCY
@@ -45,15 +48,20 @@
 std::random_device rd;
 std::mt19937 gen(rd());
 
-std::queue<std::vector<cq_entry_t *> *> g_cacheQueue[MTS_CACHEQUEUE_NUM];
-std::queue<at_entry_t *> g_cacheFreeQueue[MTS_CACHEQUEUE_NUM];
+cache_queue_t g_cacheQueue[MTS_CACHEQUEUE_NUM];
+cache_free_queue_t g_cacheFreeQueue[MTS_CACHEQUEUE_NUM];
+FreqSketch *g_cacheSketch[MTS_DRAMCACHE_NUM];
+FreqSketch *g_updateSketch;
+IdleWait g_cacheWait[MTS_CACHEQUEUE_NUM];
+
+std::queue<reclaim_job_t> g_reclaimQueue;
+std::mutex g_reclaimMutex;
+std::condition_variable g_reclaimCond;
 int g_phase[MTS_THREAD_NUM]; // 3: loading, 2: warm_up, 1: exec workload;
 std::atomic<uint64_t> batched_cnt = 0;
 std::atomic<uint64_t> batched_io = 0;
 
 uint64_t scan_latency[IO_URING_RRING_NUM];
-bool cqReady[MTS_CACHEQUEUE_NUM];
-bool fqReady[MTS_CACHEQUEUE_NUM];
 volatile bool ctInitialized = false;
 volatile bool iocInitialized = false;
 volatile bool ioc_lookup = false;
@@ -70,9 +78,23 @@ std::set<MTSThread *> g_MTSThreadSet;
 std::vector<KeyIndex *> g_perNumaKeyIndex(MTS_KEYINDEX_NUM);;
 std::vector<AddressTable *> g_perNumaAddressTable(MTS_AT_NUM);
 std::vector<OpLog *> g_perNumaOpLog(MTS_OPLOG_NUM);
-std::vector<ValueStorage *> g_perNumaValueStorage(MTS_VS_NUM);
+std::vector<ValueStorage *> g_perNumaValueStorage(MTS_VS_MAX_NUM);
+/* ValueStorages in use, set up at startup */
+int g_vsNum = MTS_VS_NUM;
 thread_local MTSThread* curMTSThread = NULL;
 
+/* thread ids in use; an id keeps its read rings for the next thread */
+bool g_threadIdUsed[MTS_THREAD_NUM];
+/* PWB and AddressTable slots not held by a thread, by socket */
+std::vector<int> g_freeLogSlot[NUM_SOCKET];
+/* ValueStorages each IO completer polls for lookups */
+std::vector<int> g_iocValueStorage[IO_COMPLETER_NUM];
+int g_vsCompleter[MTS_VS_MAX_NUM];
+IdleWait g_iocWait[IO_COMPLETER_NUM];
+/* CPU time spent by the IO completers and the reads they completed */
+std::atomic<uint64_t> g_iocCpuNs(0);
+std::atomic<uint64_t> g_iocIos(0);
+
 int MTSImpl::getThreadNuma() {
     int chip; 
     int core;
@@ -88,105 +110,140 @@ int MTSImpl::getThreadNuma() {
 	return threadNumaNode;
 }
 
-void MTSImpl::cache_kv_items(Val_t val, at_entry_t *at_entry, int curThreadId) {
-    std::atomic<int> qid = curThreadId;
-    while(true) {
-	if(smp_cas(&cqReady[qid], true, false)) {
-	    std::vector<cq_entry_t *>* cq_entry_vec = new std::vector<cq_entry_t *>;
-	    cq_entry_t *cq_entry = new cq_entry_t;
-	    cq_entry->at_entry = at_entry;
-	    cq_entry->val = val;
-	    cq_entry->ops = CT_LOOKUP;
-	    cq_entry_vec->push_back(cq_entry);
-	    g_cacheQueue[qid].push(cq_entry_vec);
-	    smp_cas(&cqReady[qid], false, true);
-	    break;
+/* socket whose NVM holds the PWB and the AddressTable of a slot */
+static inline int log_slot_node(int slot) {
+    return slot * NUM_SOCKET / MTS_OPLOG_NUM;
+}
+
+/* the lowest free id, whose read rings are most likely set up already */
+static int alloc_thread_id() {
+    for(int i = 0; i < MTS_THREAD_NUM; i++) {
+	if(!g_threadIdUsed[i]) {
+	    g_threadIdUsed[i] = true;
+	    return i;
+	}
+    }
+    ts_trace(TS_ERROR, "More than %d threads registered\n", MTS_THREAD_NUM);
+    exit(EXIT_FAILURE);
+}
+
+/* a slot on the socket of the caller, or on the nearest one with a free slot */
+static int alloc_log_slot(int node) {
+    int slot;
+
+    for(int i = 0; i < NUM_SOCKET; i++) {
+	std::vector<int> &slots = g_freeLogSlot[(node + i) % NUM_SOCKET];
+	if(!slots.empty()) {
+	    slot = slots.back();
+	    slots.pop_back();
+	    return slot;
 	}
     }
+    ts_trace(TS_ERROR, "More than %d threads registered\n", MTS_OPLOG_NUM);
+    exit(EXIT_FAILURE);
 }
 
+static inline std::vector<cq_entry_t *> *alloc_cq_entry_vec() {
+    return SlabPool<std::vector<cq_entry_t *>>::alloc();
+}
+
+/* the vector keeps its capacity for the next batch; dc_entries the cache
+ * thread did not take are freed with their cq_entry */
+static void free_cq_entry_vec(std::vector<cq_entry_t *> *cq_entry_vec) {
+    for(auto cq_entry : *cq_entry_vec) {
+	if(cq_entry->dc_entry) {
+	    free_dc_entry(cq_entry->dc_entry);
+	    cq_entry->dc_entry = nullptr;
+	}
+	SlabPool<cq_entry_t>::free(cq_entry);
+    }
+    cq_entry_vec->clear();
+    SlabPool<std::vector<cq_entry_t *>>::free(cq_entry_vec);
+}
+
+/* the value is copied out of the read buffer into the dc_entry to cache */
 void MTSImpl::cache_kv_items(std::vector<cq_entry_t *> *cq_entry_vec, vs_entry_t *vs_entry, int ops) {
-    cq_entry_t *cq_entry = new cq_entry_t;
+    cq_entry_t *cq_entry = SlabPool<cq_entry_t>::alloc();
     cq_entry->at_entry = vs_entry->at_entry;
-    cq_entry->key = vs_entry->key;
-    cq_entry->val = vs_entry->val;
+    cq_entry->dc_entry = alloc_dc_entry(vs_entry->at_entry, vs_entry->key, vs_entry->val, vs_entry->len);
     cq_entry->ops = ops;
     cq_entry_vec->push_back(cq_entry);
-    ts_trace(TS_INFO, "at_entry %p val %lu ops %d size %d\n",
-	    cq_entry->at_entry, cq_entry->val, cq_entry->ops, cq_entry_vec->size());
+    ts_trace(TS_INFO, "at_entry %p len %u ops %d size %d\n",
+	    cq_entry->at_entry, vs_entry->len, cq_entry->ops, cq_entry_vec->size());
 }
 
-void MTSImpl::cache_kv_items(std::vector<cq_entry_t *> *cq_entry_vec, int curThreadId) {
-    std::atomic<int> qid = curThreadId;
-    while(true) {
-	if(smp_cas(&cqReady[qid], true, false)) {
-	    g_cacheQueue[qid].push(cq_entry_vec);
-	    smp_cas(&cqReady[qid], false, true);
-	    break;
+/* Hands a batch over to the cache threads, split by shard. Caching is only
+ * a hint: a batch is dropped rather than queued behind a full ring. */
+void MTSImpl::cache_kv_items(std::vector<cq_entry_t *> *cq_entry_vec) {
+    std::vector<cq_entry_t *> *shard_vec[MTS_CACHEQUEUE_NUM];
+
+    if(MTS_CACHEQUEUE_NUM == 1) {
+	shard_vec[0] = cq_entry_vec;
+    } else {
+	for(int qid = 0; qid < MTS_CACHEQUEUE_NUM; qid++)
+	    shard_vec[qid] = nullptr;
+	for(auto cq_entry : *cq_entry_vec) {
+	    int qid = cache_shard(cq_entry->at_entry);
+	    if(shard_vec[qid] == nullptr)
+		shard_vec[qid] = alloc_cq_entry_vec();
+	    shard_vec[qid]->push_back(cq_entry);
 	}
+	cq_entry_vec->clear();
+	free_cq_entry_vec(cq_entry_vec);
+    }
+
+    for(int qid = 0; qid < MTS_CACHEQUEUE_NUM; qid++) {
+	if(shard_vec[qid] == nullptr)
+	    continue;
+	if(!g_cacheQueue[qid].bounded_push(shard_vec[qid])) {
+	    ts_trace(TS_INFO, "[CACHE_KV_ITEMS] cache queue %d is full, drop %lu entries\n", qid, shard_vec[qid]->size());
+	    free_cq_entry_vec(shard_vec[qid]);
+	    continue;
+	}
+	g_cacheWait[qid].wake();
     }
 }
 
-void MTSImpl::cache_free_kv_items(at_entry_t *at_entry, int curThreadId) {
-    std::atomic<int> qid = curThreadId;
+void MTSImpl::cache_free_kv_items(at_entry_t *at_entry) {
     if(is_cached(at_entry)) {
-	while(true) {
-	    if(smp_cas(&fqReady[qid], true, false)) {
-		g_cacheFreeQueue[qid].push(at_entry);
-		smp_cas(&fqReady[qid], false, true);
-		break;
-	    }
+	/* never dropped: the cache thread must unlink the dc_entry */
+	while(!g_cacheFreeQueue[cache_shard(at_entry)].bounded_push(at_entry)) {
+	    __builtin_ia32_pause();
 	}
+	g_cacheWait[cache_shard(at_entry)].wake();
     }
 }
 
-void DramCacheThreadExec() {
+/* Every cache thread owns the entries of one shard (cache_shard()) */
+void DramCacheThreadExec(int qid) {
     while(ctInitialized == false){}
 
-    CacheThread ct;
-    int i = 0;
-    int j = 0;
+    CacheThread ct(qid, g_cacheSketch[qid]);
+    std::vector<cq_entry_t *> *cq_entry_vec;
+    at_entry_t *at_entry;
+    bool idle;
 
     while(!g_endMTS) {
+	idle = true;
+
 	/* free cached entries */
-	if(!g_cacheFreeQueue[i].empty()) {
-	    while(true) {
-		if(smp_cas(&fqReady[i], true, false)) {
-		    while(!g_cacheFreeQueue[i].empty()) {
-			auto at_entry = g_cacheFreeQueue[i].front();
-			g_cacheFreeQueue[i].pop();
-			ct.freeOperation(at_entry);
-		    }
-		    smp_cas(&fqReady[i], false, true);
-		    break;
-		}
-	    }
+	while(g_cacheFreeQueue[qid].pop(at_entry)) {
+	    ct.freeOperation(at_entry);
+	    idle = false;
 	}
-	i++;
-	if(i == MTS_CACHEQUEUE_NUM)
-	    i = 0;
 
 	/* cache entries */
-	if(!g_cacheQueue[j].empty()) {
-	    while(true) { 
-		if(smp_cas(&cqReady[j], true, false)) { 
-		    ts_trace(TS_INFO, "CacheThread 0 | cqReady %p %d\n", &cqReady[j], cqReady[j]);
-		    while(!g_cacheQueue[j].empty()) {
-			auto cq_entry_vec = g_cacheQueue[j].front();
-			ct.cacheOperation(cq_entry_vec);
-			g_cacheQueue[j].pop();
-			free(cq_entry_vec);
-			ts_trace(TS_INFO, "CacheThread 2 | cnt %u %u\n", g_cacheQueue[j].size(), g_cacheQueue[j].empty());
-		    }
-		    ts_trace(TS_INFO, "CacheThread 3 | cqReady %p %d\n", &cqReady[j], cqReady[j]);
-		    smp_cas(&cqReady[j], false, true);
-		    break;
-		}
-	    }
+	for(int i = 0; i < MTS_CACHEQUEUE_SIZE && g_cacheQueue[qid].pop(cq_entry_vec); i++) {
+	    ct.cacheOperation(cq_entry_vec);
+	    free_cq_entry_vec(cq_entry_vec);
+	    idle = false;
 	}
-	j++;
-	if(j == MTS_CACHEQUEUE_NUM)
-	    j = 0;
+
+	if(idle) {
+	    g_cacheWait[qid].idle([qid] {
+		    return !g_cacheQueue[qid].empty() || !g_cacheFreeQueue[qid].empty() || g_endMTS;
+		    });
+	} else g_cacheWait[qid].busy();
     }
 }
 
@@ -194,9 +251,11 @@ void DramCacheThreadExec() {
 void MTSImpl::complete_pending_ios(ValueStorage *vs, int ring_idx) {
     struct io_uring_cqe *r_cqe;
     int entry_idx, ret;
+    int slot;
     vs_entry_t *vs_entry;
+    aio_req_t *req;
 
-    std::vector<cq_entry_t *> *cq_entry_vec = new std::vector<cq_entry_t *>;
+    std::vector<cq_entry_t *> *cq_entry_vec = alloc_cq_entry_vec();
 
     for(entry_idx = 0; entry_idx < vs->pending_ios[ring_idx]; entry_idx++) {
 
@@ -211,12 +270,15 @@ void MTSImpl::complete_pending_ios(ValueStorage *vs, int ring_idx) {
 	    exit(EXIT_FAILURE);
 	}   
 
-	vs_entry = (vs_entry_t *)io_uring_cqe_get_data(r_cqe);
-	ts_trace(TS_INFO, "V lookup key %lu val %lu %p\n", vs_entry->key, vs_entry->val, vs_entry->at_entry);
+	/* a lookup read always serves a single slot */
+	vs->get_r_slots(r_cqe, &slot);
+	vs_entry = vs->finish_read(ring_idx, slot);
+	req = &vs->r_req[ring_idx][slot];
+	ts_trace(TS_INFO, "V lookup at_entry %p record %p\n", req->at_entry, vs_entry);
 
 #ifdef MTS_STATS_LATENCY
 	uint64_t start, end, elapsed_time;
-	at_entry_t *temp = vs_entry->at_entry;
+	at_entry_t *temp = req->at_entry;
 	end = read_tscp();
 	start = temp->timestamp; 
 	if(start) {
@@ -226,23 +288,28 @@ void MTSImpl::complete_pending_ios(ValueStorage *vs, int ring_idx) {
 	}
 #endif
 
-	cache_kv_items(cq_entry_vec, vs_entry, CT_LOOKUP);
+	if(req->start) {
+	    uint64_t elapsed = read_tscp() - req->start;
+	    stat_record(STAT_GET_VS, elapsed);
+	    vs->add_latency(&vs->r_lat_ewma, elapsed);
+	}
+	if(complete_read(req, vs_entry))
+	    cache_kv_items(cq_entry_vec, vs_entry, CT_LOOKUP);
 	io_uring_cqe_seen(&vs->r_ring[ring_idx], r_cqe);
     }
 
     vs->pending_ios[ring_idx] = 0;
 
+    stat_count(STAT_CNT_VS_HIT, entry_idx);
+    if(entry_idx != 0) {
+	stat_count(STAT_CNT_BATCHED_IO, entry_idx);
+	stat_count(STAT_CNT_BATCHED_CNT);
+    }
+
     if(!cq_entry_vec->empty()) {
-	int qid = ring_idx;
-	while(true) {
-	    if(smp_cas(&cqReady[qid], true, false)) {
-		g_cacheQueue[qid].push(cq_entry_vec);
-		smp_cas(&cqReady[qid], false, true);
-		break;
-	    }    
-	}
+	cache_kv_items(cq_entry_vec);
     } else {
-	free(cq_entry_vec);
+	free_cq_entry_vec(cq_entry_vec);
     }
 
 #ifdef MTS_STATS_GET
@@ -259,7 +326,10 @@ void MTSImpl::complete_pending_ios(ValueStorage *vs, int ring_idx) {
 uint64_t MTSImpl::complete_pending_ios(ValueStorage *vs, int ring_idx, int ops, std::vector<cq_entry_t *> *cq_entry_vec) {
     struct io_uring_cqe *r_cqe;
     int entry_idx, ret;
+    int first_slot, nr_slots;
+    int batched = 0;
     vs_entry_t *vs_entry;
+    aio_req_t *req;
 
     for(entry_idx = 0; entry_idx < vs->pending_ios[ring_idx]; entry_idx++) {
 	ret = io_uring_wait_cqe(&vs->r_ring[ring_idx], &r_cqe);
@@ -273,14 +343,25 @@ uint64_t MTSImpl::complete_pending_ios(ValueStorage *vs, int ring_idx, int ops,
 	    exit(EXIT_FAILURE);
 	}   
 
-	vs_entry = (vs_entry_t *)io_uring_cqe_get_data(r_cqe);
-	ts_trace(TS_INFO, "V lookup key %lu val %lu %p\n", vs_entry->key, vs_entry->val, vs_entry->at_entry);
+	/* a coalesced scan read serves several slots */
+	nr_slots = vs->get_r_slots(r_cqe, &first_slot);
+	for(int slot = first_slot; slot < first_slot + nr_slots; slot++) {
+	    vs_entry = vs->finish_read(ring_idx, slot);
+	    req = &vs->r_req[ring_idx][slot];
+	    ts_trace(TS_INFO, "V lookup at_entry %p record %p\n", req->at_entry, vs_entry);
 
-	cache_kv_items(cq_entry_vec, vs_entry, ops);
+	    if(complete_read(req, vs_entry))
+		cache_kv_items(cq_entry_vec, vs_entry, ops);
+	}
+	batched += nr_slots;
 	io_uring_cqe_seen(&vs->r_ring[ring_idx], r_cqe);
     }
+    stat_count(STAT_CNT_VS_HIT, batched);
+    if(batched != 0) {
+	stat_count(STAT_CNT_BATCHED_IO, batched);
+	stat_count(STAT_CNT_BATCHED_CNT);
+    }
 #ifdef MTS_STATS_GET
-    int batched = entry_idx;
     total_valuestorage_hit_cnt.fetch_add(batched);
     if(batched != 0) {
 	batched_io += batched;
@@ -302,6 +383,64 @@ uint64_t MTSImpl::complete_pending_ios(ValueStorage *vs, int ring_idx, int ops,
     return 0; 
 }
 
+/* Hands the value of a completed read over to the lookup waiting for it.
+ * vs_entry is nullptr if the record has been moved or overwritten since
+ * the read was submitted; false is returned then, and nothing is cached. */
+bool MTSImpl::complete_read(aio_req_t *req, vs_entry_t *vs_entry) {
+    bool valid = (vs_entry != nullptr);
+    lookup_ctx_t *ctx = req->ctx;
+
+    if(ctx != nullptr) {
+	if(likely(valid)) {
+	    ctx->cb(ctx->key, Value_t(vs_entry->val, vs_entry->len), true);
+	} else {
+	    bool found;
+	    Value_t val = get_val(ctx->at_entry, &found);
+	    ctx->cb(ctx->key, val, found);
+	}
+	delete ctx;
+    }
+
+    req->at_entry = nullptr;
+    req->ctx = nullptr;
+    return valid;
+}
+
+/* synchronous fallback for a value whose location changed under a read */
+Value_t MTSImpl::get_val(at_entry_t *at_entry, bool *found, Key_t *key) {
+    int vs_id = 0;
+    int64_t vs_offset;
+    Value_t val;
+
+    *found = true;
+    while(true) {
+	switch(get_val_pos(at_entry, &vs_id)) {
+	    case DCACHE_VAL:
+		if(!read_dc_val(at_entry, &val, key))
+		    continue;
+		return val;
+	    case OPLOG_VAL:
+		if(!OpLog::read_val(at_entry, &val, key))
+		    continue;
+		return val;
+	    case VALUESTORAGE_VAL:
+		vs_offset = at_entry->vs_idx.vs_offset;
+		if(g_perNumaValueStorage[vs_id]->get_val(at_entry, &val, key))
+		    return val;
+		/* only a record that moved meanwhile is looked up again */
+		if(at_entry->vs_idx.vs_id == vs_id && at_entry->vs_idx.vs_offset == vs_offset) {
+		    ts_trace(TS_ERROR, "[GET_VAL] no valid record! vs_id %d vs_offset %ld\n", vs_id, vs_offset);
+		    *found = false;
+		    return Value_t();
+		}
+		continue;
+	    default:
+		*found = false;
+		return Value_t();
+	}
+    }
+}
+
 void MTSImpl::IOCompleterThreadExec(int init_id) {
     int ops;
     int ret = 0;
@@ -312,50 +451,85 @@ void MTSImpl::IOCompleterThreadExec(int init_id) {
 
     ts_trace(TS_INFO, "IOCompleterThread begins with %d\n", init_id);
 
+    if(!g_iocValueStorage[init_id].empty())
+	bind_to_node(g_perNumaValueStorage[g_iocValueStorage[init_id][0]]->get_node());
+
     ops = CT_LOOKUP;
 
     int vs_id;
-    int ring_idx = 0;
+    int ring_idx = MTS_LOOKUP_RING;
+    int pending;
+    bool idle;
+    uint64_t nr_ios = 0;
+    IdleWait &wait = g_iocWait[init_id];
 
     while(!ioc_scan) {
-	for(vs_id = init_id; vs_id < MTS_VS_NUM; vs_id += IO_COMPLETER_NUM) {
+	idle = true;
+	for(int vs_id : g_iocValueStorage[init_id]) {
 	    ValueStorage *vs = g_perNumaValueStorage[vs_id];
 	    smp_mb();
-	    if(vs->pending_ios[ring_idx]) {
+	    pending = vs->pending_ios[ring_idx];
+	    if(pending) {
 		complete_pending_ios(vs, ring_idx);
+		nr_ios += pending;
+		idle = false;
 	    }
 	}
+
+	if(idle) {
+	    wait.idle([init_id, ring_idx] {
+		    for(int vs_id : g_iocValueStorage[init_id]) {
+			if(g_perNumaValueStorage[vs_id]->pending_ios[ring_idx])
+			    return true;
+		    }
+		    return (bool)ioc_scan;
+		    });
+	} else wait.busy();
     }
 
     if(ioc_scan) {
 	ops = CT_SCAN;
 
 	while(!g_endMTS) {
+	    idle = true;
 	    for(int ring_idx = init_id; ring_idx < IO_URING_RRING_NUM; ring_idx += IO_COMPLETER_NUM) {
-		std::vector<cq_entry_t *> *cq_entry_vec = new std::vector<cq_entry_t *>;
+		std::vector<cq_entry_t *> *cq_entry_vec = alloc_cq_entry_vec();
 		cq_entry_vec->reserve(R_QD);
-		for(vs_id = 0; vs_id < MTS_VS_NUM; vs_id++) {
+		for(vs_id = 0; vs_id < g_vsNum; vs_id++) {
 		    ValueStorage *vs = g_perNumaValueStorage[vs_id];
 		    smp_mb();
-		    if(vs->pending_ios[ring_idx]) {
+		    pending = vs->pending_ios[ring_idx];
+		    if(pending) {
 			complete_pending_ios(vs, ring_idx, ops, cq_entry_vec);
+			nr_ios += pending;
+			idle = false;
 		    }
 		}
 
 		if(!cq_entry_vec->empty()) {
-		    int qid = ring_idx;
-		    while(true) {
-			if(smp_cas(&cqReady[qid], true, false)) {
-			    g_cacheQueue[qid].push(cq_entry_vec);
-			    smp_cas(&cqReady[qid], false, true);
-			    break;
-			}    
-		    }
+		    cache_kv_items(cq_entry_vec);
 		} else {
-		    free(cq_entry_vec);
+		    free_cq_entry_vec(cq_entry_vec);
 		}
 	    }
+
+	    if(idle) {
+		wait.idle([init_id] {
+			for(int ring_idx = init_id; ring_idx < IO_URING_RRING_NUM; ring_idx += IO_COMPLETER_NUM) {
+			    for(int vs_id = 0; vs_id < g_vsNum; vs_id++) {
+				if(g_perNumaValueStorage[vs_id]->pending_ios[ring_idx])
+				    return true;
+			    }
+			}
+			return (bool)g_endMTS;
+			});
+	    } else wait.busy();
 	}
+
+	struct timespec cpu;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+	g_iocCpuNs += cpu.tv_sec * 1000000000UL + cpu.tv_nsec;
+	g_iocIos += nr_ios;
     }
 
     else {
@@ -366,35 +540,95 @@ void MTSImpl::IOCompleterThreadExec(int init_id) {
 
 void MTSImpl::createCacheThread() {
     g_mutex_.lock();
-    ctInitialized = false;
-    for (int i = 0; i < MTS_CACHEQUEUE_NUM; i++) {
-	cqReady[i] = true;
-	fqReady[i] = true;
+    for (int i = 0; i < MTS_DRAMCACHE_NUM; i++) {
+	if(MTS_DC_ADMISSION)
+	    g_cacheSketch[i] = new FreqSketch(MTS_DRAMCACHE_SIZE / MTS_DRAMCACHE_NUM / MTS_DC_ITEM_SIZE);
+	else g_cacheSketch[i] = nullptr;
     }
     ctInitialized = true;
-    DramCacheThread = new std::thread(DramCacheThreadExec);
+    for (int i = 0; i < MTS_DRAMCACHE_NUM; i++) {
+	DramCacheThread[i] = new std::thread(DramCacheThreadExec, i);
+    }
+
+    g_mutex_.unlock();
+}
+
+/* Reclaim workers drain the PWB halves handed over by OpLog::switch_oplog() */
+void ReclaimThreadExec() {
+    reclaim_job_t job;
+
+    while(true) {
+	{
+	    std::unique_lock<std::mutex> lock(g_reclaimMutex);
+	    g_reclaimCond.wait(lock, [] { return !g_reclaimQueue.empty() || g_endMTS; });
+	    if(g_reclaimQueue.empty())
+		return;
+	    job = g_reclaimQueue.front();
+	    g_reclaimQueue.pop();
+	}
+	job.oplog->reclaim(job.oplog_id);
+    }
+}
 
+void MTSImpl::createReclaimThread() {
+    g_mutex_.lock();
+    for (int i = 0; i < MTS_RECLAIM_WORKER_NUM; i++) {
+	ReclaimThread[i] = new std::thread(ReclaimThreadExec);
+    }
     g_mutex_.unlock();
 }
 
+void ioc_wake(int vs_id, int ring_idx) {
+    if(ioc_scan)
+	g_iocWait[ring_idx % IO_COMPLETER_NUM].wake();
+    else g_iocWait[g_vsCompleter[vs_id]].wake();
+}
+
 void MTSImpl::createIOCompleterThread() {
+    std::vector<int> vs_ids(g_vsNum);
+
+    /* a completer polls a run of VSs on one socket and runs there */
+    for (int i = 0; i < g_vsNum; i++)
+	vs_ids[i] = i;
+    std::stable_sort(vs_ids.begin(), vs_ids.end(), [](int a, int b) {
+	    return g_perNumaValueStorage[a]->get_node() < g_perNumaValueStorage[b]->get_node();
+	    });
+
     g_mutex_.lock();
     iocInitialized = false;
+    for (int i = 0; i < IO_COMPLETER_NUM; i++)
+	g_iocValueStorage[i].clear();
+    for (int i = 0; i < g_vsNum; i++) {
+	g_vsCompleter[vs_ids[i]] = (uint64_t)i * IO_COMPLETER_NUM / g_vsNum;
+	g_iocValueStorage[g_vsCompleter[vs_ids[i]]].push_back(vs_ids[i]);
+    }
     for (int i = 0; i < IO_COMPLETER_NUM; i++) {
 	IOCompleterThread[i] = new std::thread(&MTSImpl::IOCompleterThreadExec, this, i);
     }
     g_mutex_.unlock();
 }
 
-MTSImpl::MTSImpl(int numNuma) {
+MTSImpl::MTSImpl(int numNuma, const mts_vs_config_t *vs_config) {
     char path[100];
+    double vs_weight[MTS_VS_MAX_NUM];
+
+    g_vsNum = MTS_VS_NUM;
+    if(vs_config)
+	g_vsNum = vs_config->vs_num;
+    if(g_vsNum < 1 || g_vsNum > MTS_VS_MAX_NUM) {
+	ts_trace(TS_ERROR, "Invalid number of ValueStorages: %d (1 ~ %d)\n", g_vsNum, MTS_VS_MAX_NUM);
+	exit(EXIT_FAILURE);
+    }
+    for(int i = 0; i < g_vsNum; i++)
+	vs_weight[i] = vs_config ? vs_config->weight[i] : 1.0;
+
     ts_trace(TS_ERROR, "### PRISM INFO. ============================================================\n");
     ts_trace(TS_ERROR, "NUM_SOCKET: %d, NUM_THREADS: %d\n", NUM_SOCKET, MTS_THREAD_NUM);
-    ts_trace(TS_ERROR, "KV-item Size: %lu B, READ_IO_SIZE: %lu KB, WRITE_CHUNK_SIZE: %lu KB\n",
-	    KV_SIZE, READ_IO_SIZE/1024, MTS_VS_CHUNK_SIZE/1024);
+    ts_trace(TS_ERROR, "Max Value Size: %lu B, READ_IO_SIZE: %lu KB, WRITE_CHUNK_SIZE: %lu KB\n",
+	    MTS_VAL_MAX_SIZE, READ_IO_SIZE/1024, MTS_VS_CHUNK_SIZE/1024);
     ts_trace(TS_ERROR, "SVC Size: %lu GB\n", MTS_DRAMCACHE_SIZE/1024/1024/1024);
     ts_trace(TS_ERROR, "PWB Size: %lu GB (# = %u)\n", MTS_OPLOG_G_SIZE/1024/1024/1024, MTS_OPLOG_NUM);
-    ts_trace(TS_ERROR, "VS: %u, Disks: %d\n", MTS_VS_NUM, MTS_VS_DISK_NUM);
+    ts_trace(TS_ERROR, "VS: %d, Disks: %d\n", g_vsNum, MTS_VS_DISK_NUM);
     ts_trace(TS_ERROR, "READ_QD: %d, WRITE_QD: %d\n", R_QD, W_QD);
     ts_trace(TS_ERROR, "IO_COMPLETION_THREAD: %d\n", IO_COMPLETER_NUM);
     ts_trace(TS_ERROR, "### RESULTS ================================================================\n");
@@ -406,33 +640,43 @@ MTSImpl::MTSImpl(int numNuma) {
 
     numThreads = 0;
 
+    g_updateSketch = nullptr;
+    if(MTS_VS_STREAM_NUM > 1)
+	g_updateSketch = new FreqSketch(MTS_VS_HEAT_SKETCH_SIZE);
+
     for (int i = 0; i < MTS_KEYINDEX_NUM; i++) {
 	g_perNumaKeyIndex[i] = MTSImpl::createKeyIndex();
 	sleep(1);
 	ts_trace(TS_INFO, "[PRISMImpl] Create KeyIndex %d\n", i);
     }
 
+    /* DRAM state of a PWB and an AddressTable lives next to its NVM */
     for (int i = 0; i < MTS_OPLOG_NUM; i++) {
-	if(i < (MTS_OPLOG_NUM / 2))
-	    sprintf(path, NVHEAP_POOL_PATH"0/prism/pwb%d", i);
-	else sprintf(path, NVHEAP_POOL_PATH"1/prism/pwb%d", i);
+	bind_to_node(log_slot_node(i));
+	sprintf(path, NVHEAP_POOL_PATH"%d/prism/pwb%d", log_slot_node(i), i);
 	g_perNumaOpLog[i] = MTSImpl::createOpLog(path, i);
 	ts_trace(TS_INFO, "[PRISMImpl] Create PWB %d\n", i);
     }
 
     for (int i = 0; i < MTS_AT_NUM; i++) {
-	if(i < (MTS_AT_NUM / 2))
-	    sprintf(path, MTS_AT_PATH"0/prism/hsit%d", i);
-	else sprintf(path, MTS_AT_PATH"1/prism/hsit%d", i);
+	bind_to_node(log_slot_node(i));
+	sprintf(path, MTS_AT_PATH"%d/prism/hsit%d", log_slot_node(i), i);
 	g_perNumaAddressTable[i] = MTSImpl::createAddressTable(path, i);
 	ts_trace(TS_INFO, "[PRISMImpl] Create HIST %d\n", i);
     }
+    bind_to_node(-1);
+
+    /* popped from the back, so threads take the lowest slots first */
+    for (int i = MTS_OPLOG_NUM - 1; i >= 0; i--)
+	g_freeLogSlot[log_slot_node(i)].push_back(i);
 
-    for(int i = 0; i < MTS_VS_NUM; i++) {
+    for(int i = 0; i < g_vsNum; i++) {
 	int partition = i % MTS_VS_DISK_NUM;
 	sprintf(path, MTS_VS_PATH"%d/prism/valuestorage%d", partition, i);
 	g_perNumaValueStorage[i] = MTSImpl::createValueStorage(path, i);
-	ts_trace(TS_INFO, "[PRISMImpl] Create ValueStorage %d\n", g_perNumaValueStorage[i]->get_vs_id());
+	/* shared by all threads, unlike the rings opened by registerThread() */
+	g_perNumaValueStorage[i]->open_r_ring(MTS_LOOKUP_RING);
+	ts_trace(TS_INFO, "[PRISMImpl] Create ValueStorage %d (weight %.2f)\n", g_perNumaValueStorage[i]->get_vs_id(), vs_weight[i]);
 
 	for(int ring_idx = 0; ring_idx < IO_URING_RRING_NUM; ring_idx++) {
 	    object_combiner[i][ring_idx] = (aio_struct_t *)get_aligned_memory(L1_CACHE_BYTES, sizeof(aio_struct_t));
@@ -440,15 +684,19 @@ MTSImpl::MTSImpl(int numNuma) {
 	    object_combiner[i][ring_idx]->is_working = false;
 	}
     }
+    init_vs_placement(vs_weight);
 
     for(int i = 0; i < MTS_THREAD_NUM; i++) {
 	th_state[i] = (aio_thread_state_t *)get_aligned_memory(L1_CACHE_BYTES, sizeof(aio_thread_state_t));
 	aio_thread_state_init(th_state[i]);
     }
+    for(int ring_idx = 0; ring_idx < IO_URING_RRING_NUM; ring_idx++)
+	iter_ring[ring_idx] = false;
 
     ts_trace(TS_INFO, "[PRISMImpl] Create Cache-queue%d\n", MTS_DRAMCACHE_NUM);
     createCacheThread();
     createIOCompleterThread();
+    createReclaimThread();
 
     for(int i = 0; i < MTS_THREAD_NUM; i++)
 	g_phase[i] = 3;
@@ -463,6 +711,10 @@ MTSImpl::~MTSImpl() {
     g_endMTS = true;
     ioc_scan = true;
     ts_trace(TS_INFO, "[~PRISMImpl] g_endMTS\n");
+    for(int i = 0; i < IO_COMPLETER_NUM; i++)
+	g_iocWait[i].wake();
+    for(int i = 0; i < MTS_CACHEQUEUE_NUM; i++)
+	g_cacheWait[i].wake();
 
     //terminate iocompletionthread
     g_mutex_.lock();
@@ -485,13 +737,23 @@ MTSImpl::~MTSImpl() {
 	}
     }
 
+    // terminate reclaim workers once the queued reclaims are done
+    g_reclaimMutex.lock();
+    g_reclaimCond.notify_all();
+    g_reclaimMutex.unlock();
+    for(int i = 0; i < MTS_RECLAIM_WORKER_NUM; i++) {
+	ReclaimThread[i]->join();
+	delete ReclaimThread[i];
+    }
+
     // terminate cacheThread 
     g_mutex_.lock();
     for(int i = 0; i < MTS_DRAMCACHE_NUM; i++) {
-	if(DramCacheThread->joinable()) {
-	    DramCacheThread->join();
-	    delete DramCacheThread;
+	if(DramCacheThread[i]->joinable()) {
+	    DramCacheThread[i]->join();
+	    delete DramCacheThread[i];
 	}
+	delete g_cacheSketch[i];
     }
     g_mutex_.unlock();
     for(int i = 0; i < MTS_KEYINDEX_NUM; i++) {
@@ -506,23 +768,33 @@ MTSImpl::~MTSImpl() {
 	delete g_perNumaOpLog[i];
     }
 
-    uint64_t vs_total_write_count = 0;
-    uint64_t ol_total_write_count = 0;
+    uint64_t vs_total_write_bytes = 0;
+    uint64_t ol_total_write_bytes = 0;
 
-    for(int i = 0; i < MTS_VS_NUM; i++) {
+    for(int i = 0; i < g_vsNum; i++) {
 	ts_trace(TS_INFO, "[~PRISMImpl] VS_ID: %d check_all_chunks()\n", g_perNumaValueStorage[i]->get_vs_id());
-	vs_total_write_count += g_perNumaValueStorage[i]->total_vs_write_count;
+	vs_total_write_bytes += g_perNumaValueStorage[i]->total_vs_write_bytes;
 
 	delete g_perNumaValueStorage[i];
     }
+    delete g_updateSketch;
 
     for(int i = 0; i < MTS_OPLOG_NUM; i++) {
-	ol_total_write_count += g_perNumaOpLog[i]->total_ol_write_count;
+	ol_total_write_bytes += g_perNumaOpLog[i]->total_ol_write_bytes;
+    }
+
+    /* CPU the IO completers spent per read, idle time included */
+    if(g_iocIos) {
+	std::cout << std::fixed;
+	std::cout.precision(2);
+	std::cout << "### I/O Completion =========================================================" << std::endl;
+	std::cout << "Completer_CPU_us/IO\t" << (double)g_iocCpuNs / g_iocIos / 1000 << std::endl;
+	std::cout << "Completed_IOs\t" << g_iocIos << std::endl;
     }
 
 #ifdef MTS_STATS_WAF
-    uint64_t vs_write = vs_total_write_count * 512 / 1024;
-    uint64_t ol_write = ol_total_write_count * KV_SIZE / 1024 / 1024;
+    uint64_t vs_write = vs_total_write_bytes / 1024 / 1024;
+    uint64_t ol_write = ol_total_write_bytes / 1024 / 1024;
     double waf = (double)vs_write / (double)ol_write;
 
     std::cout << "### SSD WAF ================================================================" << std::endl;
@@ -583,45 +855,65 @@ bool MTSImpl::is_cached(at_entry_t *at_entry) {
     else return false;
 }
 
-bool MTSImpl::insert(Key_t &key, Val_t val) {
+bool MTSImpl::insert(Key_t &key, const Value_t &val) {
     bool ret;
-    int curThreadId = curMTSThread->getThreadId();
+    int logId = curMTSThread->getLogId();
+
+    if(val.size() > MTS_VAL_MAX_SIZE) {
+	ts_trace(TS_ERROR, "[INSERT] value of %lu bytes is longer than MTS_VAL_MAX_SIZE\n", val.size());
+	return false;
+    }
 
     KeyIndex &keyindex = *g_perNumaKeyIndex[0];
-    AddressTable &addresstable = *g_perNumaAddressTable[curThreadId];
-    OpLog &oplog = *g_perNumaOpLog[curThreadId];
+    AddressTable &addresstable = *g_perNumaAddressTable[logId];
+    OpLog &oplog = *g_perNumaOpLog[logId];
 
     op_entry_t *op_entry = nullptr;
     at_entry_t *at_entry = nullptr;
+    uint64_t start = read_tscp();
+    uint64_t t0, t1;
 
     /* 1. Add a new op_entry(oplog->enq()) */
     op_entry = oplog.enq(key, val, OL_INSERT);
+    stat_count(STAT_CNT_PWB_WRITE_BYTES, MTS_OPLOG_WRITE_SIZE(val.size()));
     ts_trace(TS_INFO, "[INSERT-1] key: %lu, at_entry: %p, op_entry: %p\n", key, at_entry, op_entry);
 
     /* 2. Add a new at_entry */
+    t0 = read_tscp();
     at_entry = addresstable.assign(key);
+    t1 = read_tscp();
+    stat_record(STAT_AT, t1 - t0);
     ts_trace(TS_INFO, "[INSERT-2] key: %lu, at_entry: %p, op_entry: %p\n", key, at_entry, op_entry);
 
     /* 3. Link the at_entry with op_entry */
     oplog.link_to_at(op_entry, at_entry);
     addresstable.link_to_ol(at_entry, op_entry);
+    t0 = read_tscp();
+    stat_record(STAT_LINK, t0 - t1);
     ts_trace(TS_INFO, "[INSERT-3] key: %lu, at_entry: %p, op_entry: %p\n", key, at_entry, op_entry);
 
     /* 4. Add a new index_entry */
     ret = keyindex.insert(key, (void *)at_entry); 
+    t1 = read_tscp();
+    stat_record(STAT_KEYINDEX, t1 - t0);
+    stat_record(STAT_PUT, t1 - start);
     ts_trace(TS_INFO, "key %lu at_entry %p\n", key, at_entry);
 
     return ret;
 }
 
-bool MTSImpl::update(Key_t &key, Val_t val) {
-    int past_vs_id = 0;
-    int past_vs_offset = 0;
-    int curThreadId = curMTSThread->getThreadId();
+bool MTSImpl::update(Key_t &key, const Value_t &val) {
+    vs_idx_t past_vs_idx = {-1, -1};
+    int logId = curMTSThread->getLogId();
+
+    if(val.size() > MTS_VAL_MAX_SIZE) {
+	ts_trace(TS_ERROR, "[UPDATE] value of %lu bytes is longer than MTS_VAL_MAX_SIZE\n", val.size());
+	return false;
+    }
 
     KeyIndex &keyindex = *g_perNumaKeyIndex[0];
-    AddressTable &addresstable = *g_perNumaAddressTable[curThreadId];
-    OpLog &oplog = *g_perNumaOpLog[curThreadId];
+    AddressTable &addresstable = *g_perNumaAddressTable[logId];
+    OpLog &oplog = *g_perNumaOpLog[logId];
 
     op_entry_t *op_entry = nullptr;
     at_entry_t *at_entry = nullptr;
@@ -631,22 +923,44 @@ bool MTSImpl::update(Key_t &key, Val_t val) {
     MTS_SET_TIMER(start);
 #endif
 
+    uint64_t t0 = read_tscp();
+    uint64_t t1;
     at_entry = (at_entry_t *)keyindex.lookup(key);
+    t1 = read_tscp();
+    stat_record(STAT_KEYINDEX, t1 - t0);
     if((uintptr_t)at_entry == 0x0) {
 	ts_trace(TS_ERROR, "[UPDATE] keyindex.lookup returns non-exist key:%lu \n", key);
 	return 0;
     }
+    record_update(at_entry);
     ts_trace(TS_INFO, "[UPDATE-1] at_entry: %p key: %lu\n", at_entry, key);
-    
+
+    /* repeated updates of a key stay in its op_entry until the PWB switches */
+    stat_count(STAT_CNT_PWB_WRITE_BYTES, MTS_OPLOG_WRITE_SIZE(val.size()));
+    if(oplog.overwrite(at_entry, val)) {
+	stat_record(STAT_PUT, read_tscp() - t0);
+	ts_trace(TS_INFO, "[UPDATE-2] at_entry: %p, overwritten in PWB\n", at_entry);
+#ifdef MTS_STATS_WAF
+	oplog.total_ol_write_bytes += MTS_OPLOG_WRITE_SIZE(val.size());
+#endif
+#ifdef MTS_STATS_LATENCY
+	MTS_SET_TIMER(end);
+	add_timing_stat((end-start), OPLOG_VAL);
+#endif
+	return true;
+    }
+
     op_entry = oplog.enq(key, val, OL_UPDATE);
     ts_trace(TS_INFO, "[UPDATE-2] at_entry: %p, op_entry addr: %p\n", at_entry, op_entry);
 
+    t1 = read_tscp();
     oplog.link_to_at(op_entry, at_entry);
-    addresstable.link_to_ol(at_entry, op_entry, &past_vs_id, &past_vs_offset); 
+    addresstable.link_to_ol(at_entry, op_entry, &past_vs_idx);
+    stat_record(STAT_LINK, read_tscp() - t1);
     ts_trace(TS_INFO, "[UPDATE-3] at_entry: %p, op_entry: %p\n", at_entry, op_entry);
 
 #ifdef MTS_STATS_WAF
-    oplog.total_ol_write_count++;
+    oplog.total_ol_write_bytes += MTS_OPLOG_WRITE_SIZE(val.size());
 #endif
 
 #ifdef MTS_STATS_LATENCY
@@ -654,43 +968,151 @@ bool MTSImpl::update(Key_t &key, Val_t val) {
     add_timing_stat((end-start), OPLOG_VAL);
 #endif
 
-    if (!(past_vs_offset < 0) && !(past_vs_id < 0)) {
-	int chunk_offset = past_vs_offset / MTS_VS_ENTRIES_PER_CHUNK;
-	int entry_offset = past_vs_offset % MTS_VS_ENTRIES_PER_CHUNK;
+    if (!(past_vs_idx.vs_offset < 0) && !(past_vs_idx.vs_id < 0)) {
+	int chunk_offset = past_vs_idx.vs_offset / MTS_VS_ENTRIES_PER_CHUNK;
+	int entry_offset = past_vs_idx.vs_offset % MTS_VS_ENTRIES_PER_CHUNK;
 	ts_trace(TS_INFO, "[UPDATE-4] at_entry: %p, PAST_VS_ID: %d, CHUNK_OFFSET: %d, ENTRY_OFFSET: %d\n", 
-		at_entry, past_vs_id, chunk_offset, entry_offset);
+		at_entry, past_vs_idx.vs_id, chunk_offset, entry_offset);
 
-	ValueStorage *valuestorage = g_perNumaValueStorage[past_vs_id];
+	ValueStorage *valuestorage = g_perNumaValueStorage[past_vs_idx.vs_id];
 	valuestorage->unlink_to_at(chunk_offset, entry_offset, at_entry);
     }
 
-    cache_free_kv_items(at_entry, curThreadId);
+    cache_free_kv_items(at_entry);
 
+    stat_record(STAT_PUT, read_tscp() - t0);
     return true;
 }
 
-Val_t MTSImpl::lookup(Key_t &key) {
+/* Inserts new keys and updates existing ones. The oplog entries of the
+ * batch are committed together and the at_entry links share one fence. */
+uint64_t MTSImpl::multi_put(const Key_t *keys, const Value_t *vals, size_t n) {
+    if(n == 0)
+	return 0;
+
+    for(size_t i = 0; i < n; i++) {
+	if(vals[i].size() > MTS_VAL_MAX_SIZE) {
+	    ts_trace(TS_ERROR, "[MULTI_PUT] value of %lu bytes is longer than MTS_VAL_MAX_SIZE\n", vals[i].size());
+	    return 0;
+	}
+    }
+
+    int logId = curMTSThread->getLogId();
+
+    KeyIndex &keyindex = *g_perNumaKeyIndex[0];
+    AddressTable &addresstable = *g_perNumaAddressTable[logId];
+    OpLog &oplog = *g_perNumaOpLog[logId];
+
+    std::vector<op_entry_t *> op_entries(n);
+    std::vector<at_entry_t *> at_entries(n);
+    std::vector<vs_idx_t> past_vs_idx(n, {-1, -1});
+    std::vector<bool> is_new(n, false);
+    std::unordered_map<Key_t, at_entry_t *> new_keys;
+
+    /* a group is linked before the next one may switch the oplog and hand
+     * this group's half to a reclaim worker */
+    for(size_t done = 0; done < n;) {
+	/* 1. Add new op_entries with one group commit */
+	size_t nr = oplog.multi_enq(&keys[done], &vals[done], n - done, &op_entries[done]);
+	for(size_t i = done; i < done + nr; i++)
+	    stat_count(STAT_CNT_PWB_WRITE_BYTES, MTS_OPLOG_WRITE_SIZE(vals[i].size()));
+
+	/* 2. Find or add the at_entries; a repeated key reuses its entry */
+	for(size_t i = done; i < done + nr; i++) {
+	    Key_t key = keys[i];
+	    auto it = new_keys.find(key);
+	    if(it != new_keys.end()) {
+		at_entries[i] = it->second;
+		continue;
+	    }
+
+	    at_entries[i] = (at_entry_t *)keyindex.lookup(key);
+	    if((uintptr_t)at_entries[i] == 0x0) {
+		at_entries[i] = addresstable.assign(key);
+		new_keys[key] = at_entries[i];
+		is_new[i] = true;
+	    }
+	}
+
+	/* 3. Link the at_entries with the op_entries under one fence */
+	for(size_t i = done; i < done + nr; i++) {
+	    oplog.link_to_at(op_entries[i], at_entries[i], false);
+	    addresstable.link_to_ol(at_entries[i], op_entries[i], &past_vs_idx[i], false);
+	}
+	pmem_drain();
+	done += nr;
+    }
+
+    /* 4. Add new index_entries, release the past values of updated keys */
+    for(size_t i = 0; i < n; i++) {
+	at_entry_t *at_entry = at_entries[i];
+	Key_t key = keys[i];
+
+	if(is_new[i]) {
+	    keyindex.insert(key, (void *)at_entry);
+	    continue;
+	}
+	record_update(at_entry);
+
+#ifdef MTS_STATS_WAF
+	oplog.total_ol_write_bytes += MTS_OPLOG_WRITE_SIZE(vals[i].size());
+#endif
+	int past_vs_id = past_vs_idx[i].vs_id;
+	int64_t past_vs_offset = past_vs_idx[i].vs_offset;
+	if (!(past_vs_offset < 0) && !(past_vs_id < 0)) {
+	    int chunk_offset = past_vs_offset / MTS_VS_ENTRIES_PER_CHUNK;
+	    int entry_offset = past_vs_offset % MTS_VS_ENTRIES_PER_CHUNK;
+	    g_perNumaValueStorage[past_vs_id]->unlink_to_at(chunk_offset, entry_offset, at_entry);
+	}
+
+	cache_free_kv_items(at_entry);
+    }
+
+    return n;
+}
+
+Value_t MTSImpl::lookup(Key_t &key) {
+    return lookup(key, nullptr);
+}
+
+void MTSImpl::lookup_async(Key_t &key, lookup_cb_t cb) {
+    lookup(key, &cb);
+}
+
+void MTSImpl::lookup_async(const Key_t *keys, size_t n, lookup_cb_t cb) {
+    for(size_t i = 0; i < n; i++) {
+	Key_t key = keys[i];
+	/* a read from ValueStorage takes over the callback it is given */
+	lookup_cb_t key_cb = cb;
+	lookup(key, &key_cb);
+    }
+}
+
+/* With a callback, values served from SVC or PWB are delivered inline and
+ * values in ValueStorage are delivered by the I/O completer threads. */
+Value_t MTSImpl::lookup(Key_t &key, lookup_cb_t *cb) {
     ctInitialized = true;
     ioc_lookup = true;
     iocInitialized = true;
 
     std::atomic<int> curThreadId = curMTSThread->getThreadId();
-    Val_t val;
+    Value_t val;
     int vs_id = 0;
-    dc_entry_t *dc_entry;
-    op_entry_t *op_entry;
 
 #ifdef MTS_STATS_LATENCY
     uint64_t start, end;
     MTS_SET_TIMER(start);
 #endif
+    uint64_t t0 = read_tscp();
 
     KeyIndex &keyindex = *g_perNumaKeyIndex[0];
     at_entry_t *at_entry = (at_entry_t *)keyindex.lookup(key);
+    stat_record(STAT_KEYINDEX, read_tscp() - t0);
 
     if((uintptr_t)at_entry == 0x0) {
 	ts_trace(TS_ERROR, "[LOOKUP] keyindex.lookup returns non-exist key :%lu\n", key);
-	return 0;
+	if(cb) (*cb)(key, Value_t(), false);
+	return Value_t();
     }
 
     INC_GET_CNT();
@@ -702,16 +1124,14 @@ RETRY_LOOKUP:
     switch(val_pos) {
 	case DCACHE_VAL:
 	    {
-		dc_entry = (dc_entry_t *)get_untagged_ptr((intptr_t)at_entry->val_addr);
-		if(dc_entry == nullptr) goto RETRY_LOOKUP;
-		if(dc_entry->at_entry != at_entry) {
-		    ts_trace(TS_ERROR, "[LOOKUP] CANNOT ACCESS at_entry->dc_entry | at_entry: %p dc_entry: %p key: %lu\n", 
-			    at_entry, dc_entry->at_entry, key);
+		if(!read_dc_val(at_entry, &val)) {
+		    ts_trace(TS_INFO, "[LOOKUP] CANNOT ACCESS at_entry->dc_entry | at_entry: %p key: %lu\n", at_entry, key);
 		    goto RETRY_LOOKUP;
 		}
-		val = dc_entry->val;
-		ts_trace(TS_INFO, "D lookup %lu val %lu %p\n", key, val, at_entry);
+		ts_trace(TS_INFO, "D lookup %lu len %lu %p\n", key, val.size(), at_entry);
 		INC_DCACHE_HIT_CNT();
+		record_cache_hit(at_entry);
+		stat_record(STAT_GET_DCACHE, read_tscp() - t0);
 
 #ifdef MTS_STATS_LATENCY
 		MTS_SET_TIMER(end);
@@ -721,14 +1141,13 @@ RETRY_LOOKUP:
 	    }
 	case OPLOG_VAL: 
 	    {
-		op_entry = (op_entry_t *)get_untagged_ptr((intptr_t)at_entry->val_addr);
-		if(op_entry->opa != at_entry) {
+		if(!OpLog::read_val(at_entry, &val)) {
 		    ts_trace(TS_INFO, "[LOOKUP] CANNOT ACCESS at_entry->op_entry | at_entry: %p key: %lu\n", at_entry, key);
 		    goto RETRY_LOOKUP;
 		}
-		val = op_entry->val;
-		ts_trace(TS_INFO, "O lookup key %lu val %lu %p\n", key, val, at_entry);
+		ts_trace(TS_INFO, "O lookup key %lu len %lu %p\n", key, val.size(), at_entry);
 		INC_OPLOG_HIT_CNT();
+		stat_record(STAT_GET_OPLOG, read_tscp() - t0);
 
 #ifdef MTS_STATS_LATENCY
 		MTS_SET_TIMER(end);
@@ -745,36 +1164,194 @@ RETRY_LOOKUP:
 #endif
 
 		int batched = 0;
-		int ring_idx = 0;
+		int ring_idx = MTS_LOOKUP_RING;
 		aio_thread_state_t *cur_th_state = th_state[curThreadId];
-		batched = apply_ops(object_combiner[vs_id][ring_idx], cur_th_state, batching_io, at_entry, vs, ring_idx);
-		return 0;
+		lookup_ctx_t *ctx = nullptr;
+		if(cb) ctx = new lookup_ctx_t{key, at_entry, std::move(*cb)};
+		batched = apply_ops(object_combiner[vs_id][ring_idx], cur_th_state, batching_io, at_entry, ctx, vs, ring_idx);
+		return Value_t();
 	    }
 	default:
 	    {
 		ts_trace(TS_ERROR, "[LOOKUP] CANNOT FIND KEY | at_entry %p\n", at_entry);
-		return 0;
+		if(cb) (*cb)(key, Value_t(), false);
+		return Value_t();
 	    }
     }
+    if(cb) (*cb)(key, val, true);
     return val;
 }
 
-uint64_t MTSImpl::scan(Key_t &startKey, int range, std::vector<Val_t> &vec_result) {
+/* Resolves a batch of keys at once. SVC and PWB hits are served inline,
+ * ValueStorage misses are grouped by device and read on the caller's ring
+ * with one submission per device for every R_QD misses. Returns the number
+ * of keys found; out[i] is empty for a missing key. */
+uint64_t MTSImpl::multi_get(const Key_t *keys, size_t n, Value_t *out) {
+    ctInitialized = true;
+    iocInitialized = true;
+
+    int curThreadId = curMTSThread->getThreadId();
+    int ring_idx = MTS_THREAD_RING(curThreadId);
+    int vs_id = 0, val_pos;
+    uint64_t found = 0;
+    check_ring(ring_idx, "MULTI_GET");
+
+    std::vector<at_entry_t *> vs_at_vec[MTS_VS_MAX_NUM];
+    std::vector<size_t> vs_out_vec[MTS_VS_MAX_NUM];
+    uint64_t t0 = read_tscp();
+
+#ifdef MTS_STATS_LATENCY
+    uint64_t start, end;
+    MTS_SET_TIMER(start);
+#endif
+
+    KeyIndex &keyindex = *g_perNumaKeyIndex[0];
+
+    for(size_t i = 0; i < n; i++) {
+	Key_t key = keys[i];
+	at_entry_t *at_entry = (at_entry_t *)keyindex.lookup(key);
+	out[i].clear();
+
+	if((uintptr_t)at_entry == 0x0) {
+	    ts_trace(TS_INFO, "[MULTI_GET] keyindex.lookup returns non-exist key :%lu\n", key);
+	    continue;
+	}
+
+	INC_GET_CNT();
+
+RETRY_MULTI_GET:
+	val_pos = get_val_pos(at_entry, &vs_id);
+
+	switch(val_pos) {
+	    case DCACHE_VAL:
+		{
+		    if(!read_dc_val(at_entry, &out[i])) goto RETRY_MULTI_GET;
+		    found++;
+		    INC_DCACHE_HIT_CNT();
+		    record_cache_hit(at_entry);
+		    break;
+		}
+	    case OPLOG_VAL:
+		{
+		    if(!OpLog::read_val(at_entry, &out[i])) goto RETRY_MULTI_GET;
+		    found++;
+		    INC_OPLOG_HIT_CNT();
+		    break;
+		}
+	    case VALUESTORAGE_VAL:
+		{
+		    vs_at_vec[vs_id].push_back(at_entry);
+		    vs_out_vec[vs_id].push_back(i);
+		    break;
+		}
+	    default:
+		ts_trace(TS_INFO, "[MULTI_GET] CANNOT FIND KEY | at_entry %p\n", at_entry);
+	}
+    }
+
+    /* the caller's ring may still be busy with its last scan */
+    for(vs_id = 0; vs_id < g_vsNum; vs_id++) {
+	if(!vs_at_vec[vs_id].empty())
+	    while(g_perNumaValueStorage[vs_id]->pending_ios[ring_idx]) {}
+    }
+
+    std::vector<cq_entry_t *> *cq_entry_vec = alloc_cq_entry_vec();
+    size_t next[MTS_VS_MAX_NUM] = {0};
+    int nr[MTS_VS_MAX_NUM];
+    int pending[MTS_VS_MAX_NUM];
+    int slots[MTS_VS_MAX_NUM][R_QD];
+    bool remaining;
+
+    do {
+	remaining = false;
+
+	/* one submission per device and round */
+	for(vs_id = 0; vs_id < g_vsNum; vs_id++) {
+	    nr[vs_id] = std::min((size_t)R_QD, vs_at_vec[vs_id].size() - next[vs_id]);
+	    pending[vs_id] = 0;
+	    if(nr[vs_id] == 0)
+		continue;
+
+	    ValueStorage *vs = g_perNumaValueStorage[vs_id];
+	    pending[vs_id] = vs->submit_val_batch(&vs_at_vec[vs_id][next[vs_id]], nr[vs_id], slots[vs_id], ring_idx);
+	}
+
+	for(vs_id = 0; vs_id < g_vsNum; vs_id++) {
+	    if(nr[vs_id] == 0)
+		continue;
+
+	    ValueStorage *vs = g_perNumaValueStorage[vs_id];
+	    vs->wait_val_batch(pending[vs_id], ring_idx);
+
+	    for(int j = 0; j < nr[vs_id]; j++) {
+		at_entry_t *at_entry = vs_at_vec[vs_id][next[vs_id] + j];
+		size_t out_idx = vs_out_vec[vs_id][next[vs_id] + j];
+		int slot = slots[vs_id][j];
+		vs_entry_t *vs_entry = nullptr;
+
+		if(slot > -1)
+		    vs_entry = vs->finish_read(ring_idx, slot);
+
+		if(likely(vs_entry != nullptr)) {
+		    out[out_idx].assign(vs_entry->val, vs_entry->len);
+		    found++;
+		    cache_kv_items(cq_entry_vec, vs_entry, CT_LOOKUP);
+		} else {
+		    /* moved or overwritten since it was resolved */
+		    bool is_found;
+		    out[out_idx] = get_val(at_entry, &is_found);
+		    if(is_found) found++;
+		}
+	    }
+	    INC_VALUESTORAGE_HIT_CNT2(nr[vs_id]);
+	    if(pending[vs_id] != 0) {
+		stat_count(STAT_CNT_BATCHED_IO, pending[vs_id]);
+		stat_count(STAT_CNT_BATCHED_CNT);
+	    }
+
+#ifdef MTS_STATS_GET
+	    if(pending[vs_id] != 0) {
+		batched_io += pending[vs_id];
+		batched_cnt++;
+	    }
+#endif
+
+	    next[vs_id] += nr[vs_id];
+	    if(next[vs_id] < vs_at_vec[vs_id].size())
+		remaining = true;
+	}
+    } while(remaining);
+
+    if(!cq_entry_vec->empty())
+	cache_kv_items(cq_entry_vec);
+    else
+	free_cq_entry_vec(cq_entry_vec);
+
+#ifdef MTS_STATS_LATENCY
+    MTS_SET_TIMER(end);
+    add_timing_stat(end - start, TOTAL_GET);
+#endif
+    stat_record(STAT_MULTI_GET, read_tscp() - t0);
+
+    return found;
+}
+
+uint64_t MTSImpl::scan(Key_t &startKey, int range, std::vector<Value_t> &vec_result) {
     ctInitialized = true;
     ioc_scan = true;
     iocInitialized = true;
 
     int start_idx = 0;
     int vs_id, val_pos;
-    Val_t val;
+    Value_t val;
     vec_result.reserve(R_QD);
     vec_result.clear();
-    std::vector<at_entry_t *> vs_at_vec[MTS_VS_NUM];
-    dc_entry_t *dc_entry;
-    op_entry_t *op_entry;
+    std::vector<at_entry_t *> vs_at_vec[MTS_VS_MAX_NUM];
 
     int curThreadId = curMTSThread->getThreadId();
-    int ring_idx = curThreadId;
+    int ring_idx = MTS_THREAD_RING(curThreadId);
+    uint64_t t0 = read_tscp();
+    check_ring(ring_idx, "SCAN");
 
 #ifdef MTS_STATS_LATENCY
     uint64_t start, end;
@@ -798,27 +1375,21 @@ RETRY_SCAN:
 	switch(val_pos) {
 	    case DCACHE_VAL: 
 		{
-		    dc_entry = (dc_entry_t *)get_untagged_ptr((intptr_t)at_entry->val_addr);
-		    if(dc_entry == nullptr) goto RETRY_SCAN;
-		    if(dc_entry->at_entry != at_entry) {
-			ts_trace(TS_INFO, "[SCAN] CANNOT ACCESS at_entry->dc_entry | at_entry: %p key: %lu\n", 
-				at_entry, dc_entry->key);
+		    if(!read_dc_val(at_entry, &val)) {
+			ts_trace(TS_INFO, "[SCAN] CANNOT ACCESS at_entry->dc_entry | at_entry: %p\n", at_entry);
 			goto RETRY_SCAN;
 		    }
-		    val = dc_entry->val;
 		    INC_DCACHE_HIT_CNT();
+		    record_cache_hit(at_entry);
 
 		    break;
 		}
 	    case OPLOG_VAL: 
 		{
-		    op_entry = (op_entry_t *)get_untagged_ptr((intptr_t)at_entry->val_addr);
-		    if(op_entry->opa != at_entry) {
-			ts_trace(TS_INFO, "[SCAN] CANNOT ACCESS at_entry->op_entry | at_entry: %p key: %lu\n", 
-				at_entry, op_entry->key);
+		    if(!OpLog::read_val(at_entry, &val)) {
+			ts_trace(TS_INFO, "[SCAN] CANNOT ACCESS at_entry->op_entry | at_entry: %p\n", at_entry);
 			goto RETRY_SCAN;
 		    }
-		    val = op_entry->val;
 		    INC_OPLOG_HIT_CNT();
 
 		    break;
@@ -836,11 +1407,11 @@ RETRY_SCAN:
 	vec_result.push_back(val);
     }
 
-    /* scanning valuestorage from #0 to #MTS_VS_NUM */
+    /* scanning valuestorage from #0 to #g_vsNum - 1 */
     /* the number of value from valuestorage */
     uint64_t sz;
     int batched = 0;
-    for(vs_id = 0; vs_id < MTS_VS_NUM; vs_id++) {
+    for(vs_id = 0; vs_id < g_vsNum; vs_id++) {
 	if(!vs_at_vec[vs_id].empty())
 	    batched += vs_at_vec[vs_id].size();
 	else continue;
@@ -861,10 +1432,204 @@ RETRY_SCAN:
     }
 #endif
 
+    stat_record(STAT_SCAN, read_tscp() - t0);
     ts_trace(TS_INFO, "%d %d sz %d\n", vec_result.size(), batched, sz);
     return sz;
 }
 
+MTSIterator MTSImpl::seek(Key_t &startKey) {
+    ctInitialized = true;
+
+    return MTSIterator(this, startKey);
+}
+
+/* The thread rings are not shared, so only a live MTSIterator of the
+ * calling thread itself can hold ring_idx here */
+void MTSImpl::check_ring(int ring_idx, const char *op) {
+    if(unlikely(iter_ring[ring_idx])) {
+	ts_trace(TS_ERROR, "[%s] ring %d is held by a live MTSIterator of this thread\n", op, ring_idx);
+	exit(EXIT_FAILURE);
+    }
+}
+
+void MTSImpl::claim_iter_ring(int ring_idx) {
+    check_ring(ring_idx, "SEEK");
+    iter_ring[ring_idx] = true;
+}
+
+/* Resolves up to MTS_SCAN_BATCH keys from startKey on. Values in the cache
+ * or the oplog are copied into the batch right away, the others are read
+ * from ValueStorage on the caller's ring and collected by
+ * complete_scan_batch(). */
+void MTSImpl::submit_scan_batch(scan_batch_t *batch, Key_t startKey) {
+    int vs_id, val_pos;
+    Key_t key;
+    Value_t val;
+
+    int ring_idx = MTS_THREAD_RING(curMTSThread->getThreadId());
+    claim_iter_ring(ring_idx);
+    batch->ring_idx = ring_idx;
+    batch->kv.clear();
+
+    KeyIndex &keyindex = *g_perNumaKeyIndex[0];
+
+    std::vector<Val_t> results;
+    results.reserve(MTS_SCAN_BATCH);
+    int range = keyindex.lookupRange(startKey, MTS_SCAN_BATCH, results, &batch->end_key);
+    batch->last = (range < MTS_SCAN_BATCH);
+
+    for(int i = 0; i < range; i++) {
+	at_entry_t *at_entry = (at_entry_t *)results[i];
+	INC_GET_CNT();
+
+RETRY_SEEK:
+	val_pos = get_val_pos(at_entry, &vs_id);
+
+	switch(val_pos) {
+	    case DCACHE_VAL:
+		{
+		    if(!read_dc_val(at_entry, &val, &key)) goto RETRY_SEEK;
+		    batch->kv.push_back(std::make_pair(key, std::move(val)));
+		    INC_DCACHE_HIT_CNT();
+		    record_cache_hit(at_entry);
+		    break;
+		}
+	    case OPLOG_VAL:
+		{
+		    if(!OpLog::read_val(at_entry, &val, &key)) goto RETRY_SEEK;
+		    batch->kv.push_back(std::make_pair(key, std::move(val)));
+		    INC_OPLOG_HIT_CNT();
+		    break;
+		}
+	    case VALUESTORAGE_VAL:
+		{
+		    batch->vs_at_vec[vs_id].push_back(at_entry);
+		    break;
+		}
+	    default:
+		ts_trace(TS_INFO, "[SEEK] CANNOT FIND KEY | at_entry %p\n", at_entry);
+	}
+    }
+
+    for(vs_id = 0; vs_id < g_vsNum; vs_id++) {
+	batch->pending[vs_id] = 0;
+	batch->nr_slots[vs_id] = 0;
+	if(batch->vs_at_vec[vs_id].empty())
+	    continue;
+
+	ValueStorage *vs = g_perNumaValueStorage[vs_id];
+	/* the caller's ring may still be busy with its last scan */
+	while(vs->pending_ios[ring_idx]) {}
+	batch->pending[vs_id] = vs->submit_val_scan(&batch->vs_at_vec[vs_id], ring_idx, &batch->nr_slots[vs_id]);
+    }
+}
+
+/* Reaps the reads of submit_scan_batch() and sorts the batch by key */
+void MTSImpl::complete_scan_batch(scan_batch_t *batch) {
+    int ring_idx = batch->ring_idx;
+    std::vector<at_entry_t *> served;
+    std::vector<cq_entry_t *> *cq_entry_vec;
+
+    if(unlikely(ring_idx != MTS_THREAD_RING(curMTSThread->getThreadId()))) {
+	ts_trace(TS_ERROR, "[SEEK] MTSIterator of ring %d used by another thread\n", ring_idx);
+	exit(EXIT_FAILURE);
+    }
+    cq_entry_vec = alloc_cq_entry_vec();
+
+    for(int vs_id = 0; vs_id < g_vsNum; vs_id++) {
+	if(batch->vs_at_vec[vs_id].empty())
+	    continue;
+
+	ValueStorage *vs = g_perNumaValueStorage[vs_id];
+	vs->wait_val_batch(batch->pending[vs_id], ring_idx);
+
+	served.clear();
+	for(int slot = 0; slot < batch->nr_slots[vs_id]; slot++) {
+	    at_entry_t *at_entry = vs->r_req[ring_idx][slot].at_entry;
+	    vs_entry_t *vs_entry = vs->finish_read(ring_idx, slot);
+
+	    vs->r_req[ring_idx][slot] = {nullptr, nullptr, 0};
+	    if(vs_entry == nullptr)
+		continue;
+	    batch->kv.push_back(std::make_pair(vs_entry->key, Value_t(vs_entry->val, vs_entry->len)));
+	    cache_kv_items(cq_entry_vec, vs_entry, CT_SCAN);
+	    served.push_back(at_entry);
+	}
+
+	/* not read: moved or overwritten since it was resolved */
+	std::sort(served.begin(), served.end());
+	for(auto at_entry : batch->vs_at_vec[vs_id]) {
+	    if(std::binary_search(served.begin(), served.end(), at_entry))
+		continue;
+
+	    bool found;
+	    Key_t key;
+	    Value_t val = get_val(at_entry, &found, &key);
+	    if(found)
+		batch->kv.push_back(std::make_pair(key, std::move(val)));
+	}
+	INC_VALUESTORAGE_HIT_CNT2(batch->vs_at_vec[vs_id].size());
+	if(batch->pending[vs_id] != 0) {
+	    stat_count(STAT_CNT_BATCHED_IO, batch->nr_slots[vs_id]);
+	    stat_count(STAT_CNT_BATCHED_CNT);
+	}
+
+#ifdef MTS_STATS_GET
+	if(batch->pending[vs_id] != 0) {
+	    batched_io += batch->nr_slots[vs_id];
+	    batched_cnt++;
+	}
+#endif
+	batch->vs_at_vec[vs_id].clear();
+    }
+
+    if(!cq_entry_vec->empty())
+	cache_kv_items(cq_entry_vec);
+    else
+	free_cq_entry_vec(cq_entry_vec);
+
+    std::sort(batch->kv.begin(), batch->kv.end());
+    iter_ring[ring_idx] = false;
+}
+
+MTSIterator::MTSIterator(MTSImpl *mts, Key_t startKey) : mts(mts), pos(0) {
+    next_batch.reset(new scan_batch_t);
+    mts->submit_scan_batch(next_batch.get(), startKey);
+}
+
+MTSIterator::~MTSIterator() {
+    /* nobody must be left writing into the ring buffers */
+    if(next_batch)
+	mts->complete_scan_batch(next_batch.get());
+}
+
+/* Takes over the prefetched batch and starts reading the one after it */
+void MTSIterator::advance() {
+    mts->complete_scan_batch(next_batch.get());
+    cur.swap(next_batch->kv);
+    pos = 0;
+
+    /* a batch whose keys were all removed meanwhile still scanned up to
+     * end_key, so the keys after it are read next */
+    if(next_batch->last || key_is_max(next_batch->end_key)) {
+	next_batch.reset();
+	return;
+    }
+    mts->submit_scan_batch(next_batch.get(), key_successor(next_batch->end_key));
+}
+
+bool MTSIterator::next(Key_t &key, Value_t &val) {
+    while(pos == cur.size()) {
+	if(!next_batch)
+	    return false;
+	advance();
+    }
+
+    key = cur[pos].first;
+    val = cur[pos].second;
+    pos++;
+    return true;
+}
 
 bool MTSImpl::remove(Key_t &key) {
     int curThreadId = curMTSThread->getThreadId();
@@ -893,7 +1658,7 @@ bool MTSImpl::remove(Key_t &key) {
 	valuestorage.unlink_to_at(chunk_offset, entry_offset, at_entry);
 
 	if(val_pos == DCACHE_VAL)
-	    cache_free_kv_items(at_entry, curThreadId);
+	    cache_free_kv_items(at_entry);
     }
 
     /* Step 3. Reset bitmap of at_entry */
@@ -913,7 +1678,7 @@ bool MTSImpl::remove(Key_t &key) {
 }
 
 KeyIndex* MTSImpl::createKeyIndex() {
-    return new KeyIndex;
+    return new KeyIndex(totalNumaActive);
 }
 
 OpLog* MTSImpl::createOpLog(const char *path, int ol_id) {
@@ -929,16 +1694,23 @@ ValueStorage* MTSImpl::createValueStorage(const char *path, int vs_id) {
 }
 
 void MTSImpl::registerThread() {
-    int threadId = numThreads.fetch_add(1);
+    int threadId;
+
+    g_mutex_.lock();
+    threadId = alloc_thread_id();
+    numThreads.fetch_add(1);
     ts_trace(TS_INFO, "registerThread | threadId: %d\n", threadId);
     auto mt = new MTSThread(threadId);
-    g_mutex_.lock();
     g_MTSThreadSet.insert(mt);
+    mt->setLogId(alloc_log_slot(getThreadNuma()));
     curMTSThread = mt; 
     curMTSThread->phase = g_phase[threadId];
     g_mutex_.unlock();
     std::atomic_thread_fence(std::memory_order_acq_rel);
 
+    for(int i = 0; i < g_vsNum; i++)
+	g_perNumaValueStorage[i]->open_r_ring(MTS_THREAD_RING(threadId));
+
     KeyIndex &keyindex = *g_perNumaKeyIndex[0];
     keyindex.registerThread();
 
@@ -973,11 +1745,16 @@ void MTSImpl::unregisterThread() {
 	batched_io = 0;
 
 #ifdef MTS_STATS_WAF
-	for(int i = 0; i < MTS_VS_NUM; i++)
-	    g_perNumaValueStorage[i]->total_vs_write_count = 0;
+	for(int i = 0; i < g_vsNum; i++)
+	    g_perNumaValueStorage[i]->total_vs_write_bytes = 0;
 #endif
     }
 
+    g_mutex_.lock();
+    g_freeLogSlot[log_slot_node(curMTSThread->getLogId())].push_back(curMTSThread->getLogId());
+    g_threadIdUsed[threadId] = false;
+    g_mutex_.unlock();
+
     numThreads.fetch_sub(1);
     curMTSThread->setfinish();
 
@@ -990,7 +1767,7 @@ bool MTSImpl::recover(Key_t &startKey) {
     int vs_id;
     int at_id;
     int val_pos;
-    volatile Key_t key = startKey;
+    Key_t key = startKey;
     AddressTable *addresstable;
 
     KeyIndex &keyindex = *g_perNumaKeyIndex[0];
@@ -1015,7 +1792,7 @@ bool MTSImpl::recover(Key_t &startKey) {
 	case VALUESTORAGE_VAL:
 	    {
 		vs_idx_t vs_idx = at_entry->vs_idx;
-		int vs_offset = vs_idx.vs_offset;
+		int64_t vs_offset = vs_idx.vs_offset;
 		int vs_chunk_offset = vs_offset / MTS_VS_ENTRIES_PER_CHUNK;
 		int vs_entry_offset = vs_offset % MTS_VS_ENTRIES_PER_CHUNK;
 
@@ -1029,3 +1806,74 @@ bool MTSImpl::recover(Key_t &startKey) {
     }
     return true;
 }
+
+void MTSImpl::get_stats(mts_stats_t *stats) {
+    stat_collect(stats);
+}
+
+void MTSImpl::reset_stats() {
+    stat_reset();
+}
+
+/*
+ * Restart path without the KeyIndex: every ValueStorage first loads its
+ * space map checkpoint, then every AddressTable is scanned by a thread of
+ * its own and marks the slots it points at in their ValueStorage, every
+ * ValueStorage rebuilds its chunk state from them, reading the trailers of
+ * only the chunks its checkpoint does not hold, and finally the PWBs replay
+ * their unreclaimed entries. Must run before any other operation; returns
+ * the live entries.
+ */
+uint64_t MTSImpl::recover() {
+    bool vs_loaded[MTS_VS_MAX_NUM];
+    std::atomic<uint64_t> nr_live(0);
+    std::thread *at_thread[MTS_AT_NUM];
+    std::thread *vs_thread[MTS_VS_MAX_NUM];
+    std::thread *ol_thread[MTS_OPLOG_NUM];
+
+    for(int vs_id = 0; vs_id < g_vsNum; vs_id++) {
+	vs_thread[vs_id] = new std::thread([&vs_loaded, vs_id] {
+		bind_to_node(g_perNumaValueStorage[vs_id]->get_node());
+		vs_loaded[vs_id] = g_perNumaValueStorage[vs_id]->load_space_map();
+		});
+    }
+    for(int vs_id = 0; vs_id < g_vsNum; vs_id++) {
+	vs_thread[vs_id]->join();
+	delete vs_thread[vs_id];
+    }
+
+    for(int i = 0; i < MTS_AT_NUM; i++) {
+	at_thread[i] = new std::thread([&nr_live, i] {
+		bind_to_node(log_slot_node(i));
+		nr_live += g_perNumaAddressTable[i]->recover();
+		});
+    }
+    for(int i = 0; i < MTS_AT_NUM; i++) {
+	at_thread[i]->join();
+	delete at_thread[i];
+    }
+
+    for(int vs_id = 0; vs_id < g_vsNum; vs_id++) {
+	vs_thread[vs_id] = new std::thread([&vs_loaded, vs_id] {
+		bind_to_node(g_perNumaValueStorage[vs_id]->get_node());
+		g_perNumaValueStorage[vs_id]->recover_chunk_info(vs_loaded[vs_id]);
+		});
+    }
+    for(int vs_id = 0; vs_id < g_vsNum; vs_id++) {
+	vs_thread[vs_id]->join();
+	delete vs_thread[vs_id];
+    }
+
+    for(int i = 0; i < MTS_OPLOG_NUM; i++)
+	ol_thread[i] = new std::thread([i] {
+		bind_to_node(log_slot_node(i));
+		g_perNumaOpLog[i]->replay();
+		});
+    for(int i = 0; i < MTS_OPLOG_NUM; i++) {
+	ol_thread[i]->join();
+	delete ol_thread[i];
+    }
+
+    ts_trace(TS_INFO, "[RECOVER] live entries: %lu\n", nr_live.load());
+    return nr_live;
+}
@@ -7,9 +7,13 @@
 #include <thread>
 #include <set>
 #include <boost/lockfree/spsc_queue.hpp>
+#include <boost/lockfree/queue.hpp>
 #include <queue>
 #include <random>
 #include <cmath>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
 
 #include "primitives.h"
 #include "util.h"
@@ -24,6 +28,11 @@
 #include "MTSThread.h"
 #include "AIO.h"
 #include "SpinLock.h"
+#include "SlabPool.h"
+#include "SizeClass.h"
+#include "FreqSketch.h"
+#include "IdleWait.h"
+#include "Stats.h"
 
 #if PACTREE
 #include "pactree.h"
@@ -38,18 +47,83 @@ typedef struct cq_entry cq_entry_t;
 typedef struct vs_entry vs_entry_t;
 typedef struct aio_struct aio_struct_t;
 typedef struct aio_thread_state aio_thread_state_t;
+typedef struct aio_req aio_req_t;
+typedef struct lookup_ctx lookup_ctx_t;
+
+/* One batch of keys of an MTSIterator. Values found in the cache or the
+ * oplog are in kv already; the others are being read on ring_idx. */
+typedef struct scan_batch {
+    std::vector<std::pair<Key_t, Value_t>> kv;
+    std::vector<at_entry_t *> vs_at_vec[MTS_VS_MAX_NUM];
+    int pending[MTS_VS_MAX_NUM];
+    int nr_slots[MTS_VS_MAX_NUM];
+    int ring_idx;
+    Key_t end_key;	/* the last key scanned, removed or not */
+    bool last;	/* no keys beyond this batch */
+} scan_batch_t;
+
+class MTSIterator;
 
-extern bool cqReady[MTS_CACHEQUEUE_NUM];
-extern bool fqReady[MTS_CACHEQUEUE_NUM];
 
 extern std::set<MTSThread *> g_MTSThreadSet;
 extern std::vector<KeyIndex *> g_perNumaKeyIndex;
 extern std::vector<OpLog *> g_perNumaOpLog;
 extern std::vector<AddressTable*> g_perNumaAddressTable;
 extern std::vector<ValueStorage *> g_perNumaValueStorage;
-
-extern std::queue<std::vector<cq_entry_t *> *> g_cacheQueue[MTS_CACHEQUEUE_NUM];
-extern std::queue<at_entry_t *> g_cacheFreeQueue[MTS_CACHEQUEUE_NUM];
+extern int g_vsNum;
+
+/* ValueStorages to set up instead of MTS_VS_NUM. Reclaimed data is spread
+ * over them in proportion to weight; a device of weight 0 is only read. */
+typedef struct mts_vs_config {
+    int vs_num;
+    double weight[MTS_VS_MAX_NUM];
+} mts_vs_config_t;
+
+/* batches handed over to the cache thread of a shard */
+typedef boost::lockfree::queue<std::vector<cq_entry_t *> *, boost::lockfree::capacity<MTS_CACHEQUEUE_SIZE>> cache_queue_t;
+typedef boost::lockfree::queue<at_entry_t *, boost::lockfree::capacity<MTS_CACHEQUEUE_SIZE>> cache_free_queue_t;
+
+extern cache_queue_t g_cacheQueue[MTS_CACHEQUEUE_NUM];
+extern cache_free_queue_t g_cacheFreeQueue[MTS_CACHEQUEUE_NUM];
+extern FreqSketch *g_cacheSketch[MTS_DRAMCACHE_NUM];
+extern FreqSketch *g_updateSketch;
+
+/* wakes the IO completer serving a ring once reads are pending on it */
+void ioc_wake(int vs_id, int ring_idx);
+
+/* a full PWB half waiting for a reclaim worker */
+typedef struct reclaim_job {
+    OpLog *oplog;
+    int oplog_id;
+} reclaim_job_t;
+
+extern std::queue<reclaim_job_t> g_reclaimQueue;
+extern std::mutex g_reclaimMutex;
+extern std::condition_variable g_reclaimCond;
+
+/* the cache thread owning at_entry */
+static inline int cache_shard(at_entry_t *at_entry) {
+    return (int)((((uintptr_t)at_entry >> 4) * 0x9E3779B97F4A7C15UL) >> 32) % MTS_DRAMCACHE_NUM;
+}
+
+/* DRAM cache hits feed the admission sketch of the shard */
+static inline void record_cache_hit(at_entry_t *at_entry) {
+    if(MTS_DC_ADMISSION)
+	g_cacheSketch[cache_shard(at_entry)]->record_hit(at_entry);
+}
+
+/* updates feed the sketch that sorts reclaimed entries by temperature */
+static inline void record_update(at_entry_t *at_entry) {
+    if(MTS_VS_STREAM_NUM > 1)
+	g_updateSketch->record(at_entry);
+}
+
+/* chunk stream of ValueStorage an entry is written to */
+static inline int vs_stream(at_entry_t *at_entry) {
+    if(MTS_VS_STREAM_NUM > 1 && g_updateSketch->estimate(at_entry) >= MTS_VS_HOT_UPDATES)
+	return VS_STREAM_HOT;
+    return VS_STREAM_COLD;
+}
 
 extern uint64_t scan_latency[IO_URING_RRING_NUM];
 
@@ -62,35 +136,55 @@ class MTSImpl {
 	std::atomic<uint32_t> cacheHit;
 	std::atomic<uint32_t> cacheMiss;
 
-	uint64_t ready_timestamp[MTS_VS_NUM][IO_URING_RRING_NUM][R_QD];
-	uint64_t work_timestamp[MTS_VS_NUM][IO_URING_RRING_NUM][R_QD];
+	uint64_t ready_timestamp[MTS_VS_MAX_NUM][IO_URING_RRING_NUM][R_QD];
+	uint64_t work_timestamp[MTS_VS_MAX_NUM][IO_URING_RRING_NUM][R_QD];
 
 	std::vector<std::vector<OpForm *>> input_q;
 
-	std::thread *DramCacheThread;
+	std::thread *DramCacheThread[MTS_DRAMCACHE_NUM];
 	std::thread *IOCompleterThread[IO_COMPLETER_NUM];
+	std::thread *ReclaimThread[MTS_RECLAIM_WORKER_NUM];
 	void IOCompleterThreadExec(int init_id);
 
-	aio_struct_t *object_combiner[MTS_VS_NUM][IO_URING_RRING_NUM];
+	aio_struct_t *object_combiner[MTS_VS_MAX_NUM][IO_URING_RRING_NUM];
 	aio_thread_state_t *th_state[MTS_THREAD_NUM];
+
+	Value_t lookup(Key_t &key, lookup_cb_t *cb);
+	bool complete_read(aio_req_t *req, vs_entry_t *vs_entry);
+	Value_t get_val(at_entry_t *at_entry, bool *found, Key_t *key = nullptr);
+
+	friend class MTSIterator;
+	/* thread rings lent to the in-flight batch of an MTSIterator */
+	bool iter_ring[IO_URING_RRING_NUM];
+	void claim_iter_ring(int ring_idx);
+	void check_ring(int ring_idx, const char *op);
+	void submit_scan_batch(scan_batch_t *batch, Key_t startKey);
+	void complete_scan_batch(scan_batch_t *batch);
     
     public:
-	explicit MTSImpl(int numNuma);
+	explicit MTSImpl(int numNuma, const mts_vs_config_t *vs_config = nullptr);
 	~MTSImpl();
 
-	bool insert(Key_t &key, Val_t val);
-	bool update(Key_t &key, Val_t val);
+	bool insert(Key_t &key, const Value_t &val);
+	bool update(Key_t &key, const Value_t &val);
+	uint64_t multi_put(const Key_t *keys, const Value_t *vals, size_t n);
 	bool remove(Key_t &key);
-	Val_t lookup(Key_t &key);
-	uint64_t scan(Key_t &startKey, int range, std::vector<Val_t> &result);
+	Value_t lookup(Key_t &key);
+	void lookup_async(Key_t &key, lookup_cb_t cb);
+	void lookup_async(const Key_t *keys, size_t n, lookup_cb_t cb);
+	uint64_t multi_get(const Key_t *keys, size_t n, Value_t *out);
+	uint64_t scan(Key_t &startKey, int range, std::vector<Value_t> &result);
+	MTSIterator seek(Key_t &startKey);
 	bool recover(Key_t &startKey);
+	uint64_t recover();
+	void get_stats(mts_stats_t *stats);
+	void reset_stats();
 
 	int get_val_pos(at_entry_t *at_entry, int *cur_vs_id);
 	bool is_cached(at_entry_t *at_entry);
-	void cache_kv_items(Val_t val, at_entry_t *at_entry, int curMTSThread);
-	void cache_kv_items(std::vector<cq_entry_t *> *cq_entry_vec, int curMTSThread);
+	void cache_kv_items(std::vector<cq_entry_t *> *cq_entry_vec);
 	void cache_kv_items(std::vector<cq_entry_t *> *cq_entry_vec, vs_entry_t *vs_entry, int ops);
-	void cache_free_kv_items(at_entry_t *at_entry, int curMTSThread);
+	void cache_free_kv_items(at_entry_t *at_entry);
 	uint64_t complete_pending_ios(ValueStorage *vs, int ring_idx, int ops, std::vector<cq_entry_t *> *cq_entry_vec);
 	void complete_pending_ios(ValueStorage *vs, int ring_idx);
 
@@ -105,6 +199,7 @@ class MTSImpl {
 
 	void createCacheThread();
 	void createIOCompleterThread();
+	void createReclaimThread();
 
 	void registerThread();
 	void unregisterThread();
@@ -121,4 +216,27 @@ class MTSImpl {
 	std::atomic<uint64_t> total_link_time;
 };
 
+/* Returns the (key, value) pairs from a start key on, in key order. While
+ * the caller consumes a batch, the ValueStorage reads of the next one are
+ * in flight on the read ring of the calling thread, so an iterator must be
+ * used and destroyed by the thread which created it. The ring stays claimed
+ * until then: scan(), multi_get() or a second iterator on the same thread
+ * meanwhile is a fatal error. */
+class MTSIterator {
+    private:
+	MTSImpl *mts;
+	std::vector<std::pair<Key_t, Value_t>> cur;
+	size_t pos;
+	std::unique_ptr<scan_batch_t> next_batch;	/* nullptr at the end */
+
+	void advance();
+
+    public:
+	MTSIterator(MTSImpl *mts, Key_t startKey);
+	MTSIterator(MTSIterator &&) = default;
+	~MTSIterator();
+
+	bool next(Key_t &key, Value_t &val);
+};
+
 #endif //MTS_MTS_H
@@ -10,6 +10,7 @@ class MTSThread {
 	bool finish;
 	volatile std::atomic<uint64_t> runCnt;
 	int valuestorageId;
+	int logId; /* PWB and AddressTable owned while registered */
     public:
 	MTSThread(int threadId) {
 	    this->threadId = threadId;
@@ -17,6 +18,7 @@ class MTSThread {
 	    this->runCnt = 0;
 
 	    this->valuestorageId = -1;
+	    this->logId = -1;
 #ifdef MTS_STATS_GET
 	    get_cnt = 0;
 	    dcache_hit_cnt = 0;
@@ -65,6 +67,8 @@ class MTSThread {
 
 	void setValueStorageId(int id) {this->valuestorageId = id;};
 	int getValueStorageId() {return this->valuestorageId;};
+	void setLogId(int id) {this->logId = id;};
+	int getLogId() {return this->logId;};
 };
 
 #endif //MTS_THREADS_H
@@ -14,42 +14,107 @@ OpLog::OpLog(const char *path, int id) {
     oplog2.ready = false;
     reclaim_lock = false;
     g_oplog_id = id;
-    total_ol_write_count = 0;
+    total_ol_write_bytes = 0;
 
     working_oplog = &oplog1;
 }
 
 
 OpLog::~OpLog() {
-    if(reclaim_lock == true) {
-	reclaim_thread->join();
-	delete reclaim_thread;
+    while(reclaim_lock == true) {
+	__builtin_ia32_pause();
     }
 }
 
-op_entry_t *OpLog::enq(Key_t key, Val_t val, int type) {
+op_entry_t *OpLog::enq(Key_t key, const Value_t &val, int type) {
+    check_reclaim();
     op_entry_t *op_entry = put_ol_entry(*working_oplog, key, val);
 
     if(op_entry == NEED_RECLAIM) {
 	ts_trace(TS_INFO, "[ENQ] OPLOG RETURNS 'NEED_RECLAIM'\n");
-	if (reclaim_lock == true) {
-	    reclaim_thread->join();
-	    delete reclaim_thread;
-	}
+	switch_oplog();
+	op_entry = put_ol_entry(*working_oplog, key, val);
+    }
 
-	reclaimed_oplog = working_oplog;
-	ts_trace(TS_INFO, "[ENQ] Reclaimed_oplog ID: %d, ready: %d | READY FOR RECLAIMING\n",
-		reclaimed_oplog->id, reclaimed_oplog->ready);
+    return op_entry;
+}
 
-	volatile int oplog_id = reclaimed_oplog->id;
-	reclaim_thread = new std::thread(&OpLog::reclaim, this, oplog_id);
-	pin_thread(reclaim_thread, g_oplog_id, MTS_THREAD_NUM);
+/*
+ * Past MTS_OPLOG_SWITCH_MARK, switches to the other half as soon as its
+ * reclaim is done. Until then writers keep appending and only yield to the
+ * reclaim workers; they wait in switch_oplog() if the half fills up.
+ */
+void OpLog::check_reclaim() {
+    if(oplog_used(working_oplog) < MTS_OPLOG_SWITCH_MARK)
+	return;
+
+    if(reclaim_lock == false)
+	switch_oplog();
+    else std::this_thread::yield();
+}
 
-	working_oplog = get_another_oplog(reclaimed_oplog);
-	op_entry = put_ol_entry(*working_oplog, key, val);
+/* Hands the working oplog to a reclaim worker */
+void OpLog::switch_oplog() {
+    while(reclaim_lock == true) {
+	__builtin_ia32_pause();
     }
 
-    return op_entry;
+    reclaimed_oplog = working_oplog;
+    ts_trace(TS_INFO, "[ENQ] Reclaimed_oplog ID: %d, ready: %d | READY FOR RECLAIMING\n",
+	    reclaimed_oplog->id, reclaimed_oplog->ready);
+
+    reclaim_lock = true;
+    g_reclaimMutex.lock();
+    g_reclaimQueue.push({this, reclaimed_oplog->id});
+    g_reclaimMutex.unlock();
+    g_reclaimCond.notify_one();
+
+    working_oplog = get_another_oplog(reclaimed_oplog);
+}
+
+/* Enqueues up to n entries as one group: one fence and one tail persist
+ * for all entries that fit in the working oplog. Returns the number
+ * enqueued. The oplog may switch only before the group is written, so the
+ * caller links a group to its at_entries before enqueueing the next one;
+ * a reclaim worker must never see an entry whose opa is not set yet. */
+int OpLog::multi_enq(const Key_t *keys, const Value_t *vals, int n, op_entry_t **op_entries) {
+    check_reclaim();
+
+    while(true) {
+	int nr = put_ol_entries(*working_oplog, keys, vals, n, op_entries);
+	if(nr > 0)
+	    return nr;
+	ts_trace(TS_INFO, "[MULTI_ENQ] OPLOG RETURNS 'NEED_RECLAIM'\n");
+	switch_oplog();
+    }
+}
+
+int OpLog::put_ol_entries(ts_oplog_t &oplog, const Key_t *keys, const Value_t *vals, int n, op_entry_t **op_entries) {
+    int nr = 0;
+
+    /* Reserve the space of the entries that fit, then write them without draining */
+    while(nr < n) {
+	unsigned long entry_size = MTS_OPLOG_ENTRY_SIZE(vals[nr].size());
+	if (unlikely(oplog.tail_cnt - oplog.head_cnt + entry_size > MTS_OPLOG_HIGH_MARK))
+	    break;
+
+	op_entry_t *op_entry = nvlog_enq(&oplog, entry_size);
+	op_entry->len = vals[nr].size();
+	op_entry->version = 0;
+	pmem_memcpy((void *)op_entry->val, (void *)vals[nr].data(), vals[nr].size(), PMEM_F_MEM_NONTEMPORAL | PMEM_F_MEM_NODRAIN);
+	pmem_memcpy((void *)&op_entry->key, (void *)&keys[nr], sizeof(Key_t), PMEM_F_MEM_NONTEMPORAL | PMEM_F_MEM_NODRAIN);
+	pmem_flush((void *)&op_entry->size, sizeof(op_entry->size) + sizeof(op_entry->len) + sizeof(op_entry->version));
+	op_entries[nr++] = op_entry;
+    }
+    if (nr == 0)
+	return 0;
+    pmem_drain();
+
+    oplog_enq_persist(&oplog);
+    pmem_persist((void *)&oplog.nvlog_store->tail_cnt, sizeof(oplog.nvlog_store->tail_cnt));
+
+    ts_trace(TS_INFO, "[PUT_OL_ENTRIES] nr: %d oplog->tail_cnt: %lu, oplog->head_cnt: %lu\n", nr, oplog.tail_cnt, oplog.head_cnt);
+    return nr;
 }
 
 ts_oplog_t *OpLog::get_another_oplog(ts_oplog_t *oplog) {
@@ -58,20 +123,17 @@ ts_oplog_t *OpLog::get_another_oplog(ts_oplog_t *oplog) {
     } else return &oplog1;
 }
 
-op_entry_t *OpLog::put_ol_entry(ts_oplog_t &oplog, Key_t key, Val_t val) {
+op_entry_t *OpLog::put_ol_entry(ts_oplog_t &oplog, Key_t key, const Value_t &val) {
     op_entry_t *op_entry;
-    op_info.key = key;
-    op_info.val = val;
 
-    unsigned long entry_size = align_uint_to_cacheline(KV_SIZE);
+    unsigned long entry_size = MTS_OPLOG_ENTRY_SIZE(val.size());
     unsigned long oplog_index = oplog.tail_cnt - oplog.head_cnt + entry_size;
-    op_info.entry_size = entry_size; 
     if (unlikely(oplog_index > MTS_OPLOG_HIGH_MARK)) {
 	ts_trace(TS_INFO, "[PUT_OL_ENTRY] returns NEED_RECLAIM oplog_index: %lu HIGH_MARK: %lu\n", oplog_index, MTS_OPLOG_HIGH_MARK);
 	return NEED_RECLAIM;
     }
 
-    op_entry = oplog_enq(&oplog, &op_info);
+    op_entry = oplog_enq(&oplog, key, val);
 
     ts_trace(TS_INFO, "[PUT_OL_ENTRY] oplog->tail_cnt: %lu, oplog->head_cnt: %lu\n", oplog.tail_cnt, oplog.head_cnt);
 
@@ -79,25 +141,87 @@ op_entry_t *OpLog::put_ol_entry(ts_oplog_t &oplog, Key_t key, Val_t val) {
     return op_entry;
 }
 
-op_entry_t *OpLog::oplog_enq(ts_oplog_t *oplog, op_info_t *op_info) {
+op_entry_t *OpLog::oplog_enq(ts_oplog_t *oplog, Key_t key, const Value_t &val) {
     /* Reserve a space in oplog */
-    op_entry_t *op_entry = (op_entry_t *)nvlog_enq(oplog, op_info->entry_size);
-
-    int dummy_size = sizeof(op_entry->__reserved);
-    int val_size = sizeof(op_info->val) + dummy_size;
+    op_entry_t *op_entry = (op_entry_t *)nvlog_enq(oplog, MTS_OPLOG_ENTRY_SIZE(val.size()));
 
-    op_entry->key = op_info->key;
-    op_entry->val = op_info->val;
+    op_entry->key = key;
+    op_entry->len = val.size();
+    op_entry->version = 0;
+    memcpy((void *)op_entry->val, (void *)val.data(), val.size());
   
-    pmem_persist((void *)&op_entry, op_info->entry_size);
+    /* the room for a second copy is not written yet */
+    pmem_persist((void *)op_entry, MTS_OPLOG_WRITE_SIZE(val.size()));
    /* oplog_enq_persist */
     oplog_enq_persist(oplog);
 
     return op_entry;
 }
 
-void OpLog::link_to_at(op_entry_t *op_entry, at_entry_t *at_entry) {
-    pmem_memcpy((void *)&op_entry->opa, (void *)&at_entry, sizeof(at_entry), PMEM_F_MEM_NONTEMPORAL);
+/*
+ * Coalesces an update into the key's live op_entry if that entry is in the
+ * working oplog: only this thread writes it and no worker reclaims it.
+ * A value of the entry's length of up to MTS_OPLOG_OVERWRITE_MAX bytes is
+ * written into the copy not in use and made valid by persisting the bumped
+ * version, so a crash leaves either value whole. Other updates are
+ * appended.
+ */
+bool OpLog::overwrite(at_entry_t *at_entry, const Value_t &val) {
+    intptr_t val_addr = (intptr_t)at_entry->val_addr;
+
+    /* reclaimed entries are served by ValueStorage */
+    if(get_tag(val_addr) != OPLOG_VAL || at_entry->vs_idx.vs_id > -1)
+	return false;
+
+    op_entry_t *op_entry = (op_entry_t *)get_untagged_ptr(val_addr);
+    uintptr_t buffer = (uintptr_t)working_oplog->buffer;
+    if((uintptr_t)op_entry < buffer || (uintptr_t)op_entry >= buffer + working_oplog->log_size)
+	return false;
+    if(op_entry->opa != at_entry)
+	return false;
+    if(op_entry->len != val.size() || val.size() > MTS_OPLOG_OVERWRITE_MAX)
+	return false;
+    if(val.empty())
+	return true;
+
+    uint32_t version = op_entry->version + 1;
+    pmem_memcpy((void *)op_entry_val(op_entry, version), (void *)val.data(), val.size(), PMEM_F_MEM_NONTEMPORAL);
+    *(volatile uint32_t *)&op_entry->version = version;
+    pmem_persist((void *)&op_entry->version, sizeof(op_entry->version));
+    return true;
+}
+
+/*
+ * Copies the value of at_entry's op_entry. Fails if the value is not in an
+ * oplog or its entry is reclaimed, replaced or overwritten while being
+ * copied.
+ */
+bool OpLog::read_val(at_entry_t *at_entry, Value_t *val, Key_t *key) {
+    void *val_addr = at_entry->val_addr;
+    if(get_tag((intptr_t)val_addr) != OPLOG_VAL)
+	return false;
+
+    op_entry_t *op_entry = (op_entry_t *)get_untagged_ptr((intptr_t)val_addr);
+    if(op_entry == nullptr || op_entry->opa != at_entry)
+	return false;
+
+    uint32_t len = std::min((unsigned long)op_entry->len, MTS_VAL_MAX_SIZE);
+    uint32_t version = *(volatile uint32_t *)&op_entry->version;
+    smp_rmb();
+    val->assign(op_entry_val(op_entry, version), len);
+    if(key)
+	*key = op_entry->key;
+
+    smp_rmb();
+    return *(volatile uint32_t *)&op_entry->version == version &&
+	op_entry->opa == at_entry && at_entry->val_addr == val_addr;
+}
+
+void OpLog::link_to_at(op_entry_t *op_entry, at_entry_t *at_entry, bool drain) {
+    unsigned int flags = PMEM_F_MEM_NONTEMPORAL;
+    if(!drain)
+	flags |= PMEM_F_MEM_NODRAIN;
+    pmem_memcpy((void *)&op_entry->opa, (void *)&at_entry, sizeof(at_entry), flags);
 }
 
 void OpLog::unlink_to_at(at_entry_t *at_entry) {
@@ -108,6 +232,17 @@ void OpLog::unlink_to_at(at_entry_t *at_entry) {
     pmem_persist((void *)&at_entry, sizeof(at_entry_t));
 }
 
+/* at_entry lies in one of the AddressTables */
+static bool at_entry_valid(at_entry_t *at_entry) {
+    if(at_entry == NULL)
+	return false;
+    for(int at_id = 0; at_id < MTS_AT_NUM; at_id++) {
+	if(g_perNumaAddressTable[at_id]->get_at_id(at_entry) > -1)
+	    return true;
+    }
+    return false;
+}
+
 void OpLog::reclaim(volatile int oplog_id) {
     /* Init */
     ts_oplog_t *oplog;
@@ -116,7 +251,6 @@ void OpLog::reclaim(volatile int oplog_id) {
     else oplog = &oplog2;
 
     oplog->reclaimed = true;
-    reclaim_lock = true;
     oplog->ready = false;
     ts_trace(TS_INFO, "[RECLAIM] BEGIN OpLog ID: %d ready: %d\n", oplog->id, oplog->ready);
 
@@ -142,11 +276,12 @@ void OpLog::reclaim(volatile int oplog_id) {
     while ((op_entry = oplog_peek_head(oplog))) {
 	at_entry = (at_entry_t *)op_entry->opa;
 
-	/* validation test */
-	if (op_entry == (op_entry_t *)get_untagged_ptr((intptr_t)at_entry->val_addr)) {
+	/* validation test; after a crash the last entries may not have been
+	 * linked yet, leaving opa NULL or stale */
+	if (at_entry_valid(at_entry) &&
+		op_entry == (op_entry_t *)get_untagged_ptr((intptr_t)at_entry->val_addr)) {
 	    Key_t key = op_entry->key;
-	    Val_t val = op_entry->val;
-	    vs->put_vs_entry(g_oplog_id, key, val, at_entry);
+	    vs->put_vs_entry(g_oplog_id, key, op_entry_val(op_entry, op_entry->version), op_entry->len, at_entry, vs_stream(at_entry));
 
 	    if(!written_vs_set.count(vs_id))
 		written_vs_set.insert(vs_id);
@@ -194,6 +329,22 @@ void OpLog::reclaim(volatile int oplog_id) {
     smp_wmb_tso();
 }
 
+/* Moves the entries left in both halves into the value storage */
+void OpLog::replay() {
+    ts_oplog_t *halves[2] = {get_another_oplog(working_oplog), working_oplog};
+
+    for(ts_oplog_t *oplog : halves) {
+	if(oplog_used(oplog) == 0)
+	    continue;
+
+	while(reclaim_lock == true) {
+	    __builtin_ia32_pause();
+	}
+	reclaim_lock = true;
+	reclaim(oplog->id);
+    }
+}
+
 op_entry_t *OpLog::nvlog_enq(ts_nvlog_t *nvlog, unsigned int obj_size) {
     /* allocate a buffer for a given size
      * only update nvlog->tail_cnt (do not update nvlog_store->tail_cnt */
@@ -204,8 +355,6 @@ op_entry_t *OpLog::nvlog_enq(ts_nvlog_t *nvlog, unsigned int obj_size) {
     /* Make an entry size  */
     entry_size = align_uint_to_cacheline(obj_size);
 
-    ts_assert(KV_SIZE == entry_size);
-
     if (entry_size > nvlog->log_size) {
 	ts_trace(TS_ERROR, "[OVERFLOW_OUT] entry_size > nvlog->log_size)\n");
 	goto overflow_out;
@@ -279,41 +428,8 @@ op_entry_t *OpLog::oplog_peek_head(ts_oplog_t *oplog) {
 }
 
 ValueStorage *OpLog::pick_valuestorage(int oplog_id) {
-    std::random_device ol_rd;
-    std::mt19937 ol_gen(ol_rd());
-    std::uniform_int_distribution<> dist(0, MTS_VS_NUM-1);
-    int vs_id = dist(ol_gen);
-    int vs_id1 = dist(ol_gen);
-    int vs_id2 = dist(ol_gen);
-
-    ValueStorage *vs;
-
-    ValueStorage *vs1 = g_perNumaValueStorage[vs_id1];
-    ValueStorage *vs2 = g_perNumaValueStorage[vs_id2];
-
-    if(vs1->need_gc() && vs2->need_gc()) {
-	vs_id = (vs_id1 < vs_id2) ? vs_id1 : vs_id2;
-    } else if (vs1->get_used_chunk_num() < vs2->get_used_chunk_num()) {
-	vs_id = vs_id1;
-    } else
-	vs_id = vs_id2;
-
-    ts_trace(TS_INFO, "[PICK_VS] OPLOG_ID: %d VS_ID: %d(%d), VS_ID1: %d(%d), VS_ID2: %d(%d)\n", 
-	    oplog_id, vs_id, vs->get_used_chunk_num(),
-	    vs_id1, vs1->get_used_chunk_num(), vs_id2, vs2->get_used_chunk_num());
-
-    vs = g_perNumaValueStorage[vs_id];
-
-    while(true) {
-	if(!vs->is_writing) {
-	    ts_trace(TS_INFO, "[PICK_VS] OPLOG_ID: %d VS_ID: %d %d / %lu\n", oplog_id, vs_id, vs->get_used_chunk_num(), MTS_VS_HIGH_MARK);
-	    break;
-	}
-
-	vs_id = dist(ol_gen);
-	vs = g_perNumaValueStorage[vs_id];
-	ts_trace(TS_INFO, "[TRY_PICK_VS] OPLOG_ID: %d  VS_ID: %d %d / %lu\n", oplog_id, vs_id, vs->get_used_chunk_num(), MTS_VS_HIGH_MARK);
-    }
+    ValueStorage *vs = pick_vs_for_write();
 
+    ts_trace(TS_INFO, "[PICK_VS] OPLOG_ID: %d VS_ID: %d %d / %lu\n", oplog_id, vs->get_vs_id(), vs->get_used_chunk_num(), MTS_VS_HIGH_MARK);
     return vs;
 }
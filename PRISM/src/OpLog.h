@@ -25,19 +25,22 @@ class MTSThread;
 typedef struct at_entry at_entry_t;
 
 typedef struct mts_op_entry {
-    Val_t val;
-    unsigned char __reserved[KV_SIZE - sizeof(val) - (L1_CACHE_BYTES * 1)];
     at_entry_t *opa;	/* for table address */
     Key_t key;
-    size_t size;
-    unsigned char __reserved2[(L1_CACHE_BYTES * 1) - sizeof(opa) - sizeof(size) - sizeof(key)];
+    size_t size;	/* of the entry: MTS_OPLOG_ENTRY_SIZE(len) */
+    uint32_t len;
+    uint32_t version;	/* bumped by overwrite(); its low bit picks the copy of the value */
+    unsigned char __reserved[MTS_OPLOG_META_SIZE - sizeof(opa) - sizeof(key) - sizeof(size) - sizeof(len) - sizeof(version)];
+    char val[];
 } __nvm ____ptr_aligned op_entry_t;
+static_assert(sizeof(op_entry_t) == MTS_OPLOG_META_SIZE, "op_entry_t header size");
 
-typedef struct mts_op_info {
-    unsigned int entry_size;
-    Key_t key;
-    Val_t val;
-} op_info_t;   
+/* the copy of the value that is valid at a version of the entry */
+static inline char *op_entry_val(op_entry_t *op_entry, uint32_t version) {
+    if(!(version & 1))
+	return op_entry->val;
+    return op_entry->val + MTS_OPLOG_VAL_SPAN(op_entry->len);
+}
 
 class OpLog {
     private:
@@ -50,8 +53,7 @@ class OpLog {
 	ts_oplog_t *reclaimed_oplog;
 
 	int need_recovery;
-	op_info_t op_info;
-	
+
     public:
 	ts_oplog_t oplog1;
 	ts_oplog_t oplog2;
@@ -61,23 +63,35 @@ class OpLog {
 	OpLog(const char *path, int ol_id);
 	~OpLog();
 
-	std::atomic<uint64_t> total_ol_write_count;
+	std::atomic<uint64_t> total_ol_write_bytes;
 	
 	/* Enqueue Steps */
-	op_entry_t *enq(Key_t key, Val_t val, int type);
-	op_entry_t *put_ol_entry(ts_oplog_t &oplog, Key_t key, Val_t val);
+	op_entry_t *enq(Key_t key, const Value_t &val, int type);
+	op_entry_t *put_ol_entry(ts_oplog_t &oplog, Key_t key, const Value_t &val);
+	void check_reclaim();
+	void switch_oplog();
 	ts_oplog_t *get_another_oplog(ts_oplog_t *oplog);
-	op_entry_t *oplog_enq(ts_oplog_t *oplog, op_info_t *op_info);
+	op_entry_t *oplog_enq(ts_oplog_t *oplog, Key_t key, const Value_t &val);
+
+	/* Group commit */
+	int multi_enq(const Key_t *keys, const Value_t *vals, int n, op_entry_t **op_entries);
+	int put_ol_entries(ts_oplog_t &oplog, const Key_t *keys, const Value_t *vals, int n, op_entry_t **op_entries);
 	op_entry_t *nvlog_enq(ts_nvlog_t *nvlog, unsigned int obj_size);
 	void oplog_enq_persist(ts_oplog_t *oplog);
 	
+	/* Write coalescing */
+	bool overwrite(at_entry_t *at_entry, const Value_t &val);
+
+	/* Lookup */
+	static bool read_val(at_entry_t *at_entry, Value_t *val, Key_t *key = nullptr);
+
 	/* MTS Consistency */
-	void link_to_at(op_entry_t *op_entry, at_entry_t *at_entry);
+	void link_to_at(op_entry_t *op_entry, at_entry_t *at_entry, bool drain = true);
 	void unlink_to_at(at_entry_t *at_entry);
 
 	/* Recalim and Dequeue */
-	std::thread *reclaim_thread;
 	void reclaim(volatile int oplog_id);
+	void replay();
 	op_entry_t *oplog_peek_head(ts_oplog_t *oplog);
 	op_entry_t *oplog_deq(ts_oplog_t *oplog);
 	void oplog_deq_persist(ts_oplog_t *oplog);
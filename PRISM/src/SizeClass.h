@@ -0,0 +1,62 @@
+#ifndef MTS_SIZECLASS_H
+#define MTS_SIZECLASS_H
+
+#include <utility>
+#include "mts-config.h"
+#include "SlabPool.h"
+
+/*
+ * Variable-size objects from a SlabPool per size class, two classes per
+ * power of two from MTS_SC_MIN_SIZE. Memory of a class is only reused by
+ * the same class, so a reader racing with the reuse of an object still
+ * reads within an object of that size.
+ */
+static constexpr size_t sc_size(int cls) {
+    return (size_t)(cls & 1 ? 3 : 2) * (MTS_SC_MIN_SIZE / 2) << (cls / 2);
+}
+
+/* the smallest class holding size bytes, -1 if none does */
+static inline int sc_class(size_t size) {
+    for(int cls = 0; cls < MTS_SC_NUM; cls++) {
+	if(size <= sc_size(cls))
+	    return cls;
+    }
+    return -1;
+}
+
+template <size_t N>
+struct sc_block {
+    alignas(16) unsigned char data[N];
+};
+
+template <int cls>
+static void *sc_alloc_class() {
+    return SlabPool<sc_block<sc_size(cls)>>::alloc();
+}
+
+template <int cls>
+static void sc_free_class(void *obj) {
+    SlabPool<sc_block<sc_size(cls)>>::free((sc_block<sc_size(cls)> *)obj);
+}
+
+template <size_t... cls>
+static inline void *sc_alloc(int c, std::index_sequence<cls...>) {
+    static void *(*const alloc[])() = {sc_alloc_class<cls>...};
+    return alloc[c]();
+}
+
+template <size_t... cls>
+static inline void sc_free(int c, void *obj, std::index_sequence<cls...>) {
+    static void (*const free[])(void *) = {sc_free_class<cls>...};
+    free[c](obj);
+}
+
+static inline void *sc_alloc(int cls) {
+    return sc_alloc(cls, std::make_index_sequence<MTS_SC_NUM>());
+}
+
+static inline void sc_free(int cls, void *obj) {
+    sc_free(cls, obj, std::make_index_sequence<MTS_SC_NUM>());
+}
+
+#endif
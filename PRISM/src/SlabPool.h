@@ -0,0 +1,151 @@
+#ifndef MTS_SLABPOOL_H
+#define MTS_SLABPOOL_H
+
+#include <vector>
+#include <new>
+#include <atomic>
+#include <sched.h>
+#include <numa.h>
+#include "util.h"
+#include "mts-config.h"
+#include "SpinLock.h"
+
+/*
+ * Object pool of one type. Objects are carved out of slabs on the NUMA node
+ * of the allocating thread and are recycled without being destroyed, so a
+ * pooled std::vector keeps its capacity. Every thread caches free objects of
+ * its own node; objects of other nodes are handed back to their node in
+ * batches of MTS_SLAB_BATCH.
+ */
+template <typename T>
+class SlabPool {
+    private:
+	typedef struct slab_obj {
+	    T obj; /* must stay first */
+	    struct slab_obj *next;
+	    int node;
+	} slab_obj_t;
+
+	typedef struct magazine {
+	    slab_obj_t *head;
+	    int cnt;
+	} magazine_t;
+
+	typedef struct thread_cache {
+	    magazine_t mag[MTS_SLAB_NODE_NUM];
+	    int node;
+
+	    thread_cache() {
+		node = numa_node_of_cpu(sched_getcpu());
+		if(node < 0 || node >= MTS_SLAB_NODE_NUM)
+		    node = 0;
+		for(int i = 0; i < MTS_SLAB_NODE_NUM; i++)
+		    mag[i] = {nullptr, 0};
+	    }
+
+	    ~thread_cache() {
+		for(int i = 0; i < MTS_SLAB_NODE_NUM; i++) {
+		    if(mag[i].cnt)
+			push_depot(i, mag[i]);
+		}
+	    }
+	} thread_cache_t;
+
+	/* magazines of free objects per node */
+	static SpinLock depot_lock[MTS_SLAB_NODE_NUM];
+	static std::vector<magazine_t> depot[MTS_SLAB_NODE_NUM];
+	static thread_local thread_cache_t tc;
+
+	static void push_depot(int node, magazine_t &mag) {
+	    depot_lock[node].lock();
+	    depot[node].push_back(mag);
+	    depot_lock[node].unlock();
+	    mag = {nullptr, 0};
+	}
+
+	static bool pop_depot(int node, magazine_t &mag) {
+	    bool ret = false;
+	    depot_lock[node].lock();
+	    if(!depot[node].empty()) {
+		mag = depot[node].back();
+		depot[node].pop_back();
+		ret = true;
+	    }
+	    depot_lock[node].unlock();
+	    return ret;
+	}
+
+	/* slabs are never returned; the pool stays at its high-water mark */
+	static void grow(int node) {
+	    size_t nr_objs = MTS_SLAB_SIZE / sizeof(slab_obj_t);
+	    if(nr_objs == 0)
+		nr_objs = 1;
+
+	    slab_obj_t *slab = (slab_obj_t *)numa_alloc_onnode(nr_objs * sizeof(slab_obj_t), node);
+	    if(slab == nullptr) {
+		ts_trace(TS_ERROR, "Failed to allocate a slab on node %d\n", node);
+		exit(EXIT_FAILURE);
+	    }
+
+	    magazine_t mag = {nullptr, 0};
+	    for(size_t i = 0; i < nr_objs; i++) {
+		new (&slab[i].obj) T();
+		slab[i].node = node;
+		slab[i].next = mag.head;
+		mag.head = &slab[i];
+		if(++mag.cnt == MTS_SLAB_BATCH)
+		    push_depot(node, mag);
+	    }
+	    if(mag.cnt)
+		push_depot(node, mag);
+	}
+
+    public:
+	static T *alloc() {
+	    magazine_t &mag = tc.mag[tc.node];
+	    if(mag.head == nullptr) {
+		while(!pop_depot(tc.node, mag))
+		    grow(tc.node);
+	    }
+
+	    slab_obj_t *so = mag.head;
+	    mag.head = so->next;
+	    mag.cnt--;
+	    return &so->obj;
+	}
+
+	static void free(T *obj) {
+	    slab_obj_t *so = reinterpret_cast<slab_obj_t *>(obj);
+	    magazine_t &mag = tc.mag[so->node];
+
+	    so->next = mag.head;
+	    mag.head = so;
+	    mag.cnt++;
+
+	    if(so->node != tc.node) {
+		if(mag.cnt == MTS_SLAB_BATCH)
+		    push_depot(so->node, mag);
+	    } else if(mag.cnt == 2 * MTS_SLAB_BATCH) {
+		/* keep one magazine for the next allocations */
+		magazine_t full = {nullptr, 0};
+		while(full.cnt < MTS_SLAB_BATCH) {
+		    slab_obj_t *next = mag.head->next;
+		    mag.head->next = full.head;
+		    full.head = mag.head;
+		    full.cnt++;
+		    mag.head = next;
+		}
+		mag.cnt -= MTS_SLAB_BATCH;
+		push_depot(tc.node, full);
+	    }
+	}
+};
+
+template <typename T>
+SpinLock SlabPool<T>::depot_lock[MTS_SLAB_NODE_NUM];
+template <typename T>
+std::vector<typename SlabPool<T>::magazine_t> SlabPool<T>::depot[MTS_SLAB_NODE_NUM];
+template <typename T>
+thread_local typename SlabPool<T>::thread_cache_t SlabPool<T>::tc;
+
+#endif
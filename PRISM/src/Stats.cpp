@@ -0,0 +1,218 @@
+#include <vector>
+#include <string.h>
+#include "Stats.h"
+#include "SpinLock.h"
+#include "util.h"
+
+/* written by its thread only, read by stat_collect() */
+typedef struct stat_thread {
+    std::atomic<uint64_t> bucket[STAT_LOC_NUM][STAT_BUCKET_NUM];
+    std::atomic<uint64_t> count[STAT_LOC_NUM];
+    std::atomic<uint64_t> sum[STAT_LOC_NUM];
+    std::atomic<uint64_t> max[STAT_LOC_NUM];
+    std::atomic<uint64_t> cnt[STAT_CNT_NUM];
+} stat_thread_t;
+
+/* the stats of an exited thread are kept and handed to the next thread */
+struct stat_handle {
+    stat_thread_t *st = nullptr;
+    ~stat_handle();
+};
+
+static SpinLock stat_lock;
+static std::vector<stat_thread_t *> stat_threads;
+static std::vector<stat_thread_t *> stat_free;
+/* what stat_reset() saw, subtracted by stat_collect() */
+static mts_stats_t stat_base;
+static thread_local stat_handle stat_tls;
+
+stat_handle::~stat_handle() {
+    if(st == nullptr)
+	return;
+    stat_lock.lock();
+    stat_free.push_back(st);
+    stat_lock.unlock();
+}
+
+static stat_thread_t *stat_attach() {
+    stat_lock.lock();
+    if(!stat_free.empty()) {
+	stat_tls.st = stat_free.back();
+	stat_free.pop_back();
+    } else {
+	stat_tls.st = new stat_thread_t();
+	stat_threads.push_back(stat_tls.st);
+    }
+    stat_lock.unlock();
+    return stat_tls.st;
+}
+
+static inline stat_thread_t *stat_self() {
+    if(likely(stat_tls.st != nullptr))
+	return stat_tls.st;
+    return stat_attach();
+}
+
+static inline void stat_add(std::atomic<uint64_t> &v, uint64_t n) {
+    v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+void stat_record(int loc, uint64_t cycles) {
+    stat_thread_t *st = stat_self();
+
+    stat_add(st->bucket[loc][stat_bucket(cycles)], 1);
+    stat_add(st->count[loc], 1);
+    stat_add(st->sum[loc], cycles);
+    if(cycles > st->max[loc].load(std::memory_order_relaxed))
+	st->max[loc].store(cycles, std::memory_order_relaxed);
+}
+
+void stat_count(int cnt, uint64_t n) {
+    stat_add(stat_self()->cnt[cnt], n);
+}
+
+/* lowest value of a bucket */
+static uint64_t stat_bucket_value(int b) {
+    if(b < STAT_SUB_NUM)
+	return b;
+    int msb = b / STAT_SUB_NUM + STAT_SUB_BITS - 1;
+    return (uint64_t)(STAT_SUB_NUM + b % STAT_SUB_NUM) << (msb - STAT_SUB_BITS);
+}
+
+StatHistogram::StatHistogram() {
+    clear();
+}
+
+void StatHistogram::clear() {
+    memset(bucket, 0, sizeof(bucket));
+    count = 0;
+    sum = 0;
+    max = 0;
+}
+
+void StatHistogram::add(const StatHistogram &h) {
+    for(int b = 0; b < STAT_BUCKET_NUM; b++)
+	bucket[b] += h.bucket[b];
+    count += h.count;
+    sum += h.sum;
+    if(h.max > max)
+	max = h.max;
+}
+
+/* max is not subtracted; stat_reset() clears it in the threads instead */
+void StatHistogram::sub(const StatHistogram &h) {
+    for(int b = 0; b < STAT_BUCKET_NUM; b++)
+	bucket[b] -= h.bucket[b];
+    count -= h.count;
+    sum -= h.sum;
+}
+
+double StatHistogram::mean_ns() const {
+    if(count == 0)
+	return 0;
+    return (double)cycles_to_ns(sum) / count;
+}
+
+/* p in [0, 100]; the middle of the bucket holding the p-th value */
+uint64_t StatHistogram::percentile_ns(double p) const {
+    uint64_t rank = (uint64_t)(count * p / 100);
+    uint64_t seen = 0;
+
+    if(count == 0)
+	return 0;
+    if(rank >= count)
+	rank = count - 1;
+
+    for(int b = 0; b < STAT_BUCKET_NUM; b++) {
+	seen += bucket[b];
+	if(seen > rank) {
+	    uint64_t lo = stat_bucket_value(b);
+	    uint64_t hi = b + 1 < STAT_BUCKET_NUM ? stat_bucket_value(b + 1) : lo;
+	    return cycles_to_ns(lo + (hi - lo) / 2);
+	}
+    }
+    return max_ns();
+}
+
+uint64_t StatHistogram::max_ns() const {
+    return cycles_to_ns(max);
+}
+
+static void stat_snapshot(stat_thread_t *st, mts_stats_t *stats) {
+    for(int loc = 0; loc < STAT_LOC_NUM; loc++) {
+	StatHistogram &h = stats->latency[loc];
+	for(int b = 0; b < STAT_BUCKET_NUM; b++)
+	    h.bucket[b] += st->bucket[loc][b].load(std::memory_order_relaxed);
+	h.count += st->count[loc].load(std::memory_order_relaxed);
+	h.sum += st->sum[loc].load(std::memory_order_relaxed);
+	uint64_t max = st->max[loc].load(std::memory_order_relaxed);
+	if(max > h.max)
+	    h.max = max;
+    }
+    for(int c = 0; c < STAT_CNT_NUM; c++)
+	stats->cnt[c] += st->cnt[c].load(std::memory_order_relaxed);
+}
+
+static void stat_zero(mts_stats_t *stats) {
+    for(int loc = 0; loc < STAT_LOC_NUM; loc++)
+	stats->latency[loc].clear();
+    memset(stats->cnt, 0, sizeof(stats->cnt));
+}
+
+static inline double stat_ratio(uint64_t a, uint64_t b) {
+    return b ? (double)a / b : 0;
+}
+
+void stat_collect(mts_stats_t *stats) {
+    stat_zero(stats);
+
+    stat_lock.lock();
+    for(auto st : stat_threads)
+	stat_snapshot(st, stats);
+    for(int loc = 0; loc < STAT_LOC_NUM; loc++)
+	stats->latency[loc].sub(stat_base.latency[loc]);
+    for(int c = 0; c < STAT_CNT_NUM; c++)
+	stats->cnt[c] -= stat_base.cnt[c];
+    stat_lock.unlock();
+
+    uint64_t *cnt = stats->cnt;
+    stats->dcache_hit_ratio = stat_ratio(cnt[STAT_CNT_DCACHE_HIT], cnt[STAT_CNT_GET]) * 100;
+    stats->oplog_hit_ratio = stat_ratio(cnt[STAT_CNT_OPLOG_HIT], cnt[STAT_CNT_GET]) * 100;
+    stats->vs_hit_ratio = stat_ratio(cnt[STAT_CNT_VS_HIT], cnt[STAT_CNT_GET]) * 100;
+    stats->avg_batched_io = stat_ratio(cnt[STAT_CNT_BATCHED_IO], cnt[STAT_CNT_BATCHED_CNT]);
+    stats->pwb_write_bytes = cnt[STAT_CNT_PWB_WRITE_BYTES];
+    stats->vs_write_bytes = cnt[STAT_CNT_VS_WRITE_BYTES];
+    stats->waf = stat_ratio(stats->vs_write_bytes, stats->pwb_write_bytes);
+}
+
+static void stat_reset_locked(int loc) {
+    StatHistogram &base = stat_base.latency[loc];
+
+    base.clear();
+    for(auto st : stat_threads) {
+	for(int b = 0; b < STAT_BUCKET_NUM; b++)
+	    base.bucket[b] += st->bucket[loc][b].load(std::memory_order_relaxed);
+	base.count += st->count[loc].load(std::memory_order_relaxed);
+	base.sum += st->sum[loc].load(std::memory_order_relaxed);
+	/* racing with the owner at worst keeps one old maximum */
+	st->max[loc].store(0, std::memory_order_relaxed);
+    }
+}
+
+void stat_reset() {
+    stat_lock.lock();
+    for(int loc = 0; loc < STAT_LOC_NUM; loc++)
+	stat_reset_locked(loc);
+    memset(stat_base.cnt, 0, sizeof(stat_base.cnt));
+    for(auto st : stat_threads) {
+	for(int c = 0; c < STAT_CNT_NUM; c++)
+	    stat_base.cnt[c] += st->cnt[c].load(std::memory_order_relaxed);
+    }
+    stat_lock.unlock();
+}
+
+void stat_reset(int loc) {
+    stat_lock.lock();
+    stat_reset_locked(loc);
+    stat_lock.unlock();
+}
@@ -0,0 +1,87 @@
+#ifndef MTS_STATS_H
+#define MTS_STATS_H
+
+#include <stdint.h>
+#include <atomic>
+#include "arch.h"
+#include "mts-config.h"
+
+/* latency histograms, in TSC cycles */
+enum {
+    STAT_GET_DCACHE,	/* lookup() served by the DRAM cache */
+    STAT_GET_OPLOG,	/* lookup() served by a PWB */
+    STAT_GET_VS,	/* lookup() read from ValueStorage, from queueing the read */
+    STAT_MULTI_GET,
+    STAT_PUT,		/* insert() and update() */
+    STAT_SCAN,		/* scan(), up to submitting its reads */
+    STAT_KEYINDEX,	/* KeyIndex lookups and inserts */
+    STAT_AT,		/* AddressTable assigns */
+    STAT_LINK,		/* linking an op_entry and its at_entry */
+    STAT_TIMING,	/* add_timing_stat(), under MTS_STATS_LATENCY */
+    STAT_LOC_NUM,
+};
+
+enum {
+    STAT_CNT_GET,
+    STAT_CNT_DCACHE_HIT,
+    STAT_CNT_OPLOG_HIT,
+    STAT_CNT_VS_HIT,
+    STAT_CNT_BATCHED_IO,	/* reads completed in batches */
+    STAT_CNT_BATCHED_CNT,	/* batches completed */
+    STAT_CNT_PWB_WRITE_BYTES,	/* of op_entries written or overwritten */
+    STAT_CNT_VS_WRITE_BYTES,	/* written to ValueStorage, GC included */
+    STAT_CNT_NUM,
+};
+
+/* 16 sub-buckets per power of two: values are kept within 1/16 */
+#define STAT_SUB_BITS 4
+#define STAT_SUB_NUM (1 << STAT_SUB_BITS)
+#define STAT_BUCKET_NUM ((64 - STAT_SUB_BITS + 1) * STAT_SUB_NUM)
+
+static inline int stat_bucket(uint64_t v) {
+    if(v < STAT_SUB_NUM)
+	return v;
+    int msb = 63 - __builtin_clzll(v);
+    return (msb - STAT_SUB_BITS + 1) * STAT_SUB_NUM + ((v >> (msb - STAT_SUB_BITS)) & (STAT_SUB_NUM - 1));
+}
+
+/* Merged histogram of a location; values are reported in ns */
+class StatHistogram {
+    public:
+	uint64_t bucket[STAT_BUCKET_NUM];
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+
+	StatHistogram();
+	void clear();
+	void add(const StatHistogram &h);
+	void sub(const StatHistogram &h);
+	double mean_ns() const;
+	uint64_t percentile_ns(double p) const;
+	uint64_t max_ns() const;
+};
+
+typedef struct mts_stats {
+    StatHistogram latency[STAT_LOC_NUM];
+    uint64_t cnt[STAT_CNT_NUM];
+
+    double dcache_hit_ratio;	/* of STAT_CNT_GET, in % */
+    double oplog_hit_ratio;
+    double vs_hit_ratio;
+    double avg_batched_io;
+    uint64_t pwb_write_bytes;
+    uint64_t vs_write_bytes;
+    double waf;			/* vs_write_bytes / pwb_write_bytes */
+} mts_stats_t;
+
+/* hot path: single-writer, relaxed updates of the calling thread's stats */
+void stat_record(int loc, uint64_t cycles);
+void stat_count(int cnt, uint64_t n = 1);
+
+/* merges the stats of all threads since the last stat_reset() */
+void stat_collect(mts_stats_t *stats);
+void stat_reset();
+void stat_reset(int loc);
+
+#endif /* MTS_STATS_H */
@@ -1,3 +1,5 @@
+#include <zlib.h>
+#include <cmath>
 #include "ValueStorage.h"
 
 #define MTS_SET_TIMER(timestamp)  \
@@ -8,35 +10,126 @@
 std::random_device vs_rd;
 std::mt19937 vs_gen(vs_rd());
 
+/* victim_bucket of a chunk holding bytes of valid records; only empty
+ * chunks are in bucket 0 */
+static inline int vs_bucket(size_t bytes) {
+    return bytes ? bytes / MTS_VS_GC_BUCKET_SIZE + 1 : 0;
+}
+
+static uint32_t trailer_crc(const vs_chunk_trailer_t *trailer) {
+    uint32_t crc = crc32(0, (const Bytef *)trailer_slot_end(trailer), trailer->nr_slots * sizeof(uint16_t));
+    return crc32(crc, (const Bytef *)&trailer->nr_slots, sizeof(vs_chunk_trailer_t) - offsetof(vs_chunk_trailer_t, nr_slots));
+}
+
+/* the records of a valid trailer lie in the data of the chunk, as do the
+ * frames holding them if it is compressed. The trailer is read with the
+ * room of MTS_VS_ENTRIES_PER_CHUNK slot ends before it. */
+static bool valid_chunk_trailer(const vs_chunk_trailer_t *trailer) {
+    if(trailer->magic != MTS_VS_TRAILER_MAGIC || trailer->nr_slots > MTS_VS_ENTRIES_PER_CHUNK ||
+	    trailer->nr_frames > MTS_VS_FRAMES_PER_CHUNK || trailer->crc != trailer_crc(trailer))
+	return false;
+
+    const uint16_t *slot_end = trailer_slot_end(trailer);
+    size_t data_limit = MTS_VS_DATA_LIMIT(trailer->nr_slots);
+    int start = 0;
+    for(int i = 0; i < trailer->nr_slots; i++) {
+	int end = slot_end[i];
+	if(end <= start)
+	    return false;
+	start = end;
+    }
+    size_t data_end = start * MTS_VS_RECORD_ALIGN;
+    if(data_end > data_limit)
+	return false;
+
+    if(trailer->nr_frames == 0)
+	return true;
+    start = 0;
+    for(int i = 0; i < trailer->nr_frames; i++) {
+	int end = trailer->frame_end[i];
+	if(end <= start || (end - start) * SECTOR_SIZE > MTS_VS_FRAME_SIZE)
+	    return false;
+	start = end;
+    }
+    return start * SECTOR_SIZE <= data_limit && data_end <= trailer->nr_frames * MTS_VS_FRAME_SIZE;
+}
+
+/* the record of a slot of a chunk read whole, expanded and with a valid
+ * trailer; nullptr if the record found there is not whole */
+static vs_entry_t *chunk_record(char *buffer, int slot) {
+    vs_chunk_trailer_t *trailer = (vs_chunk_trailer_t *)(buffer + MTS_VS_TRAILER_POS);
+    const uint16_t *slot_end = trailer_slot_end(trailer);
+
+    if(slot >= trailer->nr_slots)
+	return nullptr;
+
+    size_t start = slot ? slot_end[slot - 1] * MTS_VS_RECORD_ALIGN : 0;
+    size_t end = slot_end[slot] * MTS_VS_RECORD_ALIGN;
+    if(start >= end || end > MTS_VS_DATA_LIMIT(trailer->nr_slots))
+	return nullptr;
+    vs_entry_t *vs_entry = (vs_entry_t *)(buffer + start);
+    if(vs_entry->slot != slot || vs_entry->len > MTS_VAL_MAX_SIZE || MTS_VS_RECORD_SIZE(vs_entry->len) != end - start)
+	return nullptr;
+    return vs_entry;
+}
+
+/* a record read for at_entry is still its record if the read holds it whole
+ * and it carries at_entry and the slot it was read from */
+static inline bool valid_record(vs_entry_t *vs_entry, vs_read_t *rd, at_entry_t *at_entry) {
+    return rd->avail >= sizeof(vs_entry_t) && vs_entry->at_entry == at_entry && vs_entry->slot == rd->slot &&
+	vs_entry->len <= MTS_VAL_MAX_SIZE && sizeof(vs_entry_t) + vs_entry->len <= rd->avail;
+}
+
 ValueStorage::ValueStorage() {}
 ValueStorage::~ValueStorage() {
     g_endVS = true;
     is_writing= false;
 
+    gc_thread->join();
+    delete gc_thread;
+
+    /* a clean shutdown leaves nothing to re-validate */
+    checkpoint_space_map();
+    pmem_unmap(space_map, sizeof(vs_space_map_t));
+
     for(int i = 0; i < IO_URING_RRING_NUM; i++) {
+	if(!r_ring_ready[i])
+	    continue;
 	io_uring_queue_exit(&r_ring[i]);
+	numa_free(r_region[i].iov_base, R_QD * READ_IO_SIZE);
+	delete src_at_entry_vec[i];
+	delete dst_at_entry_vec[i];
     }
     
-    for(int i = 0; i < IO_URING_WRING_NUM; i++)
+    for(int i = 0; i < MTS_VS_WRITER_NUM; i++) {
+	if(!w_slot_ready[i])
+	    continue;
+	/* every writer drains its pipes with forced_write_chunk() */
 	io_uring_queue_exit(&w_ring[i]);
+	for(int s = 0; s < MTS_VS_STREAM_NUM; s++) {
+	    for(int j = 0; j < MTS_VS_W_DEPTH; j++)
+		free_w_chunk(w_pipe[i][s][j]);
+	}
+    }
 
     io_uring_queue_exit(&gc_w_ring);
     io_uring_queue_exit(&gc_r_ring);
 
-    close(fd[0]); 
-}
-
-bool sort_by_entry(const std::pair<int, int> i, const std::pair<int, int> j) {
-    if (i.second == j.second) i.first < j.first;
-    return (i.second < j.second);
-}
+    for(unsigned long i = 0; i < MTS_VS_CHUNK_NUM; i++) {
+	vs_slot_dir_t *dir = slot_dir[i].load(std::memory_order_relaxed);
+	if(dir)
+	    sc_free(dir->cls, dir);
+    }
+    delete[] slot_dir;
 
-bool sort_by_key_write(const std::pair<Key_t, vs_entry_t *> i, const std::pair<Key_t, vs_entry_t *> j) {
-    return (i.first < j.first);
-}
+    if(frame_index) {
+	for(unsigned long i = 0; i < MTS_VS_CHUNK_NUM; i++)
+	    delete[] frame_index[i];
+	free(frame_index);
+    }
+    delete codec;
 
-bool sort_by_key_sync(const std::pair<Key_t, at_entry_t *> i, const std::pair<Key_t, at_entry_t *> j) {
-    return (i.first < j.first);
+    close(fd[0]); 
 }
 
 ValueStorage::ValueStorage(const char *path, int vs_num) {
@@ -51,6 +144,10 @@ ValueStorage::ValueStorage(const char *path, int vs_num) {
 	exit(EXIT_FAILURE);
     }
 
+    /* rings, buffers and gc_thread are placed on the socket of the device */
+    node = get_device_node(fd[0]);
+    bind_to_node(node);
+
     if(ftruncate(fd[0], MTS_VS_SIZE) == -1) {
 	perror("ValueStorage ftruncate failed\n");
 	exit(EXIT_FAILURE);
@@ -61,206 +158,314 @@ ValueStorage::ValueStorage(const char *path, int vs_num) {
 	exit(EXIT_FAILURE);
     }
 
+    /* slot directories of the chunks, set as they are written or loaded */
+    slot_dir = new std::atomic<vs_slot_dir_t *>[MTS_VS_CHUNK_NUM];
+    for(unsigned long i = 0; i < MTS_VS_CHUNK_NUM; i++)
+	slot_dir[i].store(nullptr, std::memory_order_relaxed);
+
     /* Prepare MANIFEST for ValueStorage */
     init_vs_bitmap_info();
     /* Indicates the offset of free chunks */
     init_free_chunk_list();
-    /* Indicates the offset of used chunks and the number of how many valid entries are in */
-    init_used_chunk_list();
+    /* Buckets used chunks by the valid bytes in them */
+    init_victim_bucket();
+    /* Checkpoints of the above on NVM */
+    init_space_map();
     /* Managing victim & free chunks whil garbage collecting */
 
+    /* rings and buffers of a thread are set up by open_r_ring() when it
+     * registers, those of a PWB by open_w_slot() on its first write */
     for(int i = 0; i < IO_URING_RRING_NUM; i++) {
-	struct io_uring_params *params = (struct io_uring_params *)malloc(sizeof(*params));
-	memset(params, 0, sizeof(*params));
-
-	ret = io_uring_queue_init_params(R_QD, &r_ring[i], params);
-	if(ret < 0) {
-	    ts_trace(TS_ERROR, "iouring r_read queue_init failed!\n");
-	    exit(EXIT_FAILURE);
-	}
+	r_ring_ready[i] = false;
+	pending_ios[i] = 0;
+	is_working[i] = 0;
+	cur_pending_vec_ready[i] = true;
 
 	for (int j = 0; j < R_QD; j++) {
-	    ret = posix_memalign((void **)&r_buffer[i][j].iov_base, SECTOR_SIZE, READ_IO_SIZE);
-	    if(ret != 0) {
-		ts_trace(TS_ERROR, "Failed to allocate r_buffer memory ValueStorage::get_val\n");
-		exit(EXIT_FAILURE);
-	    }
-	    r_buffer[i][j].iov_len = READ_IO_SIZE;
-	    memset(r_buffer[i][j].iov_base, 0, READ_IO_SIZE);
+	    r_req[i][j] = {nullptr, nullptr, 0};
+	    r_info[i][j] = {};
 	}
+    }
 
-	ret = io_uring_register_buffers(&r_ring[i], r_buffer[i], R_QD);
-	if(ret) {
-	    fprintf(stderr, "Please try again with with superuser privileges.\n");
-	    fprintf(stderr, "Error registering buffers: %s", strerror(-ret));
-	    exit(EXIT_FAILURE);
-	}
+    for (int i = 0; i < MTS_VS_WRITER_NUM; i++) {
+	w_slot_ready[i] = false;
+	for (int s = 0; s < MTS_VS_STREAM_NUM; s++)
+	    w_chunk[i][s] = nullptr;
+    }
 
-	pending_ios[i] = 0;
-	is_working[i] = 0;
-	cur_pending_vec_ready[i] = true;
+    ret = io_uring_queue_init(GC_QD, &gc_w_ring, 0);
 
-	/* for enqueueing at_entries,*/
-	src_at_entry_vec[i] = new std::vector<at_entry_t *>;
-	src_at_entry_vec[i]->reserve(R_QD);
-	dst_at_entry_vec[i] = new std::vector<at_entry_t *>;
-	dst_at_entry_vec[i]->reserve(R_QD);
+    if(ret < 0) {
+	ts_trace(TS_ERROR, "iouring gc-write queue_init failed!\n");
+	exit(EXIT_FAILURE);
     }
-    ts_trace(TS_INFO, "IO_URING_READ_POLL enable!\n");
 
-    for(int i = 0; i < IO_URING_WRING_NUM; i++) {
-	ret = io_uring_queue_init(W_QD, &w_ring[i], 0);
+    ret = io_uring_queue_init(GC_QD, &gc_r_ring, 0);
 
-	if(ret < 0) {
-	    ts_trace(TS_ERROR, "iouring write queue_init failed!\n");
-	    exit(EXIT_FAILURE);
-	}
+    if(ret < 0) {
+	ts_trace(TS_ERROR, "iouring gc-read queue_init failed! %d \n", vs_id);
+	exit(EXIT_FAILURE);
     }
-    
-    for (int i = 0; i < MTS_THREAD_NUM; i++) {
-	ret = posix_memalign((void **)&w_buffer[i], SECTOR_SIZE, MTS_VS_CHUNK_SIZE);
-	if(ret != 0) {
-	    ts_trace(TS_ERROR, "Failed to allocate w_buffer memory ValueStorage::init()\n");
-	    exit(EXIT_FAILURE);
-	}
 
-	ret = posix_memalign((void **)&s_buffer[i], SECTOR_SIZE, MTS_VS_CHUNK_SIZE);
+    for(int i = 0; i < 2; i++) {
+	ret = posix_memalign((void **)&gc_r_buffer[i],  SECTOR_SIZE , MTS_VS_CHUNK_SIZE);
 	if(ret != 0) {
-	    ts_trace(TS_ERROR, "Failed to allocate s_buffer memory ValueStorage::sort_chunk()\n");
+	    ts_trace(TS_ERROR, "Failed to allocate memory(gc_r_buffer)\n");
 	    exit(EXIT_FAILURE);
 	}
     }
 
-    ret = io_uring_queue_init(GC_QD, &gc_w_ring, 0);
+    codec = createVSCodec(MTS_VS_CODEC);
+    frame_index = nullptr;
+    if(codec)
+	frame_index = (uint16_t **)calloc(MTS_VS_CHUNK_NUM, sizeof(uint16_t *));
+
+    gc_w_chunk = new_w_chunk(-1, VS_STREAM_COLD);
+    gc_moved_entry_list = gc_w_chunk->moved_entry_list;
+
+    /* r_ring, scan_r_ring bitmap */
+    for(int i = 0; i < IO_URING_RRING_NUM; i++) {
+	r_ring_bitmap[i] = false; 
+    }
+
+    last_ring_idx = 0;
+    cur_ring_idx = 0;
+    total_vs_write_bytes = 0;
+
+    gc_running = false;
+    gc_credit = 0;
+    w_chunk_cnt = 0;
+    gc_idle_w_chunk_cnt = UINT64_MAX;
+    /* unmeasured devices are placed on by load and free space alone */
+    w_inflight = 0;
+    r_lat_ewma = 1;
+    w_lat_ewma = 1;
+    gc_thread = new std::thread(&ValueStorage::gc_thread_exec, this);
+    bind_to_node(-1);
+}
+
+uint32_t ValueStorage::get_vs_id() {
+    return vs_id;
+}
+
+int ValueStorage::get_node() {
+    return node;
+}
+
+/* Sets up a read ring: the lookup ring at startup, or the ring of a
+ * registered thread, which stays with the thread id and is reused by the
+ * next thread taking that id. */
+void ValueStorage::open_r_ring(int ring_idx) {
+    int ret;
+
+    if(r_ring_ready[ring_idx])
+	return;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
 
+    ret = io_uring_queue_init_params(R_QD, &r_ring[ring_idx], &params);
     if(ret < 0) {
-	ts_trace(TS_ERROR, "iouring gc-write queue_init failed!\n");
+	ts_trace(TS_ERROR, "iouring r_read queue_init failed!\n");
 	exit(EXIT_FAILURE);
     }
 
-    ret = io_uring_queue_init(GC_QD, &gc_r_ring, 0);
+    /* registering threads are pinned already, so the region is placed
+     * on the socket of the device explicitly */
+    if(node >= 0)
+	r_region[ring_idx].iov_base = numa_alloc_onnode(R_QD * READ_IO_SIZE, node);
+    else r_region[ring_idx].iov_base = numa_alloc_local(R_QD * READ_IO_SIZE);
+    if(r_region[ring_idx].iov_base == nullptr) {
+	ts_trace(TS_ERROR, "Failed to allocate r_buffer memory ValueStorage::get_val\n");
+	exit(EXIT_FAILURE);
+    }
+    r_region[ring_idx].iov_len = R_QD * READ_IO_SIZE;
+    memset(r_region[ring_idx].iov_base, 0, R_QD * READ_IO_SIZE);
 
-    if(ret < 0) {
-	ts_trace(TS_ERROR, "iouring gc-read queue_init failed! %d \n", vs_id);
+    for (int j = 0; j < R_QD; j++) {
+	r_buffer[ring_idx][j].iov_base = (char *)r_region[ring_idx].iov_base + j * READ_IO_SIZE;
+	r_buffer[ring_idx][j].iov_len = READ_IO_SIZE;
+    }
+
+    ret = io_uring_register_buffers(&r_ring[ring_idx], &r_region[ring_idx], 1);
+    if(ret) {
+	fprintf(stderr, "Please try again with with superuser privileges.\n");
+	fprintf(stderr, "Error registering buffers: %s", strerror(-ret));
 	exit(EXIT_FAILURE);
     }
 
-    ret = posix_memalign((void **)&gc_w_buffer, SECTOR_SIZE, MTS_VS_CHUNK_SIZE);
-    if(ret != 0) {
-	ts_trace(TS_ERROR, "Failed to allocate memory(gc_w_buffer)\n");
+    /* for enqueueing at_entries,*/
+    src_at_entry_vec[ring_idx] = new std::vector<aio_req_t>;
+    src_at_entry_vec[ring_idx]->reserve(R_QD);
+    dst_at_entry_vec[ring_idx] = new std::vector<aio_req_t>;
+    dst_at_entry_vec[ring_idx]->reserve(R_QD);
+
+    r_ring_ready[ring_idx] = true;
+}
+
+/* Sets up the write ring and chunk buffers of a writer slot on its first
+ * write; the pipes of all its streams share the ring. Only the first
+ * caller sets them up, should a slot ever be shared. */
+void ValueStorage::open_w_slot(int oplog_id) {
+    int ret;
+
+    w_slot_lock.lock();
+    if(w_slot_ready[oplog_id]) {
+	w_slot_lock.unlock();
+	return;
+    }
+
+    ret = io_uring_queue_init(W_QD * MTS_VS_W_DEPTH * MTS_VS_STREAM_NUM, &w_ring[oplog_id], 0);
+    if(ret < 0) {
+	ts_trace(TS_ERROR, "iouring write queue_init failed!\n");
 	exit(EXIT_FAILURE);
     }
 
-    ret = posix_memalign((void **)&gc_s_buffer, SECTOR_SIZE, MTS_VS_CHUNK_SIZE);
+    for(int s = 0; s < MTS_VS_STREAM_NUM; s++) {
+	for(int i = 0; i < MTS_VS_W_DEPTH; i++)
+	    w_pipe[oplog_id][s][i] = new_w_chunk(oplog_id, s);
+
+	w_fill[oplog_id][s] = 0;
+	w_chunk[oplog_id][s] = w_pipe[oplog_id][s][0];
+    }
+
+    w_slot_ready[oplog_id].store(true, std::memory_order_release);
+    w_slot_lock.unlock();
+}
+
+w_chunk_t *ValueStorage::new_w_chunk(int id, int stream) {
+    int ret;
+    w_chunk_t *chunk = new w_chunk_t;
+
+    ret = posix_memalign((void **)&chunk->w_buffer, SECTOR_SIZE, MTS_VS_CHUNK_SIZE);
     if(ret != 0) {
-	ts_trace(TS_ERROR, "Failed to allocate memory(gc_s_buffer)\n");
+	ts_trace(TS_ERROR, "Failed to allocate w_buffer memory ValueStorage::new_w_chunk()\n");
 	exit(EXIT_FAILURE);
     }
 
-    ret = posix_memalign((void **)&gc_r_buffer,  SECTOR_SIZE , MTS_VS_CHUNK_SIZE);
+    ret = posix_memalign((void **)&chunk->s_buffer, SECTOR_SIZE, MTS_VS_CHUNK_SIZE);
     if(ret != 0) {
-	ts_trace(TS_ERROR, "Failed to allocate memory(gc_r_buffer)\n");
+	ts_trace(TS_ERROR, "Failed to allocate s_buffer memory ValueStorage::new_w_chunk()\n");
 	exit(EXIT_FAILURE);
     }
 
-    for(int i = 0; i < MTS_THREAD_NUM; i++) {
-	w_chunk[i] = new w_chunk_t;
-	w_chunk[i]->entry_offset = 0;
-	moved_entry_list[i] = new std::vector<moved_entry_t>;	/* for sync at-vs */
-	s_moved_entry_list[i] = new std::vector<std::pair<Key_t, at_entry_t *>>; /* for sorting */
-	s_entry_list[i] = new std::vector<std::pair<Key_t, vs_entry_t *>>;
-
-	moved_entry_list[i]->reserve(MTS_VS_ENTRIES_PER_CHUNK);
-	s_moved_entry_list[i]->reserve(MTS_VS_ENTRIES_PER_CHUNK);
-	s_entry_list[i]->reserve(MTS_VS_ENTRIES_PER_CHUNK);
+    chunk->c_buffer = nullptr;
+    if(codec) {
+	ret = posix_memalign((void **)&chunk->c_buffer, SECTOR_SIZE, MTS_VS_CHUNK_SIZE);
+	if(ret != 0) {
+	    ts_trace(TS_ERROR, "Failed to allocate c_buffer memory ValueStorage::new_w_chunk()\n");
+	    exit(EXIT_FAILURE);
+	}
     }
-    
-    gc_w_chunk = new w_chunk_t;
-    gc_moved_entry_list = new std::vector<moved_entry_t>;
-    s_gc_moved_entry_list = new std::vector<std::pair<Key_t, at_entry_t *>>;
-    s_gc_entry_list = new std::vector<std::pair<Key_t, vs_entry_t *>>;
 
-    /* r_ring, scan_r_ring bitmap */
-    for(int i = 0; i < IO_URING_RRING_NUM; i++) {
-	r_ring_bitmap[i] = false; 
-    }
+    chunk->moved_entry_list = new std::vector<moved_entry_t>;	/* for sync at-vs */
+    chunk->moved_entry_list->reserve(MTS_VS_ENTRIES_PER_CHUNK);
 
-    last_ring_idx = 0;
-    cur_ring_idx = 0;
-    total_vs_write_count = 0;
+    chunk->id = id;
+    chunk->stream = stream;
+    chunk->chunk_offset = -1;
+    chunk->entry_offset = 0;
+    chunk->used = 0;
+    chunk->pending = 0;
+    chunk->in_flight = false;
+    chunk->io_bytes = 0;
+    chunk->submit_ts = 0;
+
+    return chunk;
 }
 
-uint32_t ValueStorage::get_vs_id() {
-    return vs_id;
+void ValueStorage::free_w_chunk(w_chunk_t *chunk) {
+    free(chunk->w_buffer);
+    free(chunk->s_buffer);
+    free(chunk->c_buffer);
+    delete chunk->moved_entry_list;
+    delete chunk;
+}
+
+/* Moves the writer to the next chunk of a stream's pipe, which is the
+ * oldest one in flight if the pipe is full */
+w_chunk_t *ValueStorage::next_w_chunk(int oplog_id, int stream) {
+    int &fill = w_fill[oplog_id][stream];
+    fill = (fill + 1) % MTS_VS_W_DEPTH;
+    w_chunk_t *chunk = w_pipe[oplog_id][stream][fill];
+
+    if(chunk->in_flight)
+	complete_w_chunk(chunk);
+    w_chunk[oplog_id][stream] = chunk;
+
+    return chunk;
 }
 
 /////////////////////////////////////////
 ////* Write value from valuestorage *////
 /////////////////////////////////////////
 
-void ValueStorage::put_vs_entry(int oplog_id, Key_t key, Val_t val, at_entry_t *at_entry) {
+/* Appends a record to a chunk; false if the chunk has no room for it and
+ * the slot end it adds to the trailer */
+bool ValueStorage::add_record(w_chunk_t *chunk, at_entry_t *at_entry, const Key_t &key, const char *val, uint32_t len) {
+    size_t size = MTS_VS_RECORD_SIZE(len);
+
+    if(chunk->entry_offset == MTS_VS_ENTRIES_PER_CHUNK || chunk->used + size > MTS_VS_DATA_LIMIT(chunk->entry_offset + 1))
+	return false;
+
+    vs_entry_t *vs_entry = (vs_entry_t *)(chunk->w_buffer + chunk->used);
+    vs_entry->at_entry = at_entry;
+    vs_entry->key = key;
+    vs_entry->len = len;
+    vs_entry->slot = 0;	/* set once the chunk is sorted */
+    vs_entry->__reserved = 0;
+    memcpy(vs_entry->val, val, len);
+    memset(vs_entry->val + len, 0, size - sizeof(vs_entry_t) - len);
+
+    chunk->w_order[chunk->entry_offset] = {key, chunk->entry_offset, (uint32_t)chunk->used, (uint32_t)size};
+    add_moved_entry_list(chunk->moved_entry_list, chunk->chunk_offset, chunk->entry_offset, vs_entry, OpForm::INSERT);
+    chunk->entry_offset++;
+    chunk->used += size;
+    return true;
+}
+
+void ValueStorage::put_vs_entry(int oplog_id, Key_t key, const char *val, uint32_t len, at_entry_t *at_entry, int stream) {
     /* step 1. Copy value and at_entry from oplog to w_buffer
      * step 2. when w_buffer is full, write()
      * step 3. after writing a chunk, sync_meatadata()
      */
 
-    /* allocating a new vs_entry(value, addresstable address) */
-
-    w_chunk_t *chunk = w_chunk[oplog_id];
+    if(unlikely(!w_slot_ready[oplog_id].load(std::memory_order_acquire)))
+	open_w_slot(oplog_id);
+    /* hot and cold entries fill separate chunks, so that the chunks of
+     * hot ones empty out by themselves */
+    stream = std::min(stream, MTS_VS_STREAM_NUM - 1);
+    w_chunk_t *chunk = w_chunk[oplog_id][stream];
 
     if(chunk->entry_offset == 0) {
-	init_w_chunk(oplog_id);
+	init_w_chunk(oplog_id, stream);
     } 
 
-    if(chunk->entry_offset < MTS_VS_ENTRIES_PER_CHUNK) {
-	vs_entry_t vs_entry = alloc(key, val, at_entry);
-	chunk->w_buffer[chunk->entry_offset] = vs_entry;
-	add_moved_entry_list(chunk->moved_entry_list, chunk->chunk_offset, chunk->entry_offset,
-		(vs_entry_t *)&chunk->w_buffer[chunk->entry_offset], OpForm::INSERT);
-	chunk->entry_offset++;
-    } else if(chunk->entry_offset == MTS_VS_ENTRIES_PER_CHUNK) {
-	write_chunk(chunk, NORMAL_WRITE);
-	sync_with_at(chunk->moved_entry_list, chunk->s_moved_entry_list);
-
-	init_w_chunk(oplog_id);
-
-	vs_entry_t vs_entry = alloc(key, val, at_entry);
-	chunk->w_buffer[chunk->entry_offset] = vs_entry; 
-	add_moved_entry_list(chunk->moved_entry_list, chunk->chunk_offset, chunk->entry_offset,
-		(vs_entry_t *)&chunk->w_buffer[chunk->entry_offset], OpForm::INSERT);
-	chunk->entry_offset++;
-    }
-}
-
-void *ValueStorage::sort_moved_entry(std::vector<moved_entry_t> *moved_entry_list, 
-	std::vector<std::pair<Key_t, at_entry_t *>> *s_moved_entry_list) {
-    for (std::vector<moved_entry_t>::iterator itr = moved_entry_list->begin(); itr != moved_entry_list->end(); itr++) {
-	moved_entry_t temp = *itr;
-
-	Key_t key = temp.key;
-	at_entry_t *s_entry = temp.at_entry;
-	auto s_moved_entry = std::make_pair(key, s_entry);
-	s_moved_entry_list->push_back(s_moved_entry);
-    }
-
-    sort(s_moved_entry_list->begin(), s_moved_entry_list->end(), sort_by_key_sync);
+    /* vs_offset shares a word with vs_id, which a concurrent update may
+     * clear meanwhile */
+    vs_idx_t cur_vs_idx = at_entry->vs_idx;
+    vs_idx_t pre_vs_idx;
+    do {
+	pre_vs_idx = cur_vs_idx;
+	pre_vs_idx.vs_offset = PRE_VALUESTORAGE_VAL;
+    } while(!__atomic_compare_exchange(&at_entry->vs_idx, &cur_vs_idx, &pre_vs_idx, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
 
-    int i = 0;
-    for(std::vector<std::pair<Key_t, at_entry_t *>>::iterator itr = s_moved_entry_list->begin(); itr != s_moved_entry_list->end(); itr++) {
-	moved_entry_list->at(i).at_entry = itr->second;
-	i++;
+    /* a full chunk is written while the next one is filled; it is synced
+     * with the AddressTable when its buffer comes around again */
+    if(!add_record(chunk, at_entry, key, val, len)) {
+	write_chunk(chunk, NORMAL_WRITE);
+	chunk = next_w_chunk(oplog_id, stream);
+	init_w_chunk(oplog_id, stream);
+	add_record(chunk, at_entry, key, val, len);
     }
-
-    s_moved_entry_list->clear();
-    return moved_entry_list;
 }
 
-
-void ValueStorage::sync_with_at(std::vector<moved_entry_t> *moved_entry_list, std::vector<std::pair<Key_t, at_entry_t *>> *s_moved_entry_list) {
-    /* add sort func */
-    sort_moved_entry(moved_entry_list, s_moved_entry_list);
+void ValueStorage::sync_with_at(std::vector<moved_entry_t> *moved_entry_list) {
     ts_trace(TS_INFO, "[SYNC] BEGIN!! SIZE: %lu\n", moved_entry_list->size());
 
+    std::shared_lock<std::shared_mutex> ckpt_guard(ckpt_mutex);
+    log_linked_chunks(moved_entry_list);
+
     for (std::vector<moved_entry_t>::iterator itr = moved_entry_list->begin(); itr != moved_entry_list->end(); itr++) {
 	moved_entry_t temp = *itr;
 	
@@ -272,8 +477,9 @@ void ValueStorage::sync_with_at(std::vector<moved_entry_t> *moved_entry_list, st
     moved_entry_list->clear();
 }
 
-void ValueStorage::gc_sync_with_at(std::vector<moved_entry_t> *gc_moved_entry_list,  std::vector<std::pair<Key_t, at_entry_t *>> *s_gc_moved_entry_list) {
-    sort_moved_entry(gc_moved_entry_list, s_gc_moved_entry_list);
+void ValueStorage::gc_sync_with_at(std::vector<moved_entry_t> *gc_moved_entry_list) {
+    std::shared_lock<std::shared_mutex> ckpt_guard(ckpt_mutex);
+    log_linked_chunks(gc_moved_entry_list);
     for (std::vector<moved_entry_t>::iterator itr = gc_moved_entry_list->begin(); itr != gc_moved_entry_list->end(); itr++) {
 	moved_entry_t temp = *itr;
 
@@ -291,11 +497,23 @@ void ValueStorage::gc_sync_with_at(std::vector<moved_entry_t> *gc_moved_entry_li
 
 void ValueStorage::forced_write_chunk(int oplog_id) {
     ts_trace(TS_INFO, "[forced_write_chunk] start \n");
-    w_chunk_t *chunk = w_chunk[oplog_id];
 
-    write_chunk(chunk, NORMAL_WRITE);
-    sync_with_at(chunk->moved_entry_list, chunk->s_moved_entry_list);
-    chunk->entry_offset = 0;
+    if(!w_slot_ready[oplog_id].load(std::memory_order_acquire))
+	return;
+    for(int s = 0; s < MTS_VS_STREAM_NUM; s++) {
+	w_chunk_t *chunk = w_chunk[oplog_id][s];
+	if(chunk->entry_offset != 0)
+	    write_chunk(chunk, NORMAL_WRITE);
+    }
+
+    /* the caller drops the PWB entries next: drain the pipes, oldest first */
+    for(int s = 0; s < MTS_VS_STREAM_NUM; s++) {
+	for(int i = 1; i <= MTS_VS_W_DEPTH; i++) {
+	    w_chunk_t *chunk = w_pipe[oplog_id][s][(w_fill[oplog_id][s] + i) % MTS_VS_W_DEPTH];
+	    if(chunk->in_flight)
+		complete_w_chunk(chunk);
+	}
+    }
 
     ts_trace(TS_INFO, "[forced_write_chunk] end \n");
 }
@@ -303,8 +521,8 @@ void ValueStorage::forced_write_chunk(int oplog_id) {
 void ValueStorage::gc_link_to_at(int chunk_offset, int entry_offset, at_entry_t *at_entry) {
     vs_idx_t vs_idx = at_entry->vs_idx;
     int cur_vs_id = vs_idx.vs_id;
-    int cur_vs_offset = vs_idx.vs_offset;
-    int new_vs_offset = chunk_offset * MTS_VS_ENTRIES_PER_CHUNK + entry_offset;
+    int64_t cur_vs_offset = vs_idx.vs_offset;
+    int64_t new_vs_offset = chunk_offset * MTS_VS_ENTRIES_PER_CHUNK + entry_offset;
 
     if(smp_cas(&cur_vs_offset, NEWLY_UPDATED_VAL, &cur_vs_offset)) {
 	ts_trace(TS_INFO, "[SET_VS_BITMAP_INFO] UPDATED VAL, SKIP | CASE 1. VALUE IS NEWLY UPDATED IN LOG | CHUNK_OFFSET: %d, ENTRY_OFFSET: %d\n", chunk_offset, entry_offset);
@@ -324,19 +542,19 @@ void ValueStorage::gc_link_to_at(int chunk_offset, int entry_offset, at_entry_t
 	_mm_sfence();
 
 	ts_trace(TS_INFO, "[GC_VS_LINK_TO_AT] VS_ID: %d, CHUNK_OFFSET: %d, ENTRY_OFFSET: %d, ENTRY_COUNT: %lu, at_entry: %p\n",
-		vs_id, chunk_offset, entry_offset, vs_bitmap_info->at(chunk_offset).count(), at_entry);
+		vs_id, chunk_offset, entry_offset, valid_slots(chunk_offset), at_entry);
 
 	set_vs_bitmap_info(chunk_offset, entry_offset);
 	ts_trace(TS_INFO, "[SET_VS_BITMAP_INFO] CHUNK_OFFSET: %d, ENTRY_OFFSET: %d, test(): %d\n", 
-		chunk_offset, entry_offset, vs_bitmap_info->at(chunk_offset).test(entry_offset));
+		chunk_offset, entry_offset, slot_valid(chunk_offset, entry_offset));
     }
     return;
 }
 
 void ValueStorage::link_to_at(int chunk_offset, int entry_offset, at_entry_t *at_entry) {
     op_entry_t *op_entry = (op_entry_t *)at_entry->val_addr;
-    int cur_vs_offset = at_entry->vs_idx.vs_offset;
-    int new_vs_offset = chunk_offset * MTS_VS_ENTRIES_PER_CHUNK + entry_offset;
+    int64_t cur_vs_offset = at_entry->vs_idx.vs_offset;
+    int64_t new_vs_offset = chunk_offset * MTS_VS_ENTRIES_PER_CHUNK + entry_offset;
 
     if(smp_cas(&cur_vs_offset, NEWLY_UPDATED_VAL, &cur_vs_offset)) {
 	ts_trace(TS_INFO, "[SET_VS_BITMAP_INFO] UPDATED VAL, SKIP | CASE 1. VALUE IS NEWLY UPDATED IN LOG | CHUNK_OFFSET: %d, ENTRY_OFFSET: %d\n", chunk_offset, entry_offset);
@@ -352,11 +570,11 @@ void ValueStorage::link_to_at(int chunk_offset, int entry_offset, at_entry_t *at
 	_mm_sfence();
 
 	ts_trace(TS_INFO, "[VS_LINK_TO_AT] VS_ID: %d, CHUNK_OFFSET: %d, ENTRY_OFFSET: %d, ENTRY_COUNT: %lu, at_entry: %p\n",
-		vs_id, chunk_offset, entry_offset, vs_bitmap_info->at(chunk_offset).count(), at_entry);
+		vs_id, chunk_offset, entry_offset, valid_slots(chunk_offset), at_entry);
 
 	set_vs_bitmap_info(chunk_offset, entry_offset);
 	ts_trace(TS_INFO, "[SET_VS_BITMAP_INFO] CHUNK_OFFSET: %d, ENTRY_OFFSET: %d, test(): %d\n", 
-		chunk_offset, entry_offset, vs_bitmap_info->at(chunk_offset).test(entry_offset));
+		chunk_offset, entry_offset, slot_valid(chunk_offset, entry_offset));
 
 	//if(get_tag((intptr_t)at_entry->val_addr) == DCACHE_VAL)
 	    //at_entry->val_addr = nullptr;
@@ -365,81 +583,371 @@ void ValueStorage::link_to_at(int chunk_offset, int entry_offset, at_entry_t *at
 }
 
 void ValueStorage::unlink_to_at(int chunk_offset, int entry_offset, at_entry_t *at_entry) {
-    if(!vs_bitmap_info->at(chunk_offset).test(entry_offset)) {
+    if(!slot_valid(chunk_offset, entry_offset)) {
 	return;
     }
 
     ts_trace(TS_INFO, "[CLEAR_VS_BITMAP_INFO] CHUNK_OFFSET: %d, ENTRY_OFFSET: %d, ENTRY_COUNT: %lu, test(): %d\n", 
-	    chunk_offset, entry_offset, vs_bitmap_info->at(chunk_offset).count(), vs_bitmap_info->at(chunk_offset).test(entry_offset));
+	    chunk_offset, entry_offset, valid_slots(chunk_offset), slot_valid(chunk_offset, entry_offset));
 
     clear_vs_bitmap_info(chunk_offset, entry_offset);
 
     ts_trace(TS_INFO, "[VS_UNLINK_TO_AT] CHUNK_OFFSET: %d, ENTRY_OFFSET: %d, ENTRY_COUNT: %lu, at_entry: %p\n",
-	    chunk_offset, entry_offset, vs_bitmap_info->at(chunk_offset).count(), at_entry);
+	    chunk_offset, entry_offset, valid_slots(chunk_offset), at_entry);
 
     return;
 }
 
+/* The victim buckets are left to gc_thread: a changed chunk is only
+ * queued by mark_stale_chunk() */
 void ValueStorage::set_vs_bitmap_info(int chunk_offset, int entry_offset) {
-    assert((vs_bitmap_info->at(chunk_offset).count() <= MTS_VS_ENTRIES_PER_CHUNK));
-    vs_bitmap_info->at(chunk_offset).set(entry_offset);
+    assert(entry_offset < (int)MTS_VS_ENTRIES_PER_CHUNK);
+    /* may read the trailer, so not under the lock */
+    size_t size = record_size(chunk_offset, entry_offset);
+    vs_dirty_log_t log = {-1, 0};
+    bool is_set = false;
+
+    chunk_lock_of(chunk_offset).lock();
+    if(!vs_bitmap_info->at(chunk_offset).test(entry_offset)) {
+	log = log_dirty_chunk(chunk_offset);
+	vs_bitmap_info->at(chunk_offset).set(entry_offset);
+	valid_bytes[chunk_offset] += size;
+	is_set = true;
+    }
+    chunk_lock_of(chunk_offset).unlock();
+
+    persist_dirty_log(log);
+    if(is_set)
+	mark_stale_chunk(chunk_offset);
 }
 
 void ValueStorage::clear_vs_bitmap_info(int chunk_offset, int entry_offset) {
-    vs_bitmap_info->at(chunk_offset).reset(entry_offset);
+    size_t size = record_size(chunk_offset, entry_offset);
+    vs_dirty_log_t log = {-1, 0};
+    bool is_cleared = false;
+    bool is_free = false;
+
+    chunk_lock_of(chunk_offset).lock();
+    if(vs_bitmap_info->at(chunk_offset).test(entry_offset)) {
+	size_t valid = valid_bytes[chunk_offset];
+	log = log_dirty_chunk(chunk_offset);
+	vs_bitmap_info->at(chunk_offset).reset(entry_offset);
+	is_free = vs_bitmap_info->at(chunk_offset).none();
+	valid_bytes[chunk_offset] = is_free ? 0 : valid - std::min(valid, size);
+	is_cleared = true;
+    }
+    chunk_lock_of(chunk_offset).unlock();
 
-    if(vs_bitmap_info->at(chunk_offset).count() == 0) {
+    persist_dirty_log(log);
+    if(is_cleared)
+	mark_stale_chunk(chunk_offset);
+    if(is_free) {
 	add_free_chunk_list(chunk_offset);
     }
+}
+
+/* Marks a slot an AddressTable points at on restart; the AddressTables
+ * are scanned concurrently */
+void ValueStorage::recover_slot(int64_t vs_offset) {
+    int chunk_offset = vs_offset / MTS_VS_ENTRIES_PER_CHUNK;
+
+    if(unlikely(chunk_offset >= (int)MTS_VS_CHUNK_NUM)) {
+	ts_trace(TS_ERROR, "[VS_RECOVER] vs_id %d vs_offset %ld is out of the device\n", vs_id, vs_offset);
+	exit(EXIT_FAILURE);
+    }
+    chunk_lock_of(chunk_offset).lock();
+    vs_bitmap_info->at(chunk_offset).set(vs_offset % MTS_VS_ENTRIES_PER_CHUNK);
+    chunk_lock_of(chunk_offset).unlock();
+}
+
+/* Rebuilds the victim buckets and the free chunk stack once the
+ * AddressTables have marked their slots; a VS that loaded its space map
+ * (from_map) starts a new generation. Nothing else may run on this VS. */
+void ValueStorage::recover_chunk_info(bool from_map) {
+    rebuild_chunk_lists(from_map);
+    if(from_map)
+	checkpoint_space_map();
+}
+
+/* Derives the victim buckets and the free chunk stack from vs_bitmap_info.
+ * Valid bytes are counted from the trailers, except those of the chunks
+ * the space map holds unchanged (from_map), whose slot directories are
+ * left to load_slot_dir(). */
+void ValueStorage::rebuild_chunk_lists(bool from_map) {
+    int top = -1;
+    int nr_free = 0;
+    uint64_t last_stamp = 0;
+
+    for(auto &bucket : *victim_bucket)
+	bucket.clear();
+    stale_chunk_head = -1;
+
+    /* lower chunks end up on top of the stack, as after init_free_chunk_list() */
+    for(int i = MTS_VS_CHUNK_NUM - 1; i >= 0; i--) {
+	vs_bitmap &bitmap = vs_bitmap_info->at(i);
+	gc_victim_info->at(i) = false;
+	is_stale_chunk[i] = false;
+	filed_bucket[i] = 0;
+	filed_stamp[i] = 0;
+	chunk_stamp[i] = 0;
+	valid_bytes[i] = 0;
+	if(bitmap.any()) {
+	    is_free_chunk[i] = false;
+	    if(from_map) {
+		chunk_stamp[i] = space_map->state[i].stamp;
+		last_stamp = std::max(last_stamp, chunk_stamp[i]);
+	    }
+	    if(from_map && !is_dirty_chunk->at(i)) {
+		valid_bytes[i] = space_map->state[i].valid_bytes;
+	    } else if(load_chunk_trailer(i)) {
+		for(size_t j = 0; j < bitmap.size(); j++) {
+		    if(bitmap.test(j))
+			valid_bytes[i] += record_size(i, j);
+		}
+	    } else {
+		ts_trace(TS_ERROR, "[VS_RECOVER] no valid trailer! vs_id %d chunk %d\n", vs_id, i);
+		valid_bytes[i] = bitmap.count() * MTS_VS_RECORD_SIZE(0);
+	    }
+	    filed_bucket[i] = vs_bucket(valid_bytes[i]);
+	    victim_bucket->at(filed_bucket[i]).insert({chunk_stamp[i], i});
+	    continue;
+	}
+	free_chunk_next[i] = top;
+	is_free_chunk[i] = true;
+	top = i;
+	nr_free++;
+    }
+    free_chunk_head = (uint32_t)top;
+    free_chunk_num = nr_free;
+    chunk_clock = last_stamp + 1;
 
+    for(int i = 0; i < MTS_VS_WRITER_NUM; i++)
+	reserved_chunk_num[i] = 0;
+
+    ts_trace(TS_INFO, "[VS_RECOVER] VS_ID: %d | TOTAL: %lu | FREE: %d\n", vs_id, MTS_VS_CHUNK_NUM, nr_free);
 }
 
-vs_entry_t ValueStorage::alloc(Key_t key, Val_t val, at_entry_t *at_entry) {
-    at_entry->vs_idx.vs_offset = PRE_VALUESTORAGE_VAL;
+void ValueStorage::init_space_map() {
+    char path[100];
+    size_t mapped_len;
+    int is_pmem;
 
-    vs_entry_t vs_entry;
-    vs_entry.key = key;
-    vs_entry.val = val;
-    vs_entry.at_entry = at_entry;
+    /* by id alone, so that a restart with another number of VSs finds it */
+    if(vs_id < (MTS_VS_NUM / 2))
+	sprintf(path, MTS_VS_MAP_PATH"0/prism/vsmap%d", vs_id);
+    else sprintf(path, MTS_VS_MAP_PATH"1/prism/vsmap%d", vs_id);
 
-    return vs_entry;
+    if((space_map = (vs_space_map_t *)pmem_map_file(path, sizeof(vs_space_map_t), PMEM_FILE_CREATE,
+		    0666, &mapped_len, &is_pmem)) == NULL) {
+	ts_trace(TS_ERROR, "pmem_map_file of the space map failed: %s\n", path);
+	exit(EXIT_FAILURE);
+    }
+
+    is_dirty_chunk = new std::vector<bool>(MTS_VS_CHUNK_NUM, false);
+    dirty_chunk_list = new std::vector<int>;
+    /* until load_space_map() succeeds, the map belongs to an older run */
+    ckpt_full = true;
+    log_gen = space_map->generation;
+    nr_logged = 0;
+    log_inflight[0] = 0;
+    log_inflight[1] = 0;
+}
+
+/* Called whenever a chunk changes, before vs_bitmap_info does; only the
+ * first change in a generation takes a dirty_log slot, which the caller
+ * writes by persist_dirty_log() once its locks are released */
+vs_dirty_log_t ValueStorage::log_dirty_chunk(int chunk_offset) {
+    vs_dirty_log_t log = {-1, 0};
+
+    dirty_lock.lock();
+    if(is_dirty_chunk->at(chunk_offset)) {
+	dirty_lock.unlock();
+	return log;
+    }
+    is_dirty_chunk->at(chunk_offset) = true;
+    dirty_chunk_list->push_back(chunk_offset);
+
+    /* a stale map must not be loaded after a crash; once per run */
+    if(unlikely(ckpt_full && space_map->magic == MTS_VS_MAP_MAGIC)) {
+	space_map->magic = 0;
+	pmem_persist(&space_map->magic, sizeof(space_map->magic));
+    }
+
+    /* a chunk is logged once in a generation, so the slots never run out */
+    log.slot = nr_logged++;
+    log.entry = (log_gen << 32) | (uint32_t)chunk_offset;
+    log_inflight[log_gen & 1]++;
+    dirty_lock.unlock();
+
+    return log;
+}
+
+void ValueStorage::persist_dirty_log(vs_dirty_log_t log, bool drain) {
+    if(log.slot < 0)
+	return;
+
+    int i = (log.entry >> 32) & 1;
+    space_map->dirty_log[i][log.slot] = log.entry;
+    if(drain)
+	pmem_persist(&space_map->dirty_log[i][log.slot], sizeof(uint64_t));
+    else pmem_flush(&space_map->dirty_log[i][log.slot], sizeof(uint64_t));
+    log_inflight[i]--;
+}
+
+/* Logs the chunks an AddressTable is about to point into; the caller keeps
+ * checkpoints out until the links are in vs_bitmap_info */
+void ValueStorage::log_linked_chunks(std::vector<moved_entry_t> *moved_entry_list) {
+    int last_chunk_offset = -1;
+
+    for(auto &moved_entry : *moved_entry_list) {
+	if(moved_entry.chunk_offset != last_chunk_offset)
+	    persist_dirty_log(log_dirty_chunk(moved_entry.chunk_offset), false);
+	last_chunk_offset = moved_entry.chunk_offset;
+    }
+    pmem_drain();
+}
+
+/*
+ * Starts a new generation and writes the state of the chunks changed in
+ * the last one (all of them the first time). The generation is switched
+ * with the links kept out; the state is copied a batch at a time under
+ * the chunk locks and written to NVM without any lock held. A crash
+ * meanwhile leaves the previous generation, whose log covers every chunk
+ * written here.
+ */
+void ValueStorage::checkpoint_space_map() {
+    std::vector<int> *chunks;
+    bool full;
+    uint64_t gen;
+
+    {
+	std::unique_lock<std::shared_mutex> ckpt_guard(ckpt_mutex);
+	dirty_lock.lock();
+	if(!ckpt_full && dirty_chunk_list->empty()) {
+	    dirty_lock.unlock();
+	    return;
+	}
+
+	full = ckpt_full;
+	chunks = dirty_chunk_list;
+	dirty_chunk_list = new std::vector<int>;
+	for(int chunk_offset : *chunks)
+	    is_dirty_chunk->at(chunk_offset) = false;
+
+	/* the array of the new generation was last used two generations
+	 * ago; an unlink may not have written its slot yet */
+	gen = ++log_gen;
+	while(log_inflight[gen & 1] > 0)
+	    __builtin_ia32_pause();
+	nr_logged = 0;
+	dirty_lock.unlock();
+    }
+
+    if(full) {
+	space_map->magic = 0;
+	pmem_persist(&space_map->magic, sizeof(space_map->magic));
+    }
+
+    vs_chunk_state_t *staging_state = new vs_chunk_state_t[MTS_VS_CKPT_BATCH]();
+    size_t nr_chunks = full ? MTS_VS_CHUNK_NUM : chunks->size();
+    for(size_t i = 0; i < nr_chunks; i += MTS_VS_CKPT_BATCH) {
+	size_t nr = std::min((size_t)MTS_VS_CKPT_BATCH, nr_chunks - i);
+
+	for(size_t j = 0; j < nr; j++) {
+	    int chunk_offset = full ? (int)(i + j) : chunks->at(i + j);
+	    chunk_lock_of(chunk_offset).lock();
+	    staging_state[j].valid_bytes = valid_bytes[chunk_offset];
+	    chunk_lock_of(chunk_offset).unlock();
+	    staging_state[j].stamp = chunk_stamp[chunk_offset];
+	}
+	for(size_t j = 0; j < nr; j++) {
+	    int chunk_offset = full ? (int)(i + j) : chunks->at(i + j);
+	    pmem_memcpy(&space_map->state[chunk_offset], &staging_state[j], sizeof(vs_chunk_state_t),
+		    PMEM_F_MEM_NODRAIN);
+	}
+    }
+    pmem_drain();
+    delete[] staging_state;
+    delete chunks;
+
+    /* no change may clear the magic written below */
+    dirty_lock.lock();
+    ckpt_full = false;
+    dirty_lock.unlock();
+
+    space_map->generation = gen;
+    space_map->magic = MTS_VS_MAP_MAGIC;
+    pmem_persist(space_map, offsetof(vs_space_map_t, __reserved));
+
+    ts_trace(TS_INFO, "[VS_CKPT] VS_ID: %d generation: %lu chunks: %lu\n", vs_id, gen, nr_chunks);
+}
+
+/*
+ * Takes up the last checkpoint: the chunks logged as changed after it are
+ * left to have their trailers read by recover_chunk_info(), the others
+ * keep the state the checkpoint holds. Returns false if there is no usable
+ * checkpoint; nothing may run on this VS meanwhile.
+ */
+bool ValueStorage::load_space_map() {
+    uint64_t gen = space_map->generation;
+    uint64_t nr_dirty = 0;
+
+    if(space_map->magic != MTS_VS_MAP_MAGIC)
+	return false;
+
+    /* slots never written hold entries of older generations */
+    for(int i = 0; i < 2; i++) {
+	for(unsigned long j = 0; j < MTS_VS_CHUNK_NUM; j++) {
+	    uint64_t entry = space_map->dirty_log[i][j];
+	    uint32_t chunk_offset = (uint32_t)entry;
+	    if((entry >> 32) < gen || chunk_offset >= MTS_VS_CHUNK_NUM || is_dirty_chunk->at(chunk_offset))
+		continue;
+
+	    /* written by the checkpoint of recover_chunk_info() */
+	    is_dirty_chunk->at(chunk_offset) = true;
+	    dirty_chunk_list->push_back(chunk_offset);
+	    nr_dirty++;
+	}
+    }
+
+    ckpt_full = false;
+    log_gen = gen;
+
+    ts_trace(TS_INFO, "[VS_LOAD_SPACE_MAP] VS_ID: %d generation: %lu changed: %lu\n",
+	    vs_id, gen, nr_dirty);
+    return true;
 }
 
-void ValueStorage::init_w_chunk(int oplog_id) {
+void ValueStorage::init_w_chunk(int oplog_id, int stream) {
     is_writing = true;
-    spinlock.lock();
 
-    /* DO GARBAGE COLLECTION */
+    /* garbage collection runs in gc_thread; only the chunks reserved for it
+     * make the foreground wait */
     if(unlikely(not_enough_free_chunk())) {
 	this->gc_done = true;
-	garbage_collection();
+	while(get_free_chunk_num() <= MTS_VS_GC_RESERVED_CHUNKS && gc_running) {
+	    __builtin_ia32_pause();
+	}
     } else this->gc_done = false;
 
-    w_chunk[oplog_id]->id = oplog_id;
-    w_chunk[oplog_id]->chunk_offset = get_free_chunk_offset();
-    w_chunk[oplog_id]->entry_offset = 0;
-    w_chunk[oplog_id]->w_buffer = w_buffer[oplog_id];
-    w_chunk[oplog_id]->s_buffer = s_buffer[oplog_id];
-    w_chunk[oplog_id]->moved_entry_list = moved_entry_list[oplog_id];
-    w_chunk[oplog_id]->s_moved_entry_list = s_moved_entry_list[oplog_id];
-    w_chunk[oplog_id]->s_entry_list = s_entry_list[oplog_id];
+    w_chunk_t *chunk = w_chunk[oplog_id][stream];
+    chunk->chunk_offset = get_free_chunk_offset(oplog_id);
+    chunk->entry_offset = 0;
+    chunk->used = 0;
+    chunk_stamp[chunk->chunk_offset] = chunk_clock++;
 
     /* INIT WRITE BUFFER */
-    ts_trace(TS_INFO, "[INIT_W_CHUNK] w_chunk_offset: %d, MTS_VS_USED: %lu, MTS_VS_SIZE: %lu\n",
-	    w_chunk[oplog_id]->chunk_offset, MTS_VS_CHUNK_SIZE * w_chunk[oplog_id]->chunk_offset, MTS_VS_SIZE);
+    ts_trace(TS_INFO, "[INIT_W_CHUNK] w_chunk_offset: %d, stream: %d, MTS_VS_USED: %lu, MTS_VS_SIZE: %lu\n",
+	    chunk->chunk_offset, stream, MTS_VS_CHUNK_SIZE * chunk->chunk_offset, MTS_VS_SIZE);
 
     is_writing = false;
-    spinlock.unlock();
 }
 
 void ValueStorage::init_gc_w_chunk() {
     gc_w_chunk->chunk_offset = get_free_chunk_offset();
     gc_w_chunk->entry_offset = 0;
-    gc_w_chunk->w_buffer = gc_w_buffer;
-    gc_w_chunk->s_buffer = gc_s_buffer;
-    gc_w_chunk->moved_entry_list = gc_moved_entry_list;
-    gc_w_chunk->s_moved_entry_list = s_gc_moved_entry_list;
-    gc_w_chunk->s_entry_list = s_gc_entry_list;
+    gc_w_chunk->used = 0;
+    chunk_stamp[gc_w_chunk->chunk_offset] = chunk_clock++;
 
     ts_trace(TS_INFO, "[INIT_GC_W_CHUNK] w_chunk_offset: %d, MTS_VS_USED: %lu, MTS_VS_SIZE: %lu\n",
 	    gc_w_chunk->chunk_offset, MTS_VS_CHUNK_SIZE * gc_w_chunk->chunk_offset, MTS_VS_SIZE);
@@ -450,20 +958,20 @@ void ValueStorage::init_gc_w_chunk() {
 ////* Read value from valuestorage *////
 ////////////////////////////////////////
 
-int ValueStorage::get_val_ccsync(std::vector<at_entry_t *> *at_entry_vec, int ring_idx) {
+int ValueStorage::get_val_ccsync(std::vector<aio_req_t> *at_entry_vec, int ring_idx) {
     int ret;
-    Val_t val;
     int entry_idx = 0;
 
     //ts_trace(TS_ERROR, "ccsync %d\n", at_entry_vec->size());
-    for(std::vector<at_entry_t *>::iterator itr = at_entry_vec->begin(); itr != at_entry_vec->end(); itr++) {
-	at_entry_t *at_entry = *itr;
-
-	/* Value has just moved into the oplog */
-	if(unlikely(at_entry->vs_idx.vs_offset < 0)) {
-	    op_entry_t *op_entry = (op_entry_t *)get_untagged_ptr((intptr_t)at_entry->val_addr);
-	    val = op_entry->val;
-	    ts_trace(TS_INFO, "[GET_VAL_ASYNC] entry in the oplog | val: %d\n", val);
+    for(std::vector<aio_req_t>::iterator itr = at_entry_vec->begin(); itr != at_entry_vec->end(); itr++) {
+	at_entry_t *at_entry = itr->at_entry;
+	int64_t vs_offset = at_entry->vs_idx.vs_offset;
+
+	/* Value has just moved into the oplog, or been cached on its way */
+	if(unlikely(vs_offset < 0)) {
+	    Value_t val;
+	    bool found = OpLog::read_val(at_entry, &val) || read_dc_val(at_entry, &val);
+	    ts_trace(TS_INFO, "[GET_VAL_ASYNC] entry in the oplog | len: %lu\n", val.size());
 #ifdef MTS_STATS_LATENCY
 	    uint64_t start, end, elapsed_time;
 	    end = read_tscp();
@@ -474,27 +982,35 @@ int ValueStorage::get_val_ccsync(std::vector<at_entry_t *> *at_entry_vec, int ri
 		at_entry->timestamp = 0;
 	    }
 #endif
+	    if(itr->ctx) {
+		itr->ctx->cb(itr->ctx->key, val, found);
+		delete itr->ctx;
+	    }
 	    continue;
 	}
 
 	/* Step 1. gathering chunk/vs_entry offset */
-	int r_chunk_offset = at_entry->vs_idx.vs_offset / MTS_VS_ENTRIES_PER_CHUNK;
-	int r_vs_entry_offset = at_entry->vs_idx.vs_offset % MTS_VS_ENTRIES_PER_CHUNK;
+	off64_t io_offset;
+	size_t io_size, entry_pos;
+	locate_entry(vs_offset, &io_offset, &io_size, &entry_pos, &r_info[ring_idx][entry_idx]);
 
-	/* validation test */
 	struct io_uring_sqe *r_sqe;
-	off64_t offset = (r_chunk_offset * MTS_VS_CHUNK_SIZE + r_vs_entry_offset * MTS_VS_ENTRY_SIZE);
-
 	r_sqe = io_uring_get_sqe(&r_ring[ring_idx]);
 	if(!r_sqe) {
-	    ts_trace(TS_ERROR, "[GET_VAL_ASYNC] get set failed, will submit sqe %d\n", entry_idx);
+	    ts_trace(TS_ERROR, "[GET_VAL_ASYNC] get sqe failed, serving %ld entries synchronously\n",
+		    at_entry_vec->end() - itr);
+	    for(; itr != at_entry_vec->end(); itr++)
+		serve_val_sync(&*itr);
 	    break;
 	}
 
-	io_uring_prep_read_fixed(r_sqe, fd[0], r_buffer[ring_idx][entry_idx].iov_base, READ_IO_SIZE, offset, entry_idx);
-	io_uring_sqe_set_data(r_sqe, r_buffer[ring_idx][entry_idx].iov_base);
+	/* read only the sectors covering the record, or its frames */
+	io_uring_prep_read_fixed(r_sqe, fd[0], r_buffer[ring_idx][entry_idx].iov_base, io_size, io_offset, 0);
+	io_uring_sqe_set_data(r_sqe, r_io_data(entry_idx, 1));
+	r_req[ring_idx][entry_idx] = *itr;
+	r_entry[ring_idx][entry_idx] = (vs_entry_t *)((char *)r_buffer[ring_idx][entry_idx].iov_base + entry_pos);
 	ts_trace(TS_INFO, "sub at_entry %p ring_idx %d vs_id %d offset[idx] %lu idx %d\n", 
-		at_entry, ring_idx, vs_id, offset, entry_idx);
+		at_entry, ring_idx, vs_id, io_offset, entry_idx);
 	entry_idx++;
     }
     at_entry_vec->clear();
@@ -512,54 +1028,280 @@ int ValueStorage::get_val_ccsync(std::vector<at_entry_t *> *at_entry_vec, int ri
 
     pending_ios[ring_idx] = pending;
     smp_mb();
+    ioc_wake(vs_id, ring_idx);
 
     return pending; 
 }
 
-cq_entry_t *ValueStorage::make_cq_entry(at_entry_t *at_entry, Val_t val) {
-    cq_entry_t *cq_entry = new cq_entry_t;
-    cq_entry->at_entry = at_entry;
-    cq_entry->val = val;
+/* Serves a request that found no room on the ring with a synchronous read,
+ * following the value if it moves meanwhile */
+void ValueStorage::serve_val_sync(aio_req_t *req) {
+    at_entry_t *at_entry = req->at_entry;
+    Value_t val;
+    int64_t vs_offset;
+    bool found;
+
+    do {
+	vs_offset = at_entry->vs_idx.vs_offset;
+	if(vs_offset < 0)
+	    found = OpLog::read_val(at_entry, &val) || read_dc_val(at_entry, &val);
+	else
+	    found = get_val(at_entry, &val);
+    } while(!found && vs_offset >= 0 && at_entry->vs_idx.vs_offset != vs_offset);
+
+    if(req->ctx) {
+	req->ctx->cb(req->ctx->key, val, found);
+	delete req->ctx;
+    }
+}
 
-    ts_trace(TS_INFO, "[MAKE_CQ_ENTRY] %p %lu\n", at_entry, val);
+/* Returns the number of slots of r_req/r_entry served by a completed read,
+ * starting at *first_slot. */
+int ValueStorage::get_r_slots(struct io_uring_cqe *r_cqe, int *first_slot) {
+    uint64_t data = (uint64_t)(uintptr_t)io_uring_cqe_get_data(r_cqe);
 
-    return cq_entry;
+    *first_slot = (int)(data & 0xffffffffUL);
+    return (int)(data >> 32);
 }
 
-int ValueStorage::get_val_scan(std::vector<at_entry_t *> *at_entry_vec, int ring_idx) {
+/* Submits up to R_QD reads on ring_idx with a single io_uring_submit.
+ * slots[i] receives the r_buffer slot of at_entries[i], or -1 if the value
+ * has just moved into the oplog and must be resolved by the caller. */
+int ValueStorage::submit_val_batch(at_entry_t **at_entries, int nr, int *slots, int ring_idx) {
     int ret;
-    Val_t val;
     int entry_idx = 0;
 
-    for(std::vector<at_entry_t *>::iterator itr = at_entry_vec->begin(); itr != at_entry_vec->end(); itr++) {
-	at_entry_t *at_entry = *itr;
+    assert(nr <= R_QD);
+
+    for(int i = 0; i < nr; i++) {
+	at_entry_t *at_entry = at_entries[i];
+	int64_t vs_offset = at_entry->vs_idx.vs_offset;
 
-	if(at_entry->vs_idx.vs_offset < 0) {
-	    op_entry_t *op_entry = (op_entry_t *)get_untagged_ptr((intptr_t)at_entry->val_addr);
-	    ts_trace(TS_INFO, "[GET_VAL_SCAN] r_chunk_offset: %d, r_vs_entry_offset: %d\n", r_chunk_offset, r_vs_entry_offset);
-	    val = op_entry->val;
+	if(unlikely(vs_offset < 0)) {
+	    slots[i] = -1;
 	    continue;
 	}
 
-	/* Step 1. gathering chunk/vs_entry offset */
-	int r_chunk_offset = at_entry->vs_idx.vs_offset / MTS_VS_ENTRIES_PER_CHUNK;;
-	int r_vs_entry_offset = at_entry->vs_idx.vs_offset % MTS_VS_ENTRIES_PER_CHUNK;
+	off64_t io_offset;
+	size_t io_size, entry_pos;
+	locate_entry(vs_offset, &io_offset, &io_size, &entry_pos, &r_info[ring_idx][entry_idx]);
 
 	struct io_uring_sqe *r_sqe = io_uring_get_sqe(&r_ring[ring_idx]);
 	if(!r_sqe) {
-	    ts_trace(TS_ERROR, "[GET_VAL_SCAN] get set failed, will submit sqe\n");
-	    break;
+	    ts_trace(TS_ERROR, "[GET_VAL_BATCH] get sqe failed! vs_id %d ring_idx %d %d\n", vs_id, ring_idx, entry_idx);
+	    exit(EXIT_FAILURE);
 	}
 
-	off64_t offset = r_chunk_offset * MTS_VS_CHUNK_SIZE + r_vs_entry_offset * MTS_VS_ENTRY_SIZE;
-	io_uring_prep_read_fixed(r_sqe, fd[0], r_buffer[ring_idx][entry_idx].iov_base, READ_IO_SIZE, offset, entry_idx);
-	io_uring_sqe_set_data(r_sqe, r_buffer[ring_idx][entry_idx].iov_base);
-
+	io_uring_prep_read_fixed(r_sqe, fd[0], r_buffer[ring_idx][entry_idx].iov_base, io_size, io_offset, 0);
+	io_uring_sqe_set_data(r_sqe, r_io_data(entry_idx, 1));
+	r_req[ring_idx][entry_idx] = {at_entry, nullptr, 0};
+	r_entry[ring_idx][entry_idx] = (vs_entry_t *)((char *)r_buffer[ring_idx][entry_idx].iov_base + entry_pos);
+	slots[i] = entry_idx;
 	entry_idx++;
     }
-    at_entry_vec->clear();
 
     int pending = entry_idx;
+    if(unlikely(pending == 0)) {
+	return pending;
+    }
+
+    ret = io_uring_submit(&r_ring[ring_idx]);
+    if(ret != pending) {
+	ts_trace(TS_ERROR, "[GET_VAL_BATCH] io_uring_submit failed! vs_id %d ring_idx %d %d %d\n", vs_id, ring_idx, ret, pending);
+	exit(EXIT_FAILURE);
+    }
+
+    return pending;
+}
+
+/* Reaps the reads of submit_val_batch(); the slots of r_buffer stay valid
+ * until the next submission on ring_idx. */
+void ValueStorage::wait_val_batch(int pending, int ring_idx) {
+    struct io_uring_cqe *r_cqe;
+    int ret;
+
+    for(int i = 0; i < pending; i++) {
+	ret = io_uring_wait_cqe(&r_ring[ring_idx], &r_cqe);
+	if(ret < 0) {
+	    ts_trace(TS_ERROR, "[GET_VAL_BATCH] io_uring_wait_cqe failed! ret=%d %s\n", ret, strerror(-ret));
+	    exit(EXIT_FAILURE);
+	}
+	if(r_cqe->res < 0) {
+	    ts_trace(TS_ERROR, "[GET_VAL_BATCH] Error in async operation ret=%d, fd %d: %s\n",
+		    r_cqe->res, fd[0], strerror(-r_cqe->res));
+	    exit(EXIT_FAILURE);
+	}
+	io_uring_cqe_seen(&r_ring[ring_idx], r_cqe);
+    }
+}
+
+/* Synchronous read of a single record, bypassing the rings; false if
+ * at_entry does not point at a record of this VS any more */
+bool ValueStorage::get_val(at_entry_t *at_entry, Value_t *val, Key_t *key) {
+    char *buf;
+    vs_entry_t *vs_entry;
+    int64_t vs_offset = at_entry->vs_idx.vs_offset;
+    bool found;
+
+    if(vs_offset < 0)
+	return false;
+
+    off64_t io_offset;
+    size_t io_size, entry_pos;
+    vs_read_t rd;
+    locate_entry(vs_offset, &io_offset, &io_size, &entry_pos, &rd);
+
+    if(posix_memalign((void **)&buf, SECTOR_SIZE, READ_IO_SIZE) != 0) {
+	ts_trace(TS_ERROR, "Failed to allocate memory ValueStorage::get_val\n");
+	exit(EXIT_FAILURE);
+    }
+
+    if(pread(fd[0], (void *)buf, io_size, io_offset) < 0) {
+	ts_trace(TS_ERROR, "[GET_VAL] pread failed! vs_id %d offset %lu %s\n", vs_id, io_offset, strerror(errno));
+	exit(EXIT_FAILURE);
+    }
+    inflate_frames(buf, &rd);
+
+    vs_entry = (vs_entry_t *)(buf + entry_pos);
+    found = valid_record(vs_entry, &rd, at_entry);
+    if(found) {
+	val->assign(vs_entry->val, vs_entry->len);
+	if(key)
+	    *key = vs_entry->key;
+    }
+    free(buf);
+
+    return found;
+}
+
+bool sort_by_vs_offset(const std::pair<int64_t, at_entry_t *> i, const std::pair<int64_t, at_entry_t *> j) {
+    return (i.first < j.first);
+}
+
+/* Reads the records of a scan with as few I/Os as possible. Records are
+ * sorted by their position in ValueStorage and neighbours of the same chunk
+ * (chunks are sorted by key in sort_w_buffer()) are merged into one read.
+ * Every slot of r_entry points into the merged read holding its record.
+ * The reads are left to the I/O completers. */
+int ValueStorage::get_val_scan(std::vector<at_entry_t *> *at_entry_vec, int ring_idx) {
+    int nr_slots;
+    int pending = submit_val_scan(at_entry_vec, ring_idx, &nr_slots);
+
+    at_entry_vec->clear();
+    if(pending) {
+	pending_ios[ring_idx] = pending;
+	ioc_wake(vs_id, ring_idx);
+    }
+    return pending;
+}
+
+/* Submits the coalesced reads of get_val_scan() without handing them over
+ * to the I/O completers; the caller reaps them with wait_val_batch() and
+ * finds its entries in the first *nr_slots slots of r_req/r_entry. */
+int ValueStorage::submit_val_scan(std::vector<at_entry_t *> *at_entry_vec, int ring_idx, int *nr_slots) {
+    int ret;
+    int entry_idx = 0;
+    int io_idx = 0;
+    size_t buf_offset = 0;
+    char *region = (char *)r_region[ring_idx].iov_base;
+
+    std::vector<std::pair<int64_t, at_entry_t *>> s_at_entry_vec;
+    s_at_entry_vec.reserve(at_entry_vec->size());
+
+    for(std::vector<at_entry_t *>::iterator itr = at_entry_vec->begin(); itr != at_entry_vec->end(); itr++) {
+	at_entry_t *at_entry = *itr;
+	int64_t vs_offset = at_entry->vs_idx.vs_offset;
+
+	/* the value has just moved into the oplog */
+	if(vs_offset < 0) {
+	    ts_trace(TS_INFO, "[GET_VAL_SCAN] entry in the oplog | at_entry: %p\n", at_entry);
+	    continue;
+	}
+	s_at_entry_vec.push_back(std::make_pair(vs_offset, at_entry));
+    }
+
+    sort(s_at_entry_vec.begin(), s_at_entry_vec.end(), sort_by_vs_offset);
+
+    size_t i = 0;
+    while(i < s_at_entry_vec.size() && entry_idx < R_QD) {
+	/* Step 1. locating the record */
+	int r_chunk_offset = s_at_entry_vec[i].first / MTS_VS_ENTRIES_PER_CHUNK;
+	off64_t io_offset;
+	size_t io_size, entry_pos;
+	locate_entry(s_at_entry_vec[i].first, &io_offset, &io_size, &entry_pos, &r_info[ring_idx][entry_idx]);
+
+	/* a record of a compressed chunk is read with its frames, alone */
+	if(unlikely(r_info[ring_idx][entry_idx].nr_frames)) {
+	    struct io_uring_sqe *r_sqe = io_uring_get_sqe(&r_ring[ring_idx]);
+	    if(!r_sqe) {
+		ts_trace(TS_ERROR, "[GET_VAL_SCAN] get set failed, will submit sqe\n");
+		break;
+	    }
+	    io_uring_prep_read_fixed(r_sqe, fd[0], region + buf_offset, io_size, io_offset, 0);
+	    io_uring_sqe_set_data(r_sqe, r_io_data(entry_idx, 1));
+	    r_req[ring_idx][entry_idx] = {s_at_entry_vec[i].second, nullptr, 0};
+	    r_entry[ring_idx][entry_idx] = (vs_entry_t *)(region + buf_offset + entry_pos);
+	    buf_offset += READ_IO_SIZE;
+	    entry_idx++;
+	    io_idx++;
+	    i++;
+	    continue;
+	}
+
+	/* Step 2. merging the following records of the same chunk; a merged
+	 * read never takes more buffer than READ_IO_SIZE per record */
+	int first_slot = entry_idx;
+	off64_t io_end = io_offset + io_size;
+
+	r_req[ring_idx][entry_idx] = {s_at_entry_vec[i].second, nullptr, 0};
+	r_entry[ring_idx][entry_idx] = (vs_entry_t *)(region + buf_offset + entry_pos);
+	entry_idx++;
+	i++;
+
+	while(i < s_at_entry_vec.size() && entry_idx < R_QD) {
+	    int next_chunk_offset = s_at_entry_vec[i].first / MTS_VS_ENTRIES_PER_CHUNK;
+	    if(next_chunk_offset != r_chunk_offset)
+		break;
+
+	    off64_t next_offset;
+	    size_t next_size, next_pos;
+	    locate_entry(s_at_entry_vec[i].first, &next_offset, &next_size, &next_pos, &r_info[ring_idx][entry_idx]);
+	    off64_t next_end = std::max(io_end, (off64_t)(next_offset + next_size));
+	    size_t next_io_size = next_end - io_offset;
+
+	    if(r_info[ring_idx][entry_idx].nr_frames || next_offset < io_offset ||
+		    next_offset - io_end > (off64_t)MTS_VS_SCAN_MERGE_GAP || next_io_size > MTS_VS_SCAN_MAX_IO_SIZE ||
+		    next_io_size > (entry_idx - first_slot + 1) * READ_IO_SIZE)
+		break;
+
+	    /* the same record may be asked twice */
+	    r_req[ring_idx][entry_idx] = {s_at_entry_vec[i].second, nullptr, 0};
+	    r_entry[ring_idx][entry_idx] = (vs_entry_t *)(region + buf_offset + (next_offset - io_offset) + next_pos);
+	    io_end = next_end;
+	    entry_idx++;
+	    i++;
+	}
+
+	struct io_uring_sqe *r_sqe = io_uring_get_sqe(&r_ring[ring_idx]);
+	if(!r_sqe) {
+	    ts_trace(TS_ERROR, "[GET_VAL_SCAN] get set failed, will submit sqe\n");
+	    entry_idx = first_slot;
+	    break;
+	}
+
+	io_size = io_end - io_offset;
+	io_uring_prep_read_fixed(r_sqe, fd[0], region + buf_offset, io_size, io_offset, 0);
+	io_uring_sqe_set_data(r_sqe, r_io_data(first_slot, entry_idx - first_slot));
+	ts_trace(TS_INFO, "[GET_VAL_SCAN] vs_id %d chunk %d entries %d io_size %lu\n",
+		vs_id, r_chunk_offset, entry_idx - first_slot, io_size);
+
+	/* keep every read READ_IO_SIZE-aligned in r_region */
+	buf_offset += (io_size + READ_IO_SIZE - 1) / READ_IO_SIZE * READ_IO_SIZE;
+	io_idx++;
+    }
+
+    int pending = io_idx;
+    *nr_slots = entry_idx;
 
     if(unlikely(pending == 0)) {
 	return pending;
@@ -571,7 +1313,6 @@ int ValueStorage::get_val_scan(std::vector<at_entry_t *> *at_entry_vec, int ring
 	exit(EXIT_FAILURE);
     }
 
-    pending_ios[ring_idx] = pending;
     return pending;
 }
 
@@ -580,14 +1321,13 @@ int ValueStorage::get_val_scan(std::vector<at_entry_t *> *at_entry_vec, int ring
 ////* Garbage collection of valuestorage *////
 //////////////////////////////////////////////
 
-/* Garbage collection process of ValueStorage
- * 0. init_w_chunk for writing new chunk
+/* Garbage collection process of ValueStorage (gc_thread)
  * 1. not_enough_free_chunk() or not
  * 2. if (not_enough), run GC
- * 3. read entries from get_victim()
- * 4. get_free_chunk_offset()
- * 5. put_vs_entry()
- * -. goto 1.
+ * 3. read the next victim from get_victim_chunk_offset() (gc_throttle())
+ * 4. copy valid entries of the current victim into gc_w_chunk
+ * 5. write gc_w_chunk and gc_sync_with_at() when full
+ * -. goto 3. until MTS_VS_LOW_MARK
  */
 bool ValueStorage::not_enough_free_chunk() {
     if (get_used_chunk_num() > MTS_VS_HIGH_MARK) { 
@@ -602,113 +1342,153 @@ bool ValueStorage::not_enough_free_chunk() {
     }
 }
 
+void ValueStorage::gc_thread_exec() {
+    auto last_ckpt = std::chrono::steady_clock::now();
+
+    while(!g_endVS) {
+	if(std::chrono::steady_clock::now() - last_ckpt > std::chrono::microseconds(MTS_VS_CKPT_INTERVAL_US)) {
+	    checkpoint_space_map();
+	    last_ckpt = std::chrono::steady_clock::now();
+	}
+
+	if(!not_enough_free_chunk() || !worth_gc()) {
+	    usleep(MTS_VS_GC_IDLE_US);
+	    continue;
+	}
+
+	gc_running = true;
+	garbage_collection();
+	gc_running = false;
+    }
+}
+
+/* Rate limiter of GC: every chunk written by the foreground earns
+ * MTS_VS_GC_CREDIT victim reads. GC runs unthrottled when the device is
+ * almost full or when the foreground has been idle for MTS_VS_GC_IDLE_US.
+ * Idleness costs one MTS_VS_GC_IDLE_US sleep to detect; later victims skip
+ * it until the foreground writes a chunk again. Victims read while idle
+ * are free, so the foreground does not pay them back afterwards. */
+void ValueStorage::gc_throttle() {
+    while(gc_credit <= 0) {
+	if(g_endVS || get_used_chunk_num() > MTS_VS_GC_URGENT_MARK)
+	    break;
+	if(w_chunk_cnt == gc_idle_w_chunk_cnt)
+	    break;
+
+	uint64_t last_w_chunk_cnt = w_chunk_cnt;
+	usleep(MTS_VS_GC_IDLE_US);
+	if(w_chunk_cnt == last_w_chunk_cnt) {
+	    gc_idle_w_chunk_cnt = last_w_chunk_cnt;
+	    break;
+	}
+    }
+    /* only the GC thread takes credit, so it never goes negative */
+    if(gc_credit > 0)
+	gc_credit--;
+}
+
 bool ValueStorage::garbage_collection() {
     /* vs_info for gc 
-     * 1. [entry unit] used_chunk_list:	has the number of valid entries per each chunk
-     * 2. [chunk unit] free_chunk_list:	indicates free_chunk_offset for getting a new chunk
+     * 1. [byte unit] victim_bucket:	used chunks by their valid bytes, oldest first
+     * 2. [chunk unit] free_chunk_head:	stack of free chunks for getting a new chunk
      * 3. [entry unit] vs_bitmap_info:	shows the position of valid entries of each chunk
      */
 
-    bool whole_file_written = true;
-    unsigned int victim_candidate_order = 0; /* means victim order of sorted used_chunk_list */
-    int r_offset, w_offset; /* each offset indicates the position will read or write */
     int gc_w_chunk_offset, gc_r_chunk_offset; /* each offset indicates the pos. of chunk (r/w) */
-    int used_chunk_num = get_used_chunk_num(); /* for the condition of terminating gc */
-    int used_chunk_num_before_gc = used_chunk_num;
-
-    /* whether garbage collection begeins or not */
-    if(create_used_chunk_list() < 2) {
-	ts_trace(TS_INFO, "%d GC_END | CASE 1 GC MUST REQUIRE AT LEAST TWO VICTIM CHUNKS\n", mts_get_now());
-	return EXIT_SUCCESS;
-    }
-
-    unsigned int victim_chunk_candidate1 = used_chunk_list->at(victim_candidate_order).second;
-    unsigned int victim_chunk_candidate2 = used_chunk_list->at(victim_candidate_order+1).second;
-    if ((victim_chunk_candidate1 + victim_chunk_candidate2) > MTS_VS_ENTRIES_PER_CHUNK) {
-	ts_trace(TS_INFO, "%d GC_END | CASE 2 THE SUM OF THE SMALLEST VICTIMS IS GREATER THAN MTS_VS_ENTRIES_PER_CHUNK\n", mts_get_now());
+    int next_gc_r_chunk_offset;
+    int cur = 0; /* gc_r_buffer holding gc_r_chunk_offset */
+    int pending;
+    std::vector<int> victims;
+
+    gc_throttle();
+    gc_r_chunk_offset = get_victim_chunk_offset();
+    if(gc_r_chunk_offset < 0) {
+	ts_trace(TS_INFO, "%d GC_END | CASE 1 NO VICTIM CHUNK\n", mts_get_now());
 	return EXIT_SUCCESS;
     }
 
     ts_trace(TS_GC_DEBUG, "%d GC_BEGIN | VS_ID: %d | TOTAL: %lu | USED: %u | FREE: %lu\n", 
 	    mts_get_now(), get_vs_id(), MTS_VS_CHUNK_NUM, get_used_chunk_num(), MTS_VS_CHUNK_NUM - get_used_chunk_num());
 
-    w_offset = 0;
-    r_offset = 0;
+    pending = submit_gc_r_chunk(gc_r_chunk_offset, gc_r_buffer[cur]);
 
     init_gc_w_chunk();
     gc_w_chunk_offset = gc_w_chunk->chunk_offset;
 
-    do {
-	/* getting victim chunk offset */
-	gc_r_chunk_offset = get_victim_chunk_offset(&victim_candidate_order);
-	victim_candidate_order++;
-
-	/* case: no proper victim chunks */
-	if(gc_r_chunk_offset < 0) {
-	    if(gc_moved_entry_list->empty()) {
-		ts_trace(TS_INFO, "[whole_file_written] add_free_chunk: %d\n", gc_w_chunk_offset);
-		add_free_chunk_list(gc_w_chunk_offset);
-		ts_trace(TS_GC_DEBUG, "%d GC_END | VS_ID: %d | TOTAL: %lu | UED: %u | FREE: %lu | CASE 3 VICTIM's ENTRY NUM == MTS_VS_ENTRIES_PER_CHUNK\n", mts_get_now(), get_vs_id(), MTS_VS_CHUNK_NUM, get_used_chunk_num(), MTS_VS_CHUNK_NUM - get_used_chunk_num());
-	    } else {
-		write_gc_w_chunk(gc_w_chunk_offset);
-		gc_sync_with_at(gc_w_chunk->moved_entry_list, gc_w_chunk->s_moved_entry_list);
-		ts_trace(TS_GC_DEBUG, "%d GC_END | VS_ID: %d | TOTAL: %lu | UED: %u | FREE: %lu | CASE 5 NO MORE VICTIMS \n", mts_get_now(), get_vs_id(), MTS_VS_CHUNK_NUM, get_used_chunk_num(), MTS_VS_CHUNK_NUM - get_used_chunk_num());
-	    }
-
-	    return EXIT_SUCCESS;
+    while(gc_r_chunk_offset > -1) {
+	wait_gc_r_chunk(pending);
+	expand_chunk(gc_r_buffer[cur]);
+	victims.push_back(gc_r_chunk_offset);
+	/* a victim without a trailer keeps its records and is put back */
+	vs_chunk_trailer_t *trailer = (vs_chunk_trailer_t *)(gc_r_buffer[cur] + MTS_VS_TRAILER_POS);
+	int nr_slots = trailer->nr_slots;
+	if(!valid_chunk_trailer(trailer)) {
+	    ts_trace(TS_ERROR, "[GC] no valid trailer! vs_id %d chunk %d\n", vs_id, gc_r_chunk_offset);
+	    nr_slots = 0;
 	}
 
+	/* reading the next victim while this one is compacted and written */
+	next_gc_r_chunk_offset = -1;
+	if(!g_endVS && get_used_chunk_num() > MTS_VS_LOW_MARK && worth_gc()) {
+	    gc_throttle();
+	    next_gc_r_chunk_offset = get_victim_chunk_offset();
+	    if(next_gc_r_chunk_offset > -1)
+		pending = submit_gc_r_chunk(next_gc_r_chunk_offset, gc_r_buffer[cur ^ 1]);
+	}
 
-	/* reading(file I/O) victim chunk */
-	read_gc_r_chunk(gc_r_chunk_offset);
-
-	/* getting valid entry of victim chunk */
-	for(unsigned int i = 0; i < MTS_VS_ENTRIES_PER_CHUNK; i++) {
-	    if(vs_bitmap_info->at(gc_r_chunk_offset).test(i)) {
-		r_offset = i;
+	/* getting valid records of victim chunk, as linked when it is
+	 * compacted; a record unlinked meanwhile is left by gc_link_to_at() */
+	chunk_lock_of(gc_r_chunk_offset).lock();
+	vs_bitmap live = vs_bitmap_info->at(gc_r_chunk_offset);
+	chunk_lock_of(gc_r_chunk_offset).unlock();
+	for(int i = 0; i < nr_slots; i++) {
+	    if(live.test(i)) {
 		ts_trace(TS_INFO, "[GC_DEBUG]: VALID_ENTRY | gc_r_chunk_offset: %d, r_offset: %d\n", gc_r_chunk_offset, i);
 	    } else {
 		ts_trace(TS_INFO, "[GC_DEBUG]: INVALID_ENTRY | gc_r_chunk_offset: %d, r_offset: %d\n", gc_r_chunk_offset, i);
 		continue;
 	    }
 
-	    /* copy entry from victim chunk to newly allocaed chunk */
-	    memcpy((void *)&gc_w_buffer[w_offset], (void *)&gc_r_buffer[r_offset], sizeof(vs_entry_t));
-
-	    /* will sync */
-	    add_moved_entry_list(gc_moved_entry_list, gc_w_chunk_offset, w_offset, (vs_entry *)&gc_w_buffer[w_offset], OpForm::INSERT);
-	    add_moved_entry_list(gc_moved_entry_list, gc_r_chunk_offset, r_offset, (vs_entry *)&gc_r_buffer[r_offset], OpForm::REMOVE);
-
+	    vs_entry_t *vs_entry = chunk_record(gc_r_buffer[cur], i);
+	    if(vs_entry == nullptr)
+		continue;
 
-	    /* write newly gathered entries and init gc_w_buffer */
-	    /* because w_offset starts from '0' */
-	    if(w_offset == (MTS_VS_ENTRIES_PER_CHUNK - 1)) { 
+	    /* copy record from victim chunk to newly allocaed chunk; a full
+	     * chunk is written and synced first */
+	    if(!add_record(gc_w_chunk, vs_entry->at_entry, vs_entry->key, vs_entry->val, vs_entry->len)) {
 		write_gc_w_chunk(gc_w_chunk_offset);
 		ts_trace(TS_INFO, "[GC: END OF WRITING A NEW CHUNK]\n");
 
 		/* link/unlink from valuestorage to addresstable */
-		gc_sync_with_at(gc_w_chunk->moved_entry_list, gc_w_chunk->s_moved_entry_list);
-		used_chunk_num++;
-
-		/* condition of terminating garbage collection */
-		if ((used_chunk_num == used_chunk_num_before_gc) || (used_chunk_num < MTS_VS_LOW_MARK)) {
-		    ts_trace(TS_GC_DEBUG, "%d GC_END | VS_ID: %d | TOTAL: %lu | UED: %u | FREE: %lu | CASE 4 REACH MTS_VS_LOW_MARK NO EFFECT OF GC\n", mts_get_now(), get_vs_id(), MTS_VS_CHUNK_NUM, get_used_chunk_num(), MTS_VS_CHUNK_NUM - get_used_chunk_num());
-		    return EXIT_SUCCESS;
-		}
+		gc_sync_with_at(gc_w_chunk->moved_entry_list);
 
 		/* prepare next chunk to be written */
 		init_gc_w_chunk();
 		gc_w_chunk_offset = gc_w_chunk->chunk_offset;
-		w_offset = 0;
-	    } else {
-		/* move to next w_offset */
-		w_offset++;
+		add_record(gc_w_chunk, vs_entry->at_entry, vs_entry->key, vs_entry->val, vs_entry->len);
 	    }
+
+	    /* will sync */
+	    add_moved_entry_list(gc_moved_entry_list, gc_r_chunk_offset, i, vs_entry, OpForm::REMOVE);
 	}
-	/* one chunk is considered free */
-	used_chunk_num--;
 	ts_trace(TS_INFO, "[GC: END OF READING SINGLE CHUNK]\n");
-    } while(true);
+
+	gc_r_chunk_offset = next_gc_r_chunk_offset;
+	cur ^= 1;
+    }
+
+    if(gc_moved_entry_list->empty()) {
+	add_free_chunk_list(gc_w_chunk_offset);
+    } else {
+	write_gc_w_chunk(gc_w_chunk_offset);
+	gc_sync_with_at(gc_w_chunk->moved_entry_list);
+    }
+    put_back_victims(&victims);
+
+    ts_trace(TS_GC_DEBUG, "%d GC_END | VS_ID: %d | TOTAL: %lu | USED: %u | FREE: %lu | VICTIMS: %lu\n",
+	    mts_get_now(), get_vs_id(), MTS_VS_CHUNK_NUM, get_used_chunk_num(), MTS_VS_CHUNK_NUM - get_used_chunk_num(), victims.size());
+
+    return EXIT_SUCCESS;
 }
 
 void ValueStorage::add_moved_entry_list(std::vector<moved_entry_t> *moved_entry_list, int chunk_offset, int entry_offset, vs_entry_t *vs_entry, OpForm::Operation op_type) {
@@ -723,98 +1503,260 @@ void ValueStorage::add_moved_entry_list(std::vector<moved_entry_t> *moved_entry_
 
     moved_entry_list->push_back(moved_entry);
 
-    ts_trace(TS_INFO, "[REC 3. ADD_MOVED_ENTRY_LIST] moved_entry_info.: %lu | VS_ID: %d, CHUNK_OFFSET: %d, ENTRY_OFFSET: %d, at_entry: %p, op_tpye: %d, Value: %lu\n",
-	    moved_entry_list->size(), vs_id, moved_entry.chunk_offset, moved_entry.entry_offset, moved_entry.at_entry, moved_entry.op_type, vs_entry->val);
+    ts_trace(TS_INFO, "[REC 3. ADD_MOVED_ENTRY_LIST] moved_entry_info.: %lu | VS_ID: %d, CHUNK_OFFSET: %d, ENTRY_OFFSET: %d, at_entry: %p, op_tpye: %d, len: %u\n",
+	    moved_entry_list->size(), vs_id, moved_entry.chunk_offset, moved_entry.entry_offset, moved_entry.at_entry, moved_entry.op_type, vs_entry->len);
 }
 
 void ValueStorage::init_vs_bitmap_info() {
     vs_bitmap_info = new std::vector<vs_bitmap>(MTS_VS_CHUNK_NUM);
+    valid_bytes = new uint32_t[MTS_VS_CHUNK_NUM]();
+}
+
+void ValueStorage::init_victim_bucket() {
+    victim_bucket = new std::vector<std::set<std::pair<uint64_t, int>>>(MTS_VS_GC_BUCKET_NUM);
+    filed_bucket = new int[MTS_VS_CHUNK_NUM]();
+    filed_stamp = new uint64_t[MTS_VS_CHUNK_NUM]();
+    is_stale_chunk = new std::atomic<bool>[MTS_VS_CHUNK_NUM];
+    stale_chunk_next = new int[MTS_VS_CHUNK_NUM];
+    for(unsigned long i = 0; i < MTS_VS_CHUNK_NUM; i++)
+	is_stale_chunk[i] = false;
+    stale_chunk_head = -1;
+    gc_victim_info = new std::vector<bool>(MTS_VS_CHUNK_NUM, false);
+    chunk_stamp = new uint64_t[MTS_VS_CHUNK_NUM]();
+    chunk_clock = 1;
+}
 
-    for(unsigned long int i = 0; i < MTS_VS_CHUNK_NUM; i++) {
-	vs_bitmap bitmap(0);
-	vs_bitmap_info->push_back(bitmap);
+void ValueStorage::init_free_chunk_list() {
+    free_chunk_next = new std::atomic<int>[MTS_VS_CHUNK_NUM];
+    is_free_chunk = new std::atomic<bool>[MTS_VS_CHUNK_NUM];
+
+    /* chunk 0 on top, -1 ends the stack */
+    for(int i = 0; i < MTS_VS_CHUNK_NUM; i++) {
+	free_chunk_next[i] = (i + 1 < MTS_VS_CHUNK_NUM) ? i + 1 : -1;
+	is_free_chunk[i] = true;
     }
+    free_chunk_head = 0;
+    free_chunk_num = MTS_VS_CHUNK_NUM;
+
+    for(int i = 0; i < MTS_VS_WRITER_NUM; i++)
+	reserved_chunk_num[i] = 0;
 }
 
-void ValueStorage::init_used_chunk_list() {
-    used_chunk_list = new std::vector<std::pair<int, int>>;
+/* Queues a chunk whose valid bytes changed for file_stale_chunks(); a
+ * chunk already queued is not queued twice */
+void ValueStorage::mark_stale_chunk(int chunk_offset) {
+    if(is_stale_chunk[chunk_offset].exchange(true))
+	return;
+
+    int head = stale_chunk_head.load(std::memory_order_acquire);
+    do {
+	stale_chunk_next[chunk_offset] = head;
+    } while(!stale_chunk_head.compare_exchange_weak(head, chunk_offset,
+		std::memory_order_release, std::memory_order_acquire));
 }
 
-void ValueStorage::init_free_chunk_list() {
-    free_chunk_list = new std::vector<int>;
-    for(int i = 0; i < MTS_VS_CHUNK_NUM; i++)
-	free_chunk_list->push_back(i);
+/* Takes the whole queue at once and files each chunk; a chunk changing
+ * again meanwhile is queued again (gc_thread only) */
+void ValueStorage::file_stale_chunks() {
+    int chunk_offset = stale_chunk_head.exchange(-1, std::memory_order_acquire);
+
+    while(chunk_offset > -1) {
+	int next = stale_chunk_next[chunk_offset];
+	is_stale_chunk[chunk_offset] = false;
+	file_chunk(chunk_offset);
+	chunk_offset = next;
+    }
 }
 
-int ValueStorage::get_victim_chunk_offset(unsigned int *order) {
-    /* step 1. find minimum value
-     * step 2. find the pos. of min. value
-     */
+/* Moves a chunk to the bucket of its valid bytes; chunks being collected
+ * and empty chunks stay out of the buckets (gc_thread only) */
+void ValueStorage::file_chunk(int chunk_offset) {
+    int to = 0;
+
+    if(!gc_victim_info->at(chunk_offset)) {
+	chunk_lock_of(chunk_offset).lock();
+	to = vs_bucket(valid_bytes[chunk_offset]);
+	chunk_lock_of(chunk_offset).unlock();
+    }
+
+    /* a chunk reused since it was filed has a new stamp */
+    uint64_t stamp = chunk_stamp[chunk_offset];
+    if(to == filed_bucket[chunk_offset] && stamp == filed_stamp[chunk_offset])
+	return;
+    if(filed_bucket[chunk_offset] > 0)
+	victim_bucket->at(filed_bucket[chunk_offset]).erase({filed_stamp[chunk_offset], chunk_offset});
+    if(to > 0)
+	victim_bucket->at(to).insert({stamp, chunk_offset});
+    filed_bucket[chunk_offset] = to;
+    filed_stamp[chunk_offset] = stamp;
+}
+
+/* GC frees a chunk only if the two emptiest chunks fit into one; a chunk
+ * of bucket b holds less than b * MTS_VS_GC_BUCKET_SIZE valid bytes */
+bool ValueStorage::worth_gc() {
+    int candidate[2];
+    int found = 0;
+
+    file_stale_chunks();
+    for(unsigned int b = 1; b < MTS_VS_GC_BUCKET_NUM && found < 2; b++) {
+	size_t chunk_num = victim_bucket->at(b).size();
+	while(chunk_num-- > 0 && found < 2)
+	    candidate[found++] = b;
+    }
+
+    if(found < 2)
+	return false;
+    return ((candidate[0] + candidate[1]) * MTS_VS_GC_BUCKET_SIZE <= MTS_VS_DATA_SIZE);
+}
 
-    int victim_chunk_offset, victim_chunk_entries;
+/*
+ * Takes the victim with the best cost-benefit out of victim_bucket: a
+ * chunk with u of its N bytes valid frees N - u bytes for reading N and
+ * writing u, and the older its data, the less likely the u bytes die soon
+ * by themselves. u is taken at the top of the bucket, so full chunks never
+ * win. Only the oldest chunk of a bucket can win.
+ */
+int ValueStorage::get_victim_chunk_offset() {
+    int victim_chunk_offset = -1;
+    unsigned int victim_bucket_idx = 0;
+    double best = 0;
+    uint64_t now = chunk_clock;
+
+    file_stale_chunks();
+    for(unsigned int b = 1; b < MTS_VS_GC_BUCKET_NUM; b++) {
+	std::set<std::pair<uint64_t, int>> &bucket = victim_bucket->at(b);
+	if(bucket.empty())
+	    continue;
 
-    if(!(*order < used_chunk_list->size())) {
-	ts_trace(TS_INFO, "[GET_VICITM_CHUNK_OFSET] *order over used_chunk_list->size()\n");
-	return -1;
+	uint64_t age = now - bucket.begin()->first;
+	double u = std::min(b * MTS_VS_GC_BUCKET_SIZE, MTS_VS_DATA_SIZE);
+	double score = (MTS_VS_DATA_SIZE - u) * age / (MTS_VS_DATA_SIZE + u);
+	if(score > best) {
+	    best = score;
+	    victim_chunk_offset = bucket.begin()->second;
+	    victim_bucket_idx = b;
+	}
     }
 
-    ts_trace(TS_INFO, "VICTIM_CHUNK_OFFSET | *order: %d\n", *order);
-    victim_chunk_offset = used_chunk_list->at(*order).first;
-    victim_chunk_entries = used_chunk_list->at(*order).second;
+    if(victim_chunk_offset > -1) {
+	victim_bucket->at(victim_bucket_idx).erase(victim_bucket->at(victim_bucket_idx).begin());
+	filed_bucket[victim_chunk_offset] = 0;
+	gc_victim_info->at(victim_chunk_offset) = true;
 
-    if((victim_chunk_entries == MTS_VS_ENTRIES_PER_CHUNK)) {
-	ts_trace(TS_INFO, "VICTIM_CHUNK_OFFSET: %d, NO MORE VICTIM CHUNK(EVERY CHUNKS HAVE FULL OF ENTIRIES)\n", victim_chunk_offset);
-	return -1;
+	ts_trace(TS_INFO, "[GET_VICTIM_CHUNK_OFFSET] victim_chunk_offset: %d valid bytes: %u age: %lu\n",
+		victim_chunk_offset, valid_bytes[victim_chunk_offset], now - chunk_stamp[victim_chunk_offset]);
     }
-    else {
-	ts_trace(TS_INFO, "[GET_VICTIM_CHUNK_OFFSET] victim_chunk_offset: %d num of valid_entries: %d\n",
-		victim_chunk_offset, victim_chunk_entries);
 
-	/* return INDEX which has minimum valid entries (>0)*/
-	return victim_chunk_offset;
+    return victim_chunk_offset;
+}
+
+/* Victims still holding records (e.g. linked again while being collected)
+ * become candidates again */
+void ValueStorage::put_back_victims(std::vector<int> *victims) {
+    for(auto victim_chunk_offset : *victims) {
+	gc_victim_info->at(victim_chunk_offset) = false;
+	file_chunk(victim_chunk_offset);
     }
 }
 
+/* Pushes a chunk onto the free stack; a chunk already on it is ignored */
 void ValueStorage::add_free_chunk_list(int free_chunk_offset) {
+    bool is_free = false;
+    uint64_t head, new_head;
+
     ts_trace(TS_INFO, "[ADD_FREE_CHUNK_LIST] CHUNK_OFFSET: %d\n", free_chunk_offset);
-    free_chunk_list->push_back(free_chunk_offset);
+    if(!is_free_chunk[free_chunk_offset].compare_exchange_strong(is_free, true))
+	return;
+
+    head = free_chunk_head.load(std::memory_order_acquire);
+    do {
+	free_chunk_next[free_chunk_offset] = (int)(uint32_t)head;
+	new_head = (((head >> 32) + 1) << 32) | (uint32_t)free_chunk_offset;
+    } while(!free_chunk_head.compare_exchange_weak(head, new_head, std::memory_order_acq_rel));
+
+    free_chunk_num++;
 }
 
-int ValueStorage::get_free_chunk_offset() {
+/* Pops the top of the free stack, -1 if it is empty */
+int ValueStorage::pop_free_chunk() {
+    uint64_t head, new_head;
     int free_chunk_offset;
 
-    free_chunk_offset = free_chunk_list->front();
+    head = free_chunk_head.load(std::memory_order_acquire);
+    do {
+	free_chunk_offset = (int)(uint32_t)head;
+	if(free_chunk_offset < 0)
+	    return -1;
+	new_head = (((head >> 32) + 1) << 32) | (uint32_t)free_chunk_next[free_chunk_offset].load();
+    } while(!free_chunk_head.compare_exchange_weak(head, new_head, std::memory_order_acq_rel));
+
+    free_chunk_num--;
+    is_free_chunk[free_chunk_offset] = false;
+
+    return free_chunk_offset;
+}
+
+/* Skips chunks filled again since they were freed (e.g. by recovery) */
+int ValueStorage::alloc_free_chunk() {
+    int free_chunk_offset = pop_free_chunk();
+
+    while(free_chunk_offset > -1 && !is_empty(free_chunk_offset))
+	free_chunk_offset = pop_free_chunk();
+
+    return free_chunk_offset;
+}
 
-    while(!is_empty(free_chunk_offset)) {
-	free_chunk_list->erase(free_chunk_list->begin());
-	free_chunk_offset = free_chunk_list->front();
+/* Writers allocate from their reservation, refilled MTS_VS_CHUNK_RESERVE
+ * chunks at a time; GC (oplog_id < 0) takes from the free stack directly. */
+int ValueStorage::get_free_chunk_offset(int oplog_id) {
+    int free_chunk_offset = -1;
+
+    if(oplog_id < 0) {
+	free_chunk_offset = alloc_free_chunk();
+    } else {
+	int *reserved = reserved_chunk[oplog_id];
+	int &reserved_num = reserved_chunk_num[oplog_id];
+
+	if(reserved_num == 0) {
+	    int chunk_offset;
+	    while(reserved_num < MTS_VS_CHUNK_RESERVE && (chunk_offset = alloc_free_chunk()) > -1)
+		reserved[reserved_num++] = chunk_offset;
+	    /* hand out the chunks in the order they were popped */
+	    std::reverse(reserved, reserved + reserved_num);
+	}
+
+	if(reserved_num > 0)
+	    free_chunk_offset = reserved[--reserved_num];
     }
 
-    if(!(free_chunk_offset < MTS_VS_CHUNK_NUM))
+    if(free_chunk_offset < 0)
     {
 	ts_trace(TS_ERROR, "[GET_FREE_CHUNK_OFFSET] NO MORE FREE CHUNK | VS_ID: %d FREE_CHUNK_OFFSET: %d\n", vs_id, free_chunk_offset);
 	exit(EXIT_FAILURE);
     }
 
-    free_chunk_list->erase(free_chunk_list->begin());
-
     assert(free_chunk_offset < MTS_VS_CHUNK_NUM);
     assert(-1 < free_chunk_offset);
 
     return free_chunk_offset;
 }
 
+unsigned int ValueStorage::get_free_chunk_num() {
+    return free_chunk_num.load(std::memory_order_relaxed);
+}
+
 unsigned int ValueStorage::get_used_chunk_num() {
-    return ((MTS_VS_CHUNK_NUM) - free_chunk_list->size());
+    return ((MTS_VS_CHUNK_NUM) - get_free_chunk_num());
 }
 
-bool ValueStorage::read_gc_r_chunk(int gc_r_chunk_offset) {
+/* Submits the read of a victim chunk into buffer; reaped by wait_gc_r_chunk() */
+int ValueStorage::submit_gc_r_chunk(int gc_r_chunk_offset, char *buffer) {
     int ret;
     off64_t offset = gc_r_chunk_offset * MTS_VS_CHUNK_SIZE;
-    memset(gc_r_buffer, 0x00, MTS_VS_CHUNK_SIZE);
+    memset(buffer, 0x00, MTS_VS_CHUNK_SIZE);
     
     int i = 0;
-    int array_num = 0;
+    size_t buf_offset = 0;
     int submitted_io = 0;
     do {
 	gc_r_sqe = io_uring_get_sqe(&gc_r_ring);
@@ -823,10 +1765,10 @@ bool ValueStorage::read_gc_r_chunk(int gc_r_chunk_offset) {
 	    break;
 	}
 
-	io_uring_prep_read(gc_r_sqe, fd[0], (void*)(vs_entry_t *)&gc_r_buffer[array_num], MTS_VS_CHUNK_SIZE/GC_QD, offset);
+	io_uring_prep_read(gc_r_sqe, fd[0], (void *)(buffer + buf_offset), MTS_VS_CHUNK_SIZE/GC_QD, offset);
 
 	offset += MTS_VS_CHUNK_SIZE/GC_QD;
-	array_num += MTS_VS_CHUNK_SIZE/GC_QD/MTS_VS_ENTRY_SIZE;
+	buf_offset += MTS_VS_CHUNK_SIZE/GC_QD;
 	submitted_io++;
     } while (true);
 
@@ -841,164 +1783,501 @@ bool ValueStorage::read_gc_r_chunk(int gc_r_chunk_offset) {
 	exit(EXIT_FAILURE);
     }
 
-    int pending = ret;
-    ret = io_uring_wait_cqe_nr(&gc_r_ring, &gc_r_cqe, pending);
+    ts_trace(TS_INFO, "[SUBMIT_GC_R_CHUNK] gc_r_chunk_offset: %d\n", gc_r_chunk_offset);
+
+    return ret;
+}
+
+void ValueStorage::wait_gc_r_chunk(int pending) {
+    int ret = io_uring_wait_cqe_nr(&gc_r_ring, &gc_r_cqe, pending);
 
     if(ret < 0) {
 	ts_trace(TS_ERROR, "io_uring_wait_cqe failed!\n");
 	exit(EXIT_FAILURE);
     } else ts_trace(TS_INFO, "io_uring_wait_cqe successed!\n");
 
-    for(i = 0; i < pending; i++) {
+    for(int i = 0; i < pending; i++) {
 	io_uring_cqe_seen(&gc_r_ring, gc_r_cqe);
     }
+}
 
-    ts_trace(TS_INFO, "[READ_GC_R_CHUNK] gc_r_chunk_offset: %d\n", gc_r_chunk_offset);
+bool ValueStorage::is_compressed(int chunk_offset) {
+    return frame_index && frame_index[chunk_offset] && frame_index[chunk_offset][0] != 0;
+}
 
-    return ret;
+/* Publishes the slot directory and the frame index of a chunk from its
+ * trailer, before any of its records is linked; the directory of its last
+ * use is freed. Called with its trailer_lock held. */
+void ValueStorage::set_slot_dir(int chunk_offset, vs_chunk_trailer_t *trailer) {
+    int cls = sc_class(sizeof(vs_slot_dir_t) + trailer->nr_slots * sizeof(uint16_t));
+    vs_slot_dir_t *dir = (vs_slot_dir_t *)sc_alloc(cls);
+
+    /* a reader finding the directory finds the frames too */
+    if(codec) {
+	uint16_t *&frame_end = frame_index[chunk_offset];
+	if(trailer->nr_frames) {
+	    if(frame_end == nullptr)
+		frame_end = new uint16_t[MTS_VS_FRAMES_PER_CHUNK];
+	    memcpy(frame_end, trailer->frame_end, sizeof(trailer->frame_end));
+	} else if(frame_end != nullptr) {
+	    frame_end[0] = 0;
+	}
+    }
+
+    dir->cls = cls;
+    dir->nr_slots = trailer->nr_slots;
+    memcpy(dir->end, trailer_slot_end(trailer), trailer->nr_slots * sizeof(uint16_t));
+
+    vs_slot_dir_t *old = slot_dir[chunk_offset].exchange(dir, std::memory_order_acq_rel);
+    if(old)
+	sc_free(old->cls, old);
 }
 
-void ValueStorage::sort_w_buffer(w_chunk_t *chunk) {
-    //vs_entry_t *w_buffer)
-    /* add sort function for enhancing scan() performance
-     * 1. alloc
-     * 2. converting
-     * 3. sorting
-     * 4. converting
-     * 5. copy
-     */
-    long unsigned int entry_num, s_entry_num;
+/*
+ * Bytes [start, end) of the data of a chunk holding the record of a slot,
+ * from its slot directory; false if there is no such record. A directory
+ * freed under us is still one of its class, so what is read is bounded by
+ * the class and by the chunk.
+ */
+bool ValueStorage::record_span(int chunk_offset, int slot, size_t *start, size_t *end) {
+    vs_slot_dir_t *dir = slot_dir[chunk_offset].load(std::memory_order_acquire);
 
-    vs_entry_t *unsorted_buffer = chunk->w_buffer;
-    vs_entry_t *sorted_buffer = chunk->s_buffer;
-    std::vector<std::pair<Key_t, vs_entry_t *>> *sorted_entry_list = chunk->s_entry_list;
-    sorted_entry_list->reserve(MTS_VS_ENTRIES_PER_CHUNK);
+    if(dir == nullptr)
+	return false;
 
-    for(entry_num = 0; entry_num < MTS_VS_ENTRIES_PER_CHUNK; entry_num++) {
-	vs_entry_t *w_entry = (vs_entry *)&unsorted_buffer[entry_num];
+    int cls = dir->cls;
+    if(unlikely(cls < 0 || cls >= MTS_SC_NUM))
+	return false;
+    int nr_slots = std::min<int>(dir->nr_slots, (sc_size(cls) - sizeof(vs_slot_dir_t)) / sizeof(uint16_t));
+    if(slot >= nr_slots)
+	return false;
 
-	if(w_entry == NULL)
-	    break;
+    *start = slot ? dir->end[slot - 1] * MTS_VS_RECORD_ALIGN : 0;
+    *end = dir->end[slot] * MTS_VS_RECORD_ALIGN;
+    return *start < *end && *end <= MTS_VS_DATA_SIZE && *end - *start <= MTS_VS_RECORD_SIZE(MTS_VAL_MAX_SIZE);
+}
 
-	if(w_entry->at_entry == NULL)
-	    break;
+/* Bytes a linked record takes in a chunk. A chunk linked by recover(Key_t)
+ * has its slot directory loaded on its first record. */
+size_t ValueStorage::record_size(int chunk_offset, int slot) {
+    size_t start, end;
+
+    if(record_span(chunk_offset, slot, &start, &end))
+	return end - start;
+    if(load_slot_dir(chunk_offset) && record_span(chunk_offset, slot, &start, &end))
+	return end - start;
+    return MTS_VS_RECORD_SIZE(0);
+}
+
+/* Loads the slot directory of a chunk not used since a restart on its
+ * first use; false if there is no new one to look at */
+bool ValueStorage::load_slot_dir(int chunk_offset) {
+    if(slot_dir[chunk_offset].load(std::memory_order_acquire) != nullptr)
+	return false;
+
+    std::lock_guard<std::mutex> guard(trailer_lock[chunk_offset % MTS_VS_CHUNK_LOCK_NUM]);
+    if(slot_dir[chunk_offset].load(std::memory_order_acquire) != nullptr)
+	return true;
+    return load_chunk_trailer(chunk_offset);
+}
+
+/* Restores the slot directory and the frame index of a used chunk from its
+ * trailer on restart; false if the trailer is not valid. The caller holds
+ * its trailer_lock, or nothing else runs on this VS. */
+bool ValueStorage::load_chunk_trailer(int chunk_offset) {
+    /* the tail of a chunk as long as the trailer of the most slots */
+    size_t tail_size = MTS_VS_TRAILER_SIZE(MTS_VS_ENTRIES_PER_CHUNK);
+    off64_t offset = (off64_t)(chunk_offset + 1) * MTS_VS_CHUNK_SIZE - tail_size;
+    char *tail;
+    bool valid;
+
+    if(posix_memalign((void **)&tail, SECTOR_SIZE, tail_size) != 0) {
+	ts_trace(TS_ERROR, "Failed to allocate memory ValueStorage::load_chunk_trailer\n");
+	exit(EXIT_FAILURE);
+    }
+    if(pread(fd[0], (void *)tail, tail_size, offset) < 0) {
+	ts_trace(TS_ERROR, "[VS_RECOVER] pread failed! vs_id %d chunk %d %s\n", vs_id, chunk_offset, strerror(errno));
+	exit(EXIT_FAILURE);
+    }
+
+    vs_chunk_trailer_t *trailer = (vs_chunk_trailer_t *)(tail + tail_size - sizeof(vs_chunk_trailer_t));
+    valid = valid_chunk_trailer(trailer);
+    if(valid)
+	set_slot_dir(chunk_offset, trailer);
+    free(tail);
+    return valid;
+}
 
-	Key_t key = w_entry->key;
-	auto s_entry = std::make_pair(key, w_entry);
-	sorted_entry_list->push_back(s_entry);
+/*
+ * Packs the frames of the sorted records in s_buffer into c_buffer and
+ * notes them in the trailer. Returns the sectors taken by the frames, 0 if
+ * they take no fewer than the records themselves.
+ */
+int ValueStorage::compress_chunk(w_chunk_t *chunk) {
+    char *src = chunk->s_buffer;
+    char *dst = chunk->c_buffer;
+    vs_chunk_trailer_t *trailer = (vs_chunk_trailer_t *)(chunk->s_buffer + MTS_VS_TRAILER_POS);
+    size_t limit = (chunk->used + SECTOR_SIZE - 1) & ~(SECTOR_SIZE - 1);
+    int nr_frames = (chunk->used + MTS_VS_FRAME_SIZE - 1) / MTS_VS_FRAME_SIZE;
+    size_t end = 0;
+
+    for(int i = 0; i < nr_frames; i++) {
+	/* a frame saving less than a sector is stored as is */
+	if(end >= limit)
+	    return 0;
+	size_t cap = std::min(limit - end, MTS_VS_FRAME_SIZE - SECTOR_SIZE);
+	size_t len = codec->compress(src + i * MTS_VS_FRAME_SIZE, MTS_VS_FRAME_SIZE, dst + end, cap);
+
+	if(len == 0) {
+	    if(end + MTS_VS_FRAME_SIZE >= limit)
+		return 0;
+	    memcpy(dst + end, src + i * MTS_VS_FRAME_SIZE, MTS_VS_FRAME_SIZE);
+	    len = MTS_VS_FRAME_SIZE;
+	}
+
+	size_t padded = (len + SECTOR_SIZE - 1) & ~(SECTOR_SIZE - 1);
+	memset(dst + end + len, 0, padded - len);
+	end += padded;
+	trailer->frame_end[i] = end / SECTOR_SIZE;
     }
+    if(end >= limit)
+	return 0;
 
-    sort(sorted_entry_list->begin(), sorted_entry_list->end(), sort_by_key_write);
+    trailer->nr_frames = nr_frames;
+    return end / SECTOR_SIZE;
+}
 
-    ts_trace(TS_INFO, "[SORT_W_BUFFER] MTS_VS_ENTRIES_PER_CHUNK: %lu\n", MTS_VS_ENTRIES_PER_CHUNK);
+/* Turns a whole chunk read as is into its records if it was compressed;
+ * its trailer stays at the end */
+void ValueStorage::expand_chunk(char *buffer) {
+    static thread_local std::vector<char> packed;
+    vs_chunk_trailer_t *trailer = (vs_chunk_trailer_t *)(buffer + MTS_VS_TRAILER_POS);
 
-    memset((void *)sorted_buffer, 0, MTS_VS_CHUNK_SIZE);
+    if(!codec || !valid_chunk_trailer(trailer) || trailer->nr_frames == 0)
+	return;
 
-    vs_entry_t *s_entry;
-    for(s_entry_num = 0; s_entry_num < entry_num; s_entry_num++) {
-	if(unlikely(sorted_entry_list->size() == 0))
-	    break;
-	s_entry = sorted_entry_list->at(s_entry_num).second;
-	memcpy((void *)&sorted_buffer[s_entry_num], (void *)s_entry, sizeof(vs_entry_t));
+    size_t packed_len = trailer->frame_end[trailer->nr_frames - 1] * SECTOR_SIZE;
+    size_t tail_pos = MTS_VS_DATA_LIMIT(trailer->nr_slots);
+    packed.resize(MTS_VS_CHUNK_SIZE);
+    /* the last frame may run into the trailer and its slot ends */
+    memcpy(packed.data(), buffer, packed_len);
+    memcpy(packed.data() + tail_pos, buffer + tail_pos, MTS_VS_CHUNK_SIZE - tail_pos);
+    trailer = (vs_chunk_trailer_t *)(packed.data() + MTS_VS_TRAILER_POS);
+
+    size_t start = 0;
+    for(int i = 0; i < trailer->nr_frames; i++) {
+	size_t end = trailer->frame_end[i] * SECTOR_SIZE;
+	char *frame = buffer + i * MTS_VS_FRAME_SIZE;
+
+	if(end - start == MTS_VS_FRAME_SIZE) {
+	    memcpy(frame, packed.data() + start, MTS_VS_FRAME_SIZE);
+	} else if(!codec->decompress(packed.data() + start, end - start, frame, MTS_VS_FRAME_SIZE)) {
+	    ts_trace(TS_ERROR, "[VS] corrupted frame %d of a chunk of vs_id %d\n", i, vs_id);
+	    exit(EXIT_FAILURE);
+	}
+	start = end;
     }
+    memcpy(buffer + tail_pos, packed.data() + tail_pos, MTS_VS_CHUNK_SIZE - tail_pos);
+}
 
-    sorted_entry_list->clear();
-    memcpy(chunk->w_buffer, sorted_buffer, MTS_VS_CHUNK_SIZE);
+/*
+ * Where the record at vs_offset is read from: io_size bytes at io_offset
+ * hold it at entry_pos, once the frames noted in rd are inflated. A slot
+ * the directory does not lead to (rewritten under us) is read as the first
+ * sector of the chunk and fails validation.
+ */
+void ValueStorage::locate_entry(int64_t vs_offset, off64_t *io_offset, size_t *io_size, size_t *entry_pos, vs_read_t *rd) {
+    int chunk_offset = vs_offset / MTS_VS_ENTRIES_PER_CHUNK;
+    int slot = vs_offset % MTS_VS_ENTRIES_PER_CHUNK;
+    off64_t chunk_start = (off64_t)chunk_offset * MTS_VS_CHUNK_SIZE;
+    size_t start, end;
+
+    rd->slot = slot;
+    rd->nr_frames = 0;
+    rd->avail = 0;
+    *io_offset = chunk_start;
+    *io_size = SECTOR_SIZE;
+    *entry_pos = 0;
+
+    if(unlikely(!record_span(chunk_offset, slot, &start, &end)) &&
+	    (!load_slot_dir(chunk_offset) || !record_span(chunk_offset, slot, &start, &end)))
+	return;
+
+    if(likely(!is_compressed(chunk_offset))) {
+	size_t first = start & ~(SECTOR_SIZE - 1);
+	*io_offset = chunk_start + first;
+	*io_size = ((end + SECTOR_SIZE - 1) & ~(SECTOR_SIZE - 1)) - first;
+	*entry_pos = start - first;
+	rd->avail = end - start;
+	return;
+    }
+
+    uint16_t *frame_end = frame_index[chunk_offset];
+    int first = start / MTS_VS_FRAME_SIZE;
+    int last = (end - 1) / MTS_VS_FRAME_SIZE;
+    int from = first ? frame_end[first - 1] : 0;
+
+    for(int f = first; f <= last; f++) {
+	int s = f ? frame_end[f - 1] : 0;
+	int e = frame_end[f];
+	if(unlikely(e <= s || (e - s) * SECTOR_SIZE > MTS_VS_FRAME_SIZE))
+	    return;
+	rd->frame_len[f - first] = (e - s) * SECTOR_SIZE;
+    }
+
+    *io_offset = chunk_start + from * SECTOR_SIZE;
+    *io_size = (frame_end[last] - from) * SECTOR_SIZE;
+    *entry_pos = start - first * MTS_VS_FRAME_SIZE;
+    rd->nr_frames = last - first + 1;
+    rd->avail = end - start;
 }
 
-void ValueStorage::write_chunk(w_chunk_t *chunk, bool write_type) {
-    int ret;
+/* Inflates the frames read into buf, a buffer of READ_IO_SIZE; frames that
+ * do not inflate leave a record failing validation */
+void ValueStorage::inflate_frames(char *buf, vs_read_t *rd) {
+    static thread_local std::vector<char> packed(READ_IO_SIZE);
+    size_t start = 0;
 
-    /* sorting for improving sanning */
+    if(likely(rd->nr_frames == 0))
+	return;
+
+    for(int i = 0; i < rd->nr_frames; i++)
+	start += rd->frame_len[i];
+    memcpy(packed.data(), buf, start);
+
+    start = 0;
+    for(int i = 0; i < rd->nr_frames; i++) {
+	char *frame = buf + i * MTS_VS_FRAME_SIZE;
+	size_t len = rd->frame_len[i];
+
+	if(len == MTS_VS_FRAME_SIZE) {
+	    memcpy(frame, packed.data() + start, MTS_VS_FRAME_SIZE);
+	} else if(!codec || !codec->decompress(packed.data() + start, len, frame, MTS_VS_FRAME_SIZE)) {
+	    rd->avail = 0;
+	    return;
+	}
+	start += len;
+    }
+}
+
+/* To be called on every completed slot: inflates the frames of the slot
+ * and returns its record, nullptr if it is not the record of r_req any
+ * more */
+vs_entry_t *ValueStorage::finish_read(int ring_idx, int slot) {
+    vs_read_t *rd = &r_info[ring_idx][slot];
+    vs_entry_t *vs_entry = r_entry[ring_idx][slot];
+
+    if(unlikely(rd->nr_frames)) {
+	/* frames are read into READ_IO_SIZE-aligned buffers of r_region */
+	char *region = (char *)r_region[ring_idx].iov_base;
+	size_t pos = (char *)vs_entry - region;
+	inflate_frames(region + pos / READ_IO_SIZE * READ_IO_SIZE, rd);
+    }
+    if(unlikely(!valid_record(vs_entry, rd, r_req[ring_idx][slot].at_entry)))
+	return nullptr;
+    return vs_entry;
+}
+
+/*
+ * Packs the records of a chunk into s_buffer in key order for scan(), and
+ * puts their slot directory into the trailer behind them. The moved
+ * entries of the chunk are pointed at the slot their record is written to.
+ */
+void ValueStorage::sort_w_buffer(w_chunk_t *chunk) {
+    int nr = chunk->entry_offset;
+    w_slot_t *w_order = chunk->w_order;
+    vs_chunk_trailer_t *trailer = (vs_chunk_trailer_t *)(chunk->s_buffer + MTS_VS_TRAILER_POS);
+    size_t data_limit = MTS_VS_DATA_LIMIT(nr);
+    static thread_local std::vector<int> pos;
+    size_t end = 0;
+
+    std::sort(w_order, w_order + nr, [](const w_slot_t &a, const w_slot_t &b) {
+	    return a.key < b.key;
+	    });
+
+    memset(chunk->s_buffer + data_limit, 0, MTS_VS_CHUNK_SIZE - data_limit);
+    trailer->nr_slots = nr;
+    uint16_t *slot_end = trailer_slot_end(trailer);
+    pos.resize(nr);
+    for(int i = 0; i < nr; i++) {
+	vs_entry_t *vs_entry = (vs_entry_t *)(chunk->s_buffer + end);
+	memcpy((void *)vs_entry, chunk->w_buffer + w_order[i].pos, w_order[i].size);
+	vs_entry->slot = i;
+	end += w_order[i].size;
+	slot_end[i] = end / MTS_VS_RECORD_ALIGN;
+	pos[w_order[i].slot] = i;
+    }
+    /* the rest of the last frame is written, or compressed, as zeroes */
+    memset(chunk->s_buffer + end, 0, std::min((end + MTS_VS_FRAME_SIZE - 1) & ~(MTS_VS_FRAME_SIZE - 1), data_limit) - end);
+    trailer->magic = MTS_VS_TRAILER_MAGIC;
+
+    for(auto &moved_entry : *chunk->moved_entry_list) {
+	if(moved_entry.op_type == OpForm::INSERT && moved_entry.chunk_offset == chunk->chunk_offset)
+	    moved_entry.entry_offset = pos[moved_entry.entry_offset];
+    }
+
+    ts_trace(TS_INFO, "[SORT_W_BUFFER] entries: %d bytes: %lu\n", nr, end);
+}
+
+static struct io_uring_sqe *get_w_sqe(struct io_uring *ring, w_chunk_t *chunk) {
+    struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+
+    if(!sqe) {
+	ts_trace(TS_ERROR, "[WRITE_CHUNK] io_uring_get_sqe failed! chunk %d\n", chunk->chunk_offset);
+	exit(EXIT_FAILURE);
+    }
+    io_uring_sqe_set_data(sqe, chunk);
+    return sqe;
+}
+
+/*
+ * Queues the writes of a sorted chunk and returns their number: the
+ * sectors taken by its records, or by their frames if they compress, split
+ * into up to nr_io - 1 writes, and one write of its trailer with the slot
+ * ends before it. The slot directory is published before the chunk is
+ * linked.
+ */
+int ValueStorage::prep_w_chunk(struct io_uring *ring, w_chunk_t *chunk, int nr_io) {
+    struct io_uring_sqe *sqe;
     off64_t offset = chunk->chunk_offset * MTS_VS_CHUNK_SIZE;
-    vs_entry_t *w_buffer = chunk->w_buffer;
+    vs_chunk_trailer_t *trailer = (vs_chunk_trailer_t *)(chunk->s_buffer + MTS_VS_TRAILER_POS);
+    size_t tail_size = MTS_VS_TRAILER_SIZE(chunk->entry_offset);
+    char *data = chunk->s_buffer;
+    size_t data_size = (chunk->used + SECTOR_SIZE - 1) & ~(SECTOR_SIZE - 1);
+    int nr = 0;
+
+    if(codec) {
+	int sectors = compress_chunk(chunk);
+	if(sectors > 0) {
+	    data = chunk->c_buffer;
+	    data_size = sectors * SECTOR_SIZE;
+	} else {
+	    trailer->nr_frames = 0;
+	    memset(trailer->frame_end, 0, sizeof(trailer->frame_end));
+	}
+    }
+    trailer->crc = trailer_crc(trailer);
+    {
+	/* a lazy load of the chunk's last use must not come after it */
+	std::lock_guard<std::mutex> guard(trailer_lock[chunk->chunk_offset % MTS_VS_CHUNK_LOCK_NUM]);
+	set_slot_dir(chunk->chunk_offset, trailer);
+    }
 
-    sort_w_buffer(chunk);
+    size_t per_io = (data_size / (nr_io - 1) + SECTOR_SIZE - 1) & ~(SECTOR_SIZE - 1);
+    for(size_t done = 0; done < data_size; done += per_io) {
+	sqe = get_w_sqe(ring, chunk);
+	io_uring_prep_write(sqe, fd[0], data + done, std::min(per_io, data_size - done), offset + done);
+	nr++;
+    }
+    sqe = get_w_sqe(ring, chunk);
+    io_uring_prep_write(sqe, fd[0], chunk->s_buffer + MTS_VS_CHUNK_SIZE - tail_size, tail_size,
+	    offset + MTS_VS_CHUNK_SIZE - tail_size);
+    nr++;
 
-    ts_trace(TS_INFO, "write_chunk offset %lu\n", offset);
+    chunk->io_bytes = data_size + tail_size;
+    return nr;
+}
 
-    int i = 0;
-    int array_num = 0;
-    int submitted_io = 0;
+/* Submits the writes of a chunk; complete_w_chunk() reaps them */
+void ValueStorage::write_chunk(w_chunk_t *chunk, bool write_type) {
+    int ret;
     int ring_idx = chunk->id;
-    struct io_uring_sqe *w_sqe;
-    struct io_uring_cqe *w_cqe;
 
-    do {
-	w_sqe = io_uring_get_sqe(&w_ring[ring_idx]);
-	if(!w_sqe) {
-	    ts_trace(TS_INFO, "[GET_VAL] write get set failed \n");
-	    break;
-	}
+    /* sorting for improving sanning */
+    sort_w_buffer(chunk);
 
-	io_uring_prep_write(w_sqe, fd[0], (void *)(vs_entry_t *)&w_buffer[array_num], MTS_VS_CHUNK_SIZE/W_QD, offset);
+    ts_trace(TS_INFO, "write_chunk offset %lu\n", chunk->chunk_offset * MTS_VS_CHUNK_SIZE);
 
-	offset += MTS_VS_CHUNK_SIZE / W_QD;
-	array_num += MTS_VS_CHUNK_SIZE / W_QD / MTS_VS_ENTRY_SIZE;
-	submitted_io++;
-	ts_trace(TS_INFO, "[GET_VAL] offset %lu array_num %d submitted_io %d\n", offset, array_num, submitted_io);
-    } while (true);
+    int nr_io = prep_w_chunk(&w_ring[ring_idx], chunk, W_QD);
+    chunk->pending = nr_io;
+    chunk->in_flight = true;
+    chunk->submit_ts = read_tscp();
+    w_inflight++;
 
     ret = io_uring_submit(&w_ring[ring_idx]);
-    if(ret < 0) {
-	ts_trace(TS_ERROR, "io_uring_submit failed! | io_uring_submit(&w_ring) ret %d submitted_io %d\n", ret, submitted_io);
+    if(ret != nr_io) {
+	ts_trace(TS_ERROR, "io_uring_submit failed! | io_uring_submit(&w_ring) ret %d\n", ret);
 	exit(EXIT_FAILURE);
-    } else ts_trace(TS_INFO, "io_uring_submit successed! | ret: %d i: %d\n", ret, i);
+    }
 
-    int pending = ret;
+    /* writes done by now time the device before their chunk comes around */
+    reap_w_ring(ring_idx, false);
+}
 
-    ret = io_uring_wait_cqe_nr(&w_ring[ring_idx], &w_cqe, pending);
-    if(ret < 0) {
-	ts_trace(TS_ERROR, "io_uring_wait_cqe failed!\n");
-	exit(EXIT_FAILURE);
-    } else ts_trace(TS_INFO, "io_uring_wait_cqe successed!\n");
+/* Counts off the completed writes of a ring, waiting for one if wait. A
+ * chunk whose writes are all done feeds the write latency of the device. */
+void ValueStorage::reap_w_ring(int ring_idx, bool wait) {
+    int ret;
+    struct io_uring_cqe *w_cqe;
 
+    if(wait)
+	ret = io_uring_wait_cqe(&w_ring[ring_idx], &w_cqe);
+    else ret = io_uring_peek_cqe(&w_ring[ring_idx], &w_cqe);
 
-    for(i = 0; i < pending; i++) {
+    while(ret == 0) {
+	if(w_cqe->res < 0) {
+	    ts_trace(TS_ERROR, "[WRITE_CHUNK] write failed ret=%d: %s\n", w_cqe->res, strerror(-w_cqe->res));
+	    exit(EXIT_FAILURE);
+	}
+
+	w_chunk_t *done = (w_chunk_t *)io_uring_cqe_get_data(w_cqe);
+	if(--done->pending == 0) {
+	    add_latency(&w_lat_ewma, read_tscp() - done->submit_ts);
+	    w_inflight--;
+	}
 	io_uring_cqe_seen(&w_ring[ring_idx], w_cqe);
-	ts_trace(TS_INFO, "[GET_VAL] ring_idx %d pending %d\n", ring_idx, i);
+	ret = io_uring_peek_cqe(&w_ring[ring_idx], &w_cqe);
     }
 
+    if(ret < 0 && ret != -EAGAIN) {
+	ts_trace(TS_ERROR, "io_uring_wait_cqe failed! %s\n", strerror(-ret));
+	exit(EXIT_FAILURE);
+    }
+}
+
+/* Waits for the writes of a chunk and links its entries in the
+ * AddressTable. Writes of later chunks completing meanwhile are counted
+ * off; chunks are completed in the order they were written. */
+void ValueStorage::complete_w_chunk(w_chunk_t *chunk) {
+    int ring_idx = chunk->id;
+
+    while(chunk->pending > 0)
+	reap_w_ring(ring_idx, true);
+
+    sync_with_at(chunk->moved_entry_list);
+    chunk->in_flight = false;
+    chunk->entry_offset = 0;
+    chunk->used = 0;
+
 #ifdef MTS_STATS_WAF
-    total_vs_write_count++;
+    total_vs_write_bytes += chunk->io_bytes;
 #endif
+    stat_count(STAT_CNT_VS_WRITE_BYTES, chunk->io_bytes);
+    /* lets gc_thread keep pace with the foreground */
+    w_chunk_cnt++;
+    if(gc_credit < MTS_VS_GC_MAX_CREDIT)
+	gc_credit += MTS_VS_GC_CREDIT;
     ts_trace(TS_INFO, "[WRITE_CHUNK] vs_id: %d\n", vs_id);
 }
 
 void ValueStorage::write_gc_w_chunk(int gc_w_chunk_offset) {
-    int ret;
+    int ret, i;
 
     /* sorting for improving scan performance */
     sort_w_buffer(gc_w_chunk);
-    off64_t offset = gc_w_chunk_offset * MTS_VS_CHUNK_SIZE;
-    
-    int i = 0;
-    int array_num = 0;
-    int submitted_io = 0;
-    do {
-	gc_w_sqe = io_uring_get_sqe(&gc_w_ring);
-	if(!gc_w_sqe) {
-	    ts_trace(TS_INFO, "[GC-WRITE] get set stopped, will submit \n");
-	    break;
-	}
-
-	io_uring_prep_write(gc_w_sqe, fd[0], (void *)(vs_entry_t *)&gc_w_buffer[array_num], MTS_VS_CHUNK_SIZE/GC_QD, offset);
-
-	offset += MTS_VS_CHUNK_SIZE/GC_QD;
-	array_num +=  MTS_VS_CHUNK_SIZE/GC_QD/MTS_VS_ENTRY_SIZE;
-	submitted_io++;
-    } while (true);
+    int nr_io = prep_w_chunk(&gc_w_ring, gc_w_chunk, GC_QD);
+    uint64_t start = read_tscp();
+    w_inflight++;
 
     ret = io_uring_submit(&gc_w_ring);
-
-    if(ret != submitted_io) {
-	ts_trace(TS_ERROR, "[GC-WRITE] io_uring_submit failed! | io_uring_submit(&gc_w_ring): %d i: %d\n", ret, i);
-	exit(EXIT_FAILURE);
-    } else ts_trace(TS_INFO, "[GC-WRITE] io_uring_submit successed! | ret: %d i: %d\n", ret, i);
     if (ret < 0) {
 	fprintf(stderr, "[GC-WRITE]io_uring_submit failed! | io_uring_submit: %s\n", strerror(-ret));
 	exit(EXIT_FAILURE);
     }
+    if(ret != nr_io) {
+	ts_trace(TS_ERROR, "[GC-WRITE] io_uring_submit failed! | io_uring_submit(&gc_w_ring): %d\n", ret);
+	exit(EXIT_FAILURE);
+    } else ts_trace(TS_INFO, "[GC-WRITE] io_uring_submit successed! | ret: %d\n", ret);
 
     int pending = ret;
     ret = io_uring_wait_cqe_nr(&gc_w_ring, &gc_w_cqe, pending);
@@ -1011,39 +2290,30 @@ void ValueStorage::write_gc_w_chunk(int gc_w_chunk_offset) {
     for(i = 0; i < pending; i++) {
 	io_uring_cqe_seen(&gc_w_ring, gc_w_cqe);
     }
-    memset(gc_w_buffer, 0x00, MTS_VS_CHUNK_SIZE);
+    add_latency(&w_lat_ewma, read_tscp() - start);
+    w_inflight--;
+    stat_count(STAT_CNT_VS_WRITE_BYTES, gc_w_chunk->io_bytes);
     ts_trace(TS_INFO, "[WRITE_GC_CHUNK] w_chunk_offset: %d\n", gc_w_chunk_offset);
 }
 
-int ValueStorage::create_used_chunk_list() {
-    int used_chunk_cnt = 0;
-    int entry_num = 0;
-
-    used_chunk_list->clear();
-
-    /* create used_chunk_list from vs_bitmap_info */
-    for (unsigned long int chunk_offset = 0; chunk_offset < MTS_VS_CHUNK_NUM; chunk_offset++) {
-	entry_num = vs_bitmap_info->at(chunk_offset).count();
-	if(entry_num > 0) {
-	    auto chunk_info = std::make_pair(chunk_offset, entry_num);
-	    used_chunk_list->push_back(chunk_info);
-
-	    ts_trace(TS_INFO, "[CREATE_USED_CHUNK_LIST] CHUNK_OFFSET: %d, VALID_ENTRY: %d\n", 
-		    used_chunk_list->at(used_chunk_cnt).first,
-		    used_chunk_list->at(used_chunk_cnt).second);
-
-	    used_chunk_cnt++;
-	}
-    }
-
-    /* sort by num of entry */
-    sort(used_chunk_list->begin(), used_chunk_list->end(), sort_by_entry);
+/* whether a slot of a chunk holds a linked record */
+bool ValueStorage::slot_valid(int chunk_offset, int slot) {
+    chunk_lock_of(chunk_offset).lock();
+    bool valid = vs_bitmap_info->at(chunk_offset).test(slot);
+    chunk_lock_of(chunk_offset).unlock();
+    return valid;
+}
 
-    return used_chunk_cnt;
+/* linked records of a chunk */
+size_t ValueStorage::valid_slots(int chunk_offset) {
+    chunk_lock_of(chunk_offset).lock();
+    size_t count = vs_bitmap_info->at(chunk_offset).count();
+    chunk_lock_of(chunk_offset).unlock();
+    return count;
 }
 
 int ValueStorage::is_empty(int chunk_offset) {
-     if(vs_bitmap_info->at(chunk_offset).count() == 0)
+     if(valid_slots(chunk_offset) == 0)
 	 return true;
      else return false;
 }
@@ -1053,3 +2323,84 @@ int ValueStorage::need_gc() {
 	return true;
     else return false;
 }
+
+void ValueStorage::add_latency(std::atomic<uint64_t> *ewma, uint64_t cycles) {
+    uint64_t old = ewma->load(std::memory_order_relaxed);
+
+    /* racing samples may be lost, which only slows the average down */
+    ewma->store(old - (old >> MTS_VS_LAT_EWMA_SHIFT) + (cycles >> MTS_VS_LAT_EWMA_SHIFT), std::memory_order_relaxed);
+}
+
+/*
+ * Expected cost of writing a chunk here, lower is better: the time to
+ * serve the I/Os queued ahead of it at the latencies seen lately, over
+ * the share of the device still free.
+ */
+double ValueStorage::placement_cost() {
+    unsigned int free_num = get_free_chunk_num();
+    int r_inflight = 0;
+
+    if(free_num <= MTS_VS_GC_RESERVED_CHUNKS)
+	return HUGE_VAL;
+    for(int i = 0; i < IO_URING_RRING_NUM; i++)
+	r_inflight += pending_ios[i].load(std::memory_order_relaxed);
+
+    double busy = (double)(w_inflight + 1) * w_lat_ewma + (double)r_inflight * r_lat_ewma;
+    return busy * MTS_VS_CHUNK_NUM / free_num;
+}
+
+/* prefix sums of the write weights of the ValueStorages */
+static double vs_weight_sum[MTS_VS_MAX_NUM];
+
+void init_vs_placement(const double *weight) {
+    double sum = 0;
+
+    for(int i = 0; i < g_vsNum; i++) {
+	if(weight[i] > 0)
+	    sum += weight[i];
+	vs_weight_sum[i] = sum;
+    }
+
+    /* no device to prefer: spread over all of them */
+    if(sum == 0) {
+	for(int i = 0; i < g_vsNum; i++)
+	    vs_weight_sum[i] = i + 1;
+    }
+}
+
+static int sample_vs(std::mt19937 &gen) {
+    std::uniform_real_distribution<double> dist(0, vs_weight_sum[g_vsNum - 1]);
+    double x = dist(gen);
+
+    for(int i = 0; i < g_vsNum; i++) {
+	if(x < vs_weight_sum[i])
+	    return i;
+    }
+    /* x hit the top of the range: the last device taking writes */
+    for(int i = g_vsNum - 1; i > 0; i--) {
+	if(vs_weight_sum[i] > vs_weight_sum[i - 1])
+	    return i;
+    }
+    return 0;
+}
+
+/*
+ * Picks the ValueStorage of a reclaimed or evicted chunk: the cheaper of
+ * two devices sampled by weight. A device allocating a chunk (is_writing)
+ * is passed over while there are others to try.
+ */
+ValueStorage *pick_vs_for_write() {
+    static thread_local std::mt19937 gen(std::random_device{}());
+    ValueStorage *vs = nullptr;
+
+    for(int tries = 0; tries < g_vsNum; tries++) {
+	ValueStorage *vs1 = g_perNumaValueStorage[sample_vs(gen)];
+	ValueStorage *vs2 = g_perNumaValueStorage[sample_vs(gen)];
+
+	vs = (vs1->placement_cost() <= vs2->placement_cost()) ? vs1 : vs2;
+	if(!vs->is_writing)
+	    break;
+    }
+
+    return vs;
+}
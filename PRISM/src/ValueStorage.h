@@ -3,7 +3,6 @@
 
 #include <sys/eventfd.h>
 #include <stdlib.h>
-#include <bitset>
 #include <vector>
 #include <list>
 #include <iostream>
@@ -19,19 +18,31 @@
 #include <sys/mman.h>
 #include <malloc.h>
 #include <shared_mutex>
+#include <mutex>
+#include <unordered_set>
+#include <set>
+#include <thread>
+#include <chrono>
 #include <cassert>
+#include <climits>
+#include <numa.h>
 #include "liburing.h"
 #include "MTSImpl.h"
+#include "SizeClass.h"
 #include "SpinLock.h"
+#include "Codec.h"
 
 typedef struct at_entry at_entry_t;
 typedef struct cq_entry cq_entry_t;
 
+/* a record of a chunk: the value follows, padded to MTS_VS_RECORD_ALIGN */
 typedef struct vs_entry {
     at_entry_t *at_entry;
     Key_t key;
-    Val_t val;
-    unsigned char __reserved[KV_SIZE - sizeof(Key_t) - sizeof(Val_t) - sizeof(at_entry_t *)]; 
+    uint32_t len;
+    uint16_t slot;	/* of the record in its chunk */
+    uint16_t __reserved;
+    char val[];
 } vs_entry_t;
 
 typedef struct moved_entry {
@@ -52,24 +63,149 @@ typedef struct file_info {
     struct iovec iovec[];
 } file_info_t;
 
+typedef struct w_slot {
+    Key_t key;
+    int slot;		/* order the record was added in */
+    uint32_t pos;	/* of the record in w_buffer */
+    uint32_t size;
+} w_slot_t;
+
 typedef struct w_chunk {
     int id;
+    int stream;		/* VS_STREAM_* of the entries */
     int chunk_offset;
     int entry_offset;
-    vs_entry_t *w_buffer;
-    vs_entry_t *s_buffer;
+    size_t used;	/* bytes of w_buffer taken by the records */
+    int pending;	/* writes of the chunk not completed yet */
+    bool in_flight;	/* written, not synced with the AddressTable yet */
+    char *w_buffer;	/* records in the order they were added */
+    char *s_buffer;	/* records sorted by key, then the trailer */
+    char *c_buffer;		/* compressed frames, nullptr without codec */
+    size_t io_bytes;		/* written for the chunk */
+    uint64_t submit_ts;		/* read_tscp() when it was written */
     std::vector<moved_entry_t> *moved_entry_list;
-    std::vector<std::pair<Key_t, at_entry_t *>> *s_moved_entry_list;
-    std::vector<std::pair<Key_t, vs_entry_t *>> *s_entry_list;
+    /* the records of w_buffer, sorted by key by sort_w_buffer() */
+    w_slot_t w_order[MTS_VS_ENTRIES_PER_CHUNK];
 } w_chunk_t;
 
 
-typedef std::bitset<MTS_VS_ENTRIES_PER_CHUNK> vs_bitmap;
+/* Slots of a chunk holding linked records, as many bits as the highest
+ * slot set needs; a chunk of large records takes few of them */
+class vs_bitmap {
+    private:
+	std::vector<bool> bits;
+	size_t nr_set = 0;
+
+    public:
+	bool test(size_t slot) const {
+	    return slot < bits.size() && bits[slot];
+	}
+	void set(size_t slot) {
+	    if(slot >= bits.size())
+		bits.resize(slot + 1);
+	    if(!bits[slot]) {
+		bits[slot] = true;
+		nr_set++;
+	    }
+	}
+	void reset(size_t slot) {
+	    if(test(slot)) {
+		bits[slot] = false;
+		nr_set--;
+	    }
+	}
+	void reset() {
+	    std::vector<bool>().swap(bits);
+	    nr_set = 0;
+	}
+	size_t count() const { return nr_set; }
+	bool none() const { return nr_set == 0; }
+	bool any() const { return nr_set != 0; }
+	size_t size() const { return bits.size(); }
+};
+
+/* what a restart takes of a chunk without reading its trailer */
+typedef struct vs_chunk_state {
+    uint64_t stamp;	/* chunk_stamp */
+    uint32_t valid_bytes;
+    uint32_t __reserved;
+} vs_chunk_state_t;
+
+/* Checkpoint of the chunk state on NVM, as of the start of generation
+ * 'generation'. A chunk changed in generation g is logged in dirty_log[g & 1]
+ * as g << 32 | chunk before its entries can be linked, so a restart reads
+ * the trailers of only the chunks logged with g >= generation. The bitmaps
+ * are rebuilt from the AddressTables. */
+typedef struct vs_space_map {
+    uint64_t magic;
+    uint64_t generation;
+    uint64_t __reserved[6];
+    uint64_t dirty_log[2][MTS_VS_CHUNK_NUM];
+    vs_chunk_state_t state[MTS_VS_CHUNK_NUM];
+} vs_space_map_t;
+
+/* an entry of dirty_log reserved by log_dirty_chunk() */
+typedef struct vs_dirty_log {
+    int slot;		/* -1 if the chunk was logged already */
+    uint64_t entry;
+} vs_dirty_log_t;
+
+/* Last bytes of a chunk, at MTS_VS_TRAILER_POS, right after the nr_slots
+ * entries of slot_end (see trailer_slot_end()). Record i of the chunk ends
+ * slot_end[i] * MTS_VS_RECORD_ALIGN bytes into its data. The data of a
+ * compressed chunk is packed in nr_frames frames from the start of the
+ * chunk; frame i ends frame_end[i] sectors in, and a frame taking
+ * MTS_VS_FRAME_SIZE is stored as is. */
+typedef struct vs_chunk_trailer {
+    uint64_t magic;
+    uint32_t crc;	/* of slot_end and the rest */
+    uint16_t nr_slots;
+    uint16_t nr_frames;	/* 0 if not compressed */
+    uint16_t frame_end[MTS_VS_FRAMES_PER_CHUNK];
+} vs_chunk_trailer_t;
+
+static inline uint16_t *trailer_slot_end(const vs_chunk_trailer_t *trailer) {
+    return (uint16_t *)trailer - trailer->nr_slots;
+}
+
+/* the largest record lies within the buffer of a read slot wherever it
+ * starts, read by sectors or inflated by frames */
+static_assert(((MTS_VS_RECORD_SIZE(MTS_VAL_MAX_SIZE) + SECTOR_SIZE - 2) / SECTOR_SIZE + 1) * SECTOR_SIZE <= READ_IO_SIZE &&
+	((MTS_VS_RECORD_SIZE(MTS_VAL_MAX_SIZE) + MTS_VS_FRAME_SIZE - 2) / MTS_VS_FRAME_SIZE + 1) * MTS_VS_FRAME_SIZE <= READ_IO_SIZE,
+	"READ_IO_SIZE too small for MTS_VAL_MAX_SIZE");
+/* the slots of a chunk and their ends fit the trailer, and a vs_offset of
+ * the last slot of the last chunk fits vs_idx_t */
+static_assert(MTS_VS_ENTRIES_PER_CHUNK <= UINT16_MAX && MTS_VS_CHUNK_SIZE / MTS_VS_RECORD_ALIGN <= UINT16_MAX,
+	"too many slots for the chunk trailer");
+static_assert(MTS_VS_CHUNK_NUM * MTS_VS_ENTRIES_PER_CHUNK - 1 < (1UL << (MTS_VS_OFFSET_BITS - 1)), "too many slots for a vs_offset");
+
+/* DRAM copy of the slot_end of a chunk, from a size class */
+typedef struct vs_slot_dir {
+    int cls;
+    int nr_slots;
+    uint16_t end[];
+} vs_slot_dir_t;
+/* the slot directory of a full chunk has a size class */
+static_assert(sizeof(vs_slot_dir_t) + MTS_VS_ENTRIES_PER_CHUNK * sizeof(uint16_t) <= sc_size(MTS_SC_NUM - 1),
+	"MTS_SC_NUM too small for a slot directory");
+
+/* how the record of a read slot is found once the read completes */
+typedef struct vs_read {
+    uint32_t avail;	/* bytes read from the record on */
+    uint16_t slot;	/* of the record in its chunk */
+    uint16_t nr_frames;	/* to inflate first, 0 if the chunk is not compressed */
+    uint16_t frame_len[MTS_VS_READ_FRAMES];
+} vs_read_t;
+
+/* user data of a read: the slots of r_req it serves */
+static inline void *r_io_data(int first_slot, int nr_slots) {
+    return (void *)(((uint64_t)nr_slots << 32) | (uint32_t)first_slot);
+}
 
 class ValueStorage {
     private:
-	SpinLock spinlock;
 	int vs_id;
+	int node; /* socket of the device, -1 if unknown */
 	bool gc_done;
 	std::atomic<bool> g_endVS;
 
@@ -77,60 +213,158 @@ class ValueStorage {
 	int r_chunk_offset;
 	int r_vs_entry_offset;
 
-	/* for write() */
-	w_chunk_t *w_chunk[MTS_THREAD_NUM];
-	vs_entry_t *w_buffer[MTS_THREAD_NUM];
-	vs_entry_t *s_buffer[MTS_THREAD_NUM];
-	std::vector<moved_entry_t> *moved_entry_list[MTS_THREAD_NUM];
-	std::vector<std::pair<Key_t, at_entry_t *>> *s_moved_entry_list[MTS_THREAD_NUM];
-	std::vector<std::pair<Key_t, vs_entry_t *>> *s_entry_list[MTS_THREAD_NUM];
+	/* for write(): each writer (PWB or cache thread slot) fills a w_chunk per stream
+	 * while the other chunks of the stream's w_pipe are written */
+	w_chunk_t *w_chunk[MTS_VS_WRITER_NUM][MTS_VS_STREAM_NUM];
+	w_chunk_t *w_pipe[MTS_VS_WRITER_NUM][MTS_VS_STREAM_NUM][MTS_VS_W_DEPTH];
+	int w_fill[MTS_VS_WRITER_NUM][MTS_VS_STREAM_NUM];	/* index of w_chunk in w_pipe */
+	/* set by open_w_slot() under w_slot_lock once the slot is usable */
+	std::atomic<bool> w_slot_ready[MTS_VS_WRITER_NUM];
+	SpinLock w_slot_lock;
 
 	/* for garbage_collection */
+	std::thread *gc_thread;
+	std::atomic<bool> gc_running;
+	std::atomic<int> gc_credit;
+	std::atomic<uint64_t> w_chunk_cnt;
+	uint64_t gc_idle_w_chunk_cnt;	/* w_chunk_cnt when GC last found the foreground idle */
 	w_chunk_t *gc_w_chunk;
-	vs_entry_t *gc_r_buffer;
-	vs_entry_t *gc_w_buffer;
-	vs_entry_t *gc_s_buffer;
+	char *gc_r_buffer[2];	/* the next victim is read while one is compacted */
 	std::vector<moved_entry_t> *gc_moved_entry_list;
-	std::vector<std::pair<Key_t, at_entry_t *>> *s_gc_moved_entry_list;
-	std::vector<std::pair<Key_t, vs_entry_t *>> *s_gc_entry_list;
 
-	/* how many free chunks are there */
-	std::vector<int> *free_chunk_list;
-	/* how many used chunks are there */
-	std::vector<std::pair<int, int>> *used_chunk_list;
+	/* slot directory of every chunk written or loaded, replaced when the
+	 * chunk is written again; readers bound what they find by its class.
+	 * A restart from the space map leaves them to load_slot_dir(). */
+	std::atomic<vs_slot_dir_t *> *slot_dir;
+	/* trailer_lock[c % MTS_VS_CHUNK_LOCK_NUM] orders the lazy load of
+	 * chunk c with its next write */
+	std::mutex trailer_lock[MTS_VS_CHUNK_LOCK_NUM];
+	void set_slot_dir(int chunk_offset, vs_chunk_trailer_t *trailer);
+	bool record_span(int chunk_offset, int slot, size_t *start, size_t *end);
+	size_t record_size(int chunk_offset, int slot);
+	bool load_chunk_trailer(int chunk_offset);
+	bool load_slot_dir(int chunk_offset);
+
+	/* compression: frame_end of every compressed chunk, nullptr or a
+	 * zero first frame_end for an uncompressed one */
+	VSCodec *codec;
+	uint16_t **frame_index;
+	bool is_compressed(int chunk_offset);
+	int compress_chunk(w_chunk_t *chunk);
+
+	/* free chunks: a lock-free stack linked through free_chunk_next; the
+	 * head holds an ABA tag in the upper and the top chunk in the lower
+	 * 32 bits */
+	std::atomic<uint64_t> free_chunk_head;
+	std::atomic<int> *free_chunk_next;
+	std::atomic<bool> *is_free_chunk;
+	std::atomic<int> free_chunk_num;
+	/* free chunks taken ahead by each writer slot */
+	int reserved_chunk[MTS_VS_WRITER_NUM][MTS_VS_CHUNK_RESERVE];
+	int reserved_chunk_num[MTS_VS_WRITER_NUM];
 	std::vector<vs_bitmap> *vs_bitmap_info;
+	/* bytes of the records set in vs_bitmap_info */
+	uint32_t *valid_bytes;
+	/* victim candidates: used chunks bucketed by their valid bytes in
+	 * MTS_VS_GC_BUCKET_SIZE units, oldest first. Only gc_thread touches
+	 * them: set/clear_vs_bitmap_info() merely queue a changed chunk on
+	 * stale_chunk_head, and the queue is filed before a victim is picked. */
+	std::vector<std::set<std::pair<uint64_t, int>>> *victim_bucket;
+	int *filed_bucket;	/* bucket of each chunk, 0 if in none */
+	uint64_t *filed_stamp;	/* chunk_stamp it was filed with */
+	std::atomic<bool> *is_stale_chunk;
+	int *stale_chunk_next;
+	std::atomic<int> stale_chunk_head;	/* -1 ends the queue */
+	void mark_stale_chunk(int chunk_offset);
+	void file_stale_chunks();
+	void file_chunk(int chunk_offset);
+	/* chunk_clock when each chunk was last opened for writing */
+	uint64_t *chunk_stamp;
+	std::atomic<uint64_t> chunk_clock;
+	/* chunks taken out of victim_bucket by a running GC */
+	std::vector<bool> *gc_victim_info;
+	/* chunk_lock[c % MTS_VS_CHUNK_LOCK_NUM] guards vs_bitmap_info and
+	 * valid_bytes of chunk c */
+	SpinLock chunk_lock[MTS_VS_CHUNK_LOCK_NUM];
+	SpinLock &chunk_lock_of(int chunk_offset) {
+	    return chunk_lock[chunk_offset % MTS_VS_CHUNK_LOCK_NUM];
+	}
+
+	/* space map checkpoints */
+	vs_space_map_t *space_map;
+	std::vector<bool> *is_dirty_chunk;
+	std::vector<int> *dirty_chunk_list;
+	bool ckpt_full;	/* the map on NVM is not ours yet */
+	uint64_t log_gen;	/* generation the changes are logged with */
+	int nr_logged;	/* dirty_log slots taken in log_gen */
+	/* dirty_log slots taken, not written yet, by the array */
+	std::atomic<int> log_inflight[2];
+	/* guards is_dirty_chunk, dirty_chunk_list and the above; the log
+	 * itself is written after it is released */
+	SpinLock dirty_lock;
+	/* shared by syncs with the AddressTable, taken by a checkpoint to
+	 * switch generations */
+	std::shared_mutex ckpt_mutex;
+	void init_space_map();
+	vs_dirty_log_t log_dirty_chunk(int chunk_offset);
+	void persist_dirty_log(vs_dirty_log_t log, bool drain = true);
+	void log_linked_chunks(std::vector<moved_entry_t> *moved_entry_list);
+	void open_w_slot(int oplog_id);
+	w_chunk_t *new_w_chunk(int id, int stream);
+	void free_w_chunk(w_chunk_t *chunk);
+	int prep_w_chunk(struct io_uring *ring, w_chunk_t *chunk, int nr_io);
+	w_chunk_t *next_w_chunk(int oplog_id, int stream);
+	void reap_w_ring(int ring_idx, bool wait);
+	void complete_w_chunk(w_chunk_t *chunk);
+	void rebuild_chunk_lists(bool from_map);
 
 	/* io_uring completion */
 	std::thread finisher;
 	void listener_thread();
 
     public:
-	std::atomic<uint64_t> total_vs_write_count;
+	std::atomic<uint64_t> total_vs_write_bytes;
 	int fd[1];
 	mutable std::shared_mutex s_mutex_;
 	mutable std::mutex mutex_;
 	std::atomic<bool> is_writing;
 	std::atomic<bool> is_recovered;
 
+	/* load of the device, for placing reclaimed chunks */
+	std::atomic<int> w_inflight;	/* chunks written, not completed yet */
+	std::atomic<uint64_t> r_lat_ewma;	/* of lookups, in cycles */
+	std::atomic<uint64_t> w_lat_ewma;	/* of chunk writes, in cycles */
+	void add_latency(std::atomic<uint64_t> *ewma, uint64_t cycles);
+	double placement_cost();
+
 	std::atomic<int> cur_ring_idx;
 	std::atomic<int> last_ring_idx;
 	bool r_ring_bitmap[IO_URING_RRING_NUM];
+	bool r_ring_ready[IO_URING_RRING_NUM];
 	bool scan_r_ring_bitmap[IO_URING_RRING_NUM];
 
 	bool cur_pending_vec_ready[IO_URING_RRING_NUM];;
 
-	uint64_t ready_timestamp[MTS_VS_NUM][IO_URING_RRING_NUM][R_QD];
-	uint64_t work_timestamp[MTS_VS_NUM][IO_URING_RRING_NUM][R_QD];
+	uint64_t ready_timestamp[MTS_VS_MAX_NUM][IO_URING_RRING_NUM][R_QD];
+	uint64_t work_timestamp[MTS_VS_MAX_NUM][IO_URING_RRING_NUM][R_QD];
 
 	std::atomic<int> pending_ios[IO_URING_RRING_NUM];
 	bool is_working[IO_URING_RRING_NUM];
-	std::vector<at_entry_t *> *src_at_entry_vec[IO_URING_RRING_NUM];
-	std::vector<at_entry_t *> *dst_at_entry_vec[IO_URING_RRING_NUM];
+	std::vector<aio_req_t> *src_at_entry_vec[IO_URING_RRING_NUM];
+	std::vector<aio_req_t> *dst_at_entry_vec[IO_URING_RRING_NUM];
+	/* read requests in flight, indexed by the slot of r_buffer */
+	aio_req_t r_req[IO_URING_RRING_NUM][R_QD];
+	/* where the record of each slot lands in r_region */
+	vs_entry_t *r_entry[IO_URING_RRING_NUM][R_QD];
+	vs_read_t r_info[IO_URING_RRING_NUM][R_QD];
 
 	int s_is_working[IO_URING_SRING_NUM];
 
 	/* io_uring */
 	/* for read() */
+	/* one registered region of R_QD * READ_IO_SIZE per ring, so that
+	 * coalesced scan reads may span several slots of r_buffer */
+	struct iovec r_region[IO_URING_RRING_NUM];
 	struct iovec r_buffer[IO_URING_RRING_NUM][R_QD];
 	struct io_uring r_ring[IO_URING_RRING_NUM];
 	struct io_uring scan_r_ring[IO_URING_SRING_NUM];
@@ -150,34 +384,46 @@ class ValueStorage {
 	~ValueStorage();
 
 	uint32_t get_vs_id();
+	int get_node();
+	void open_r_ring(int ring_idx);
 	void init_free_chunk_list();
-	void init_used_chunk_list();
+	void init_victim_bucket();
 	void init_vs_bitmap_info();
 	void set_vs_bitmap_info(int chunk_offset, int vs_entry_offset);
 	void clear_vs_bitmap_info(int chunk_offset, int vs_entry_offset);
+	void recover_slot(int64_t vs_offset);
+	void recover_chunk_info(bool from_map);
+	bool load_space_map();
+	void checkpoint_space_map();
+	bool slot_valid(int chunk_offset, int slot);
+	size_t valid_slots(int chunk_offset);
 	int is_empty(int chunk_offset);
 	int need_gc();
 
 	/* write() */
-	vs_entry_t alloc(Key_t key, Val_t val, at_entry_t *at_entry);
-	void put_vs_entry(int oplog_id, Key_t key, Val_t val, at_entry_t *at_entry);
+	bool add_record(w_chunk_t *chunk, at_entry_t *at_entry, const Key_t &key, const char *val, uint32_t len);
+	void put_vs_entry(int oplog_id, Key_t key, const char *val, uint32_t len, at_entry_t *at_entry, int stream = VS_STREAM_COLD);
 	void forced_write_chunk(int oplog_id);
 	void add_moved_entry_list(std::vector<moved_entry_t> *moved_entry_list, int chunk_offset, int entry_offset, vs_entry_t *vs_entry, OpForm::Operation op_type);
-	void sync_with_at(std::vector<moved_entry_t> *moved_entry_list, std::vector<std::pair<Key_t, at_entry_t *>> *s_moved_entry_list);
+	void sync_with_at(std::vector<moved_entry_t> *moved_entry_list);
 
 	/* read() */
-	Val_t get_val(at_entry_t *at_entry);
-	int get_val_ccsync(std::vector<at_entry_t *> *vec, int ring_idx);
-	int get_val_ccsync(at_entry_t *at_entry, int ring_idx);
+	bool get_val(at_entry_t *at_entry, Value_t *val, Key_t *key = nullptr);
+	int get_val_ccsync(std::vector<aio_req_t> *vec, int ring_idx);
+	void serve_val_sync(aio_req_t *req);
+	int get_r_slots(struct io_uring_cqe *r_cqe, int *first_slot);
+	void locate_entry(int64_t vs_offset, off64_t *io_offset, size_t *io_size, size_t *entry_pos, vs_read_t *rd);
+	void inflate_frames(char *buf, vs_read_t *rd);
+	vs_entry_t *finish_read(int ring_idx, int slot);
+	int submit_val_batch(at_entry_t **at_entries, int nr, int *slots, int ring_idx);
+	void wait_val_batch(int pending, int ring_idx);
 
 
 	/* scan() */
 	int get_val_scan(std::vector<at_entry_t *> *cur_at_entry, int ring_idx);
+	int submit_val_scan(std::vector<at_entry_t *> *cur_at_entry, int ring_idx, int *nr_slots);
 
-	/* caching */
-	cq_entry_t *make_cq_entry(at_entry_t *at_entry, Val_t val);
-
-	void init_w_chunk(int oplog_id);
+	void init_w_chunk(int oplog_id, int stream);
 	void write_chunk(w_chunk_t *chunk, bool write_type);
 
 	void link_to_at(int chunk_idx, int entry_idx, at_entry_t *at_entry);
@@ -185,22 +431,33 @@ class ValueStorage {
 	void gc_link_to_at(int chunk_idx, int entry_idx, at_entry_t *at_entry);
 
 	void sort_w_buffer(w_chunk_t *w_chunk);
-	void *sort_moved_entry(std::vector<moved_entry_t> *moved_entry_list, std::vector<std::pair<Key_t, at_entry_t *>> *s_moved_entry_list);
 
 	/* Garbage Collection */
 	bool not_enough_free_chunk();
-	int get_free_chunk_offset();
+	int pop_free_chunk();
+	int alloc_free_chunk();
+	int get_free_chunk_offset(int oplog_id = -1);
+	unsigned int get_free_chunk_num();
 	unsigned int get_used_chunk_num();
+	void gc_thread_exec();
+	void gc_throttle();
 	bool garbage_collection();
 	void init_gc_w_chunk();
 	void add_free_chunk_list(int free_chunk_offset);
 	void write_gc_w_chunk(int gc_w_chunk_offset);
-	bool read_gc_r_chunk(int gc_r_offset);
-	int get_victim_chunk_offset(unsigned int *chunk_read_cnt);
-	void gc_sync_with_at(std::vector<moved_entry_t> *gc_moved_entry_list, std::vector<std::pair<Key_t, at_entry_t *>> *s_gc_moved_entry_list);
+	int submit_gc_r_chunk(int gc_r_chunk_offset, char *buffer);
+	void wait_gc_r_chunk(int pending);
+	void expand_chunk(char *buffer);
+	bool worth_gc();
+	int get_victim_chunk_offset();
+	void put_back_victims(std::vector<int> *victims);
+	void gc_sync_with_at(std::vector<moved_entry_t> *gc_moved_entry_list);
 
-	int create_used_chunk_list();
 	void check_all_chunks();
 };
 
+/* placement of reclaimed and evicted chunks over the ValueStorages */
+void init_vs_placement(const double *weight);
+ValueStorage *pick_vs_for_write();
+
 #endif /* MTS_VALUESTORAGE_H */
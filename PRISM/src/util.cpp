@@ -1,8 +1,9 @@
 #include "util.h"
 #include "numa-config.h"
 #include <sys/time.h>
-
-#define MAX_STATS 10000000UL
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <numa.h>
 
 void cache_prefetch(char *addr, int size, int locality) {
     int iter = size / L1_CACHE_BYTES;
@@ -128,76 +129,80 @@ void pin_thread(std::thread *t, int socket, int physical_cpu, int smt) {
     return;
 }
 
-// STATS //////////////////////////////////////////////////////////////////////////////////////////
-struct stats {
-    uint64_t *timing_time;
-    uint64_t *timing_value;
-    size_t timing_idx;
-    size_t max_timing_idx;
-} stats;
-
-int cmp_uint(const void *_a, const void *_b) {
-    uint64_t a = *(uint64_t*)_a;
-    uint64_t b = *(uint64_t*)_b;
-    if(a > b)
-	return 1;
-    else if(a < b)
+/*
+ * Runs the calling thread on a socket and prefers its memory, so that what
+ * it allocates and touches, and threads it spawns, stay there. node < 0
+ * lets the thread run and allocate anywhere again.
+ */
+void bind_to_node(int node) {
+    if(numa_available() < 0)
+	return;
+
+    if(node < 0 || node > numa_max_node()) {
+	numa_run_on_node(-1);
+	numa_set_localalloc();
+	return;
+    }
+
+    if(numa_run_on_node(node) != 0)
+	ts_trace(TS_INFO, "Failed to run on node %d\n", node);
+    numa_set_preferred(node);
+}
+
+/* Socket of the block device behind fd, -1 if sysfs does not tell */
+int get_device_node(int fd) {
+    /* a partition inherits the node of its disk */
+    const char *links[] = {"device/numa_node", "device/device/numa_node",
+	"../device/numa_node", "../device/device/numa_node"};
+    struct stat st;
+    char path[128];
+    int node = -1;
+
+    if(fstat(fd, &st) < 0)
 	return -1;
-    else
-	return 0;
+
+    for(unsigned int i = 0; i < sizeof(links) / sizeof(links[0]) && node < 0; i++) {
+	sprintf(path, "/sys/dev/block/%u:%u/%s", major(st.st_dev), minor(st.st_dev), links[i]);
+	FILE *fp = fopen(path, "r");
+	if(fp == NULL)
+	    continue;
+	if(fscanf(fp, "%d", &node) != 1)
+	    node = -1;
+	fclose(fp);
+    }
+
+    return node;
 }
 
+// STATS //////////////////////////////////////////////////////////////////////////////////////////
+/* MTS_STATS_LATENCY samples go to the STAT_TIMING histogram of the thread */
 void clear_timing_stat() {
-    stats.timing_idx = 0;
+    stat_reset(STAT_TIMING);
 }
 
 void add_timing_stat(uint64_t elapsed, uint64_t location) {
-    if(!stats.timing_value) {
-	int lat_stats = MAX_STATS;
-	stats.timing_value = (uint64_t *)malloc(lat_stats * sizeof(*stats.timing_value));
-	memset(stats.timing_value, 0, lat_stats * sizeof(*stats.timing_value));
-	stats.timing_idx = 0;
-	stats.max_timing_idx = lat_stats;
-    }
-    if(stats.timing_idx >= stats.max_timing_idx) {
-	stats.timing_idx = 0;
-    }
-    stats.timing_value[stats.timing_idx] = elapsed;
-    stats.timing_idx++;
+    stat_record(STAT_TIMING, elapsed);
 }
 
 void print_stats() {
-    uint64_t avg = 0;
+    mts_stats_t *stats = new mts_stats_t;
+    stat_collect(stats);
 
-    if(stats.timing_idx == 0) {
+    StatHistogram &h = stats->latency[STAT_TIMING];
+    if(h.count == 0) {
 	printf("#No stat has been collected\n");
+	delete stats;
 	return;
     }
 
-    int lat_stats = MAX_STATS;
-    uint64_t last = lat_stats;
-
-    /* for debugging */
-    int j = 0;
-    for(int i = 0; i < last; i++) {
-	if(stats.timing_value[i] > 0) {
-	    j++;
-	}     
-    }
-
-    last = j;
-    for(uint64_t i = 1; i < last; i++) {
-	avg += stats.timing_value[i];
-    }
-
-    qsort(stats.timing_value, last, sizeof(*stats.timing_value), cmp_uint);
-    printf("AVG %lu\n", cycles_to_us(avg/last));
-    printf("50p %lu\n", cycles_to_us(stats.timing_value[last*50/100]));
-    printf("90p %lu\n", cycles_to_us(stats.timing_value[last*90/100]));
-    printf("95p %lu\n", cycles_to_us(stats.timing_value[last*95/100]));
-    printf("99p %lu\n", cycles_to_us(stats.timing_value[last*99/100]));
+    printf("AVG %lu\n", (uint64_t)h.mean_ns() / 1000);
+    printf("50p %lu\n", h.percentile_ns(50) / 1000);
+    printf("90p %lu\n", h.percentile_ns(90) / 1000);
+    printf("95p %lu\n", h.percentile_ns(95) / 1000);
+    printf("99p %lu\n", h.percentile_ns(99) / 1000);
 
-    stats.timing_idx = 0;
+    stat_reset(STAT_TIMING);
+    delete stats;
 } 
 
 uint64_t mts_get_now() {
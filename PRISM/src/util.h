@@ -16,6 +16,8 @@ uint64_t cycles_to_us(uint64_t cycles);
 unsigned long tacc_rdtscp(int *chip, int *core);
 void pin_thread(std::thread *t, int thread_id, int num_threads);
 void pin_thread(std::thread *t, int socket, int physical_cpu, int smp);
+void bind_to_node(int node);
+int get_device_node(int fd);
 void add_timing_stat(uint64_t elapsed, uint64_t location);
 void print_stats();
 void clear_timing_stat();
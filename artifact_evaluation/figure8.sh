@@ -240,13 +240,13 @@ do
 				    thread_num=1
 				    io_completer=8
 
-				    sed -i "5s/.*/#define MTS_THREAD_NUM ${thread_num}/g" ${PRISM_DIR}/include/mts-config.h
-				    sed -i "6s/.*/#define KV_SIZE ${kv_size}UL/g" ${PRISM_DIR}/include/mts-config.h
-				    sed -i "25s/.*/#define MTS_OPLOG_G_SIZE (${pwb_size}UL * 1UL * 1024UL * 1024UL)/g" ${PRISM_DIR}/include/mts-config.h
-				    sed -i "35s/.*/#define MTS_VS_DISK_NUM ${disk_num}/g" ${PRISM_DIR}/include/mts-config.h
-				    sed -i "51s/.*/#define R_QD ${wkld_qd}/g" ${PRISM_DIR}/include/mts-config.h
-				    sed -i "60s/.*/#define IO_COMPLETER_NUM ${io_completer}/g" ${PRISM_DIR}/include/mts-config.h
-				    sed -i "65s/.*/#define MTS_DRAMCACHE_SIZE ((${svc_size}UL * 1UL * 1024UL * 1024UL))/g" ${PRISM_DIR}/include/mts-config.h
+				    sed -i "s/^#define MTS_THREAD_NUM .*/#define MTS_THREAD_NUM ${thread_num}/g" ${PRISM_DIR}/include/mts-config.h
+				    sed -i "s/^#define KV_SIZE .*/#define KV_SIZE ${kv_size}UL/g" ${PRISM_DIR}/include/mts-config.h
+				    sed -i "s/^#define MTS_OPLOG_G_SIZE .*/#define MTS_OPLOG_G_SIZE (${pwb_size}UL * 1UL * 1024UL * 1024UL)/g" ${PRISM_DIR}/include/mts-config.h
+				    sed -i "s/^#define MTS_VS_DISK_NUM .*/#define MTS_VS_DISK_NUM ${disk_num}/g" ${PRISM_DIR}/include/mts-config.h
+				    sed -i "s/^#define R_QD .*/#define R_QD ${wkld_qd}/g" ${PRISM_DIR}/include/mts-config.h
+				    sed -i "s/^#define IO_COMPLETER_NUM .*/#define IO_COMPLETER_NUM ${io_completer}/g" ${PRISM_DIR}/include/mts-config.h
+				    sed -i "s/^#define MTS_DRAMCACHE_SIZE .*/#define MTS_DRAMCACHE_SIZE ((${svc_size}UL * 1UL * 1024UL * 1024UL))/g" ${PRISM_DIR}/include/mts-config.h
 
 				    BUILD
 
@@ -257,7 +257,7 @@ do
 
 					    if [[ $workload_type == "e" ]];
 					    then
-						sed -i "51s/.*/#define R_QD ${WKLD_E_QD}/g" ${PRISM_DIR}/include/mts-config.h
+						sed -i "s/^#define R_QD .*/#define R_QD ${WKLD_E_QD}/g" ${PRISM_DIR}/include/mts-config.h
 						BUILD
 					    fi
 
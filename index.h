@@ -1,5 +1,6 @@
 
 #include <iostream>
+#include <cstring>
 #include "indexkey.h"
 #include "./PRISM/include/MTS.h"
 #include "BwTree/bwtree.h"
@@ -68,25 +69,27 @@ class MTSIndex : public Index<KeyType, KeyComparator>
   //void UnregisterThread(size_t thread_id) {}
 
   bool insert(KeyType key, uint64_t value, threadinfo *ti) {
-    idx.insert(key, value);
+    idx.insert(key, make_value(value));
     return true;
   }
 
   uint64_t find(KeyType key, std::vector<uint64_t> *v, threadinfo *ti) {
-    uint64_t result;
-    result = idx.lookup(key);
+    uint64_t result = 0;
+    Value_t val = idx.lookup(key);
+    if(val.size() >= sizeof(result))
+      memcpy(&result, val.data(), sizeof(result));
     v->clear();
     v->push_back(result);
     return 0;
   }
 
   bool upsert(KeyType key, uint64_t value, threadinfo *ti) {
-    idx.update(key, value);
+    idx.update(key, make_value(value));
     return true;
   }
 
   uint64_t scan(KeyType key, int range, threadinfo *ti) {
-    std::vector<KeyType> result;
+    std::vector<Value_t> result;
     uint64_t size = idx.scan(key, range, result);
     //if(range != size) printf("%d %d\n", range, size);
     return size;
@@ -111,6 +114,13 @@ class MTSIndex : public Index<KeyType, KeyComparator>
  private:
  MTS idx;
 
+  // A KV_SIZE value that starts with the workload's 8-byte value
+  static Value_t make_value(uint64_t value) {
+    Value_t val(KV_SIZE, '\0');
+    memcpy(&val[0], &value, sizeof(value));
+    return val;
+  }
+
 };
 
 #endif